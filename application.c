@@ -30,30 +30,117 @@ typedef struct
 
 static const application_function_table_t application_function_table[];
 
-app_action_t application_content(string_t *src, string_t *dst)
+enum
 {
-	string_init(varname_io, "trigger.status.io");
-	string_init(varname_pin, "trigger.status.pin");
+	command_index_size = 256,
+};
+
+_Static_assert((command_index_size & (command_index_size - 1)) == 0, "command_index_size not a power of two");
+
+// open addressing hash index into application_function_table, both command names,
+// 0 = empty slot, otherwise entry index + 1, built on first use
+
+static uint8_t command_index[command_index_size];
+static _Bool command_index_valid = false;
 
+attr_pure static unsigned int command_hash(const char *name, int length)
+{
+	return(fnv1a_hash(name, length) & (command_index_size - 1));
+}
+
+static void command_index_insert(const char *name, unsigned int entry)
+{
+	unsigned int slot, probe;
+
+	slot = command_hash(name, strlen(name));
+
+	for(probe = 0; probe < command_index_size; probe++, slot = (slot + 1) & (command_index_size - 1))
+	{
+		if(command_index[slot] == 0)
+		{
+			command_index[slot] = entry + 1;
+			return;
+		}
+	}
+
+	log("application: command index full\n");
+}
+
+static void command_index_build(void)
+{
+	unsigned int entry;
+
+	memset(command_index, 0, sizeof(command_index));
+
+	for(entry = 0; application_function_table[entry].function; entry++)
+	{
+		command_index_insert(application_function_table[entry].command1, entry);
+
+		if(strcmp(application_function_table[entry].command1, application_function_table[entry].command2))
+			command_index_insert(application_function_table[entry].command2, entry);
+	}
+
+	command_index_valid = true;
+}
+
+static const application_function_table_t *find_command(const string_t *name)
+{
 	const application_function_table_t *tableptr;
+	unsigned int slot, probe;
+	uint32_t time_start;
+
+	time_start = system_get_time();
+	tableptr = (const application_function_table_t *)0;
+
+	if(!command_index_valid)
+		command_index_build();
+
+	slot = command_hash(string_buffer(name), string_length(name));
+
+	for(probe = 0; probe < command_index_size; probe++, slot = (slot + 1) & (command_index_size - 1))
+	{
+		if(command_index[slot] == 0)
+			break;
+
+		if(string_match_cstr(name, application_function_table[command_index[slot] - 1].command1) ||
+				string_match_cstr(name, application_function_table[command_index[slot] - 1].command2))
+		{
+			tableptr = &application_function_table[command_index[slot] - 1];
+			break;
+		}
+	}
+
+	stat_cmd_lookups++;
+	stat_cmd_lookup_time_us += system_get_time() - time_start;
+
+	return(tableptr);
+}
+
+static void trigger_status(void)
+{
+	config_handle_new(handle_io, "trigger.status.io");
+	config_handle_new(handle_pin, "trigger.status.pin");
+
 	int status_io, status_pin;
 
-	if(config_get_int(&varname_io, -1, -1, &status_io) &&
-			config_get_int(&varname_pin, -1, -1, &status_pin) &&
+	if(config_handle_get_int(&handle_io, -1, -1, &status_io) &&
+			config_handle_get_int(&handle_pin, -1, -1, &status_pin) &&
 			(status_io != -1) && (status_pin != -1))
 	{
 		io_trigger_pin((string_t *)0, status_io, status_pin, io_trigger_on);
 	}
+}
+
+app_action_t application_content(string_t *src, string_t *dst)
+{
+	const application_function_table_t *tableptr;
+
+	trigger_status();
 
 	if(parse_string(0, src, dst, ' ') != parse_ok)
 		return(app_action_empty);
 
-	for(tableptr = application_function_table; tableptr->function; tableptr++)
-		if(string_match_cstr(dst, tableptr->command1) ||
-				string_match_cstr(dst, tableptr->command2))
-			break;
-
-	if(tableptr->function)
+	if((tableptr = find_command(dst)))
 	{
 		string_clear(dst);
 		return(tableptr->function(src, dst));
@@ -63,6 +150,251 @@ app_action_t application_content(string_t *src, string_t *dst)
 	return(app_action_error);
 }
 
+static void binary_reply(string_t *dst, unsigned int opcode, app_action_t action)
+{
+	enum { reply_header_size = application_binary_header_size + 2 };
+	char *buffer = string_buffer_nonconst(dst);
+	int length = string_length(dst);
+
+	if((length + reply_header_size) > string_size(dst))
+		length = string_size(dst) - reply_header_size;
+
+	memmove(buffer + reply_header_size, buffer, length);
+
+	buffer[0] = application_binary_magic;
+	buffer[1] = (length + 2) & 0xff;
+	buffer[2] = ((length + 2) >> 8) & 0xff;
+	buffer[3] = opcode;
+	buffer[4] = action;
+
+	string_setlength(dst, length + reply_header_size);
+}
+
+// native binary handlers, they take the arguments as parsed by application_content_binary
+// and reply with binary values (little endian), errors are replied as text
+
+static void binary_append_uint32(string_t *dst, uint32_t value)
+{
+	string_append_char(dst, (value >>  0) & 0xff);
+	string_append_char(dst, (value >>  8) & 0xff);
+	string_append_char(dst, (value >> 16) & 0xff);
+	string_append_char(dst, (value >> 24) & 0xff);
+}
+
+static app_action_t binary_io_read(unsigned int argc, const int32_t *argv, string_t *dst)
+{
+	uint32_t value;
+
+	if((argc != 2) || (argv[0] < 0) || (argv[1] < 0))
+	{
+		string_append(dst, "ERROR: io-read: io and pin required\n");
+		return(app_action_error);
+	}
+
+	if(io_read_pin(dst, argv[0], argv[1], &value) != io_ok)
+		return(app_action_error);
+
+	binary_append_uint32(dst, value);
+
+	return(app_action_normal);
+}
+
+static app_action_t binary_io_write(unsigned int argc, const int32_t *argv, string_t *dst)
+{
+	uint32_t value;
+
+	if((argc != 3) || (argv[0] < 0) || (argv[1] < 0))
+	{
+		string_append(dst, "ERROR: io-write: io, pin and value required\n");
+		return(app_action_error);
+	}
+
+	if(io_write_pin(dst, argv[0], argv[1], (uint32_t)argv[2]) != io_ok)
+		return(app_action_error);
+
+	if(io_read_pin(dst, argv[0], argv[1], &value) != io_ok)
+		return(app_action_error);
+
+	binary_append_uint32(dst, value);
+
+	return(app_action_normal);
+}
+
+/*
+ * The binary opcodes are part of the protocol, unlike the position of a command in
+ * application_function_table they don't change between builds. Never renumber or reuse
+ * an opcode, new commands get the next free one. Commands without a native handler
+ * are run through their text handler, with the arguments converted back into a command line.
+ */
+
+typedef struct
+{
+	unsigned int opcode;
+	const char *command;
+	app_action_t (*function)(unsigned int argc, const int32_t *argv, string_t *dst);
+} application_binary_table_t;
+
+static const application_binary_table_t application_binary_table[] =
+{
+	{ 0x01,	"io-read",			binary_io_read },
+	{ 0x02,	"io-write",			binary_io_write },
+	{ 0x03,	"io-trigger",		(void *)0 },
+	{ 0x04,	"io-set-mask",		(void *)0 },
+	{ 0x05,	"i2c-sensor-read",	(void *)0 },
+	{ 0x06,	"identification",	(void *)0 },
+	{ 0x07,	"stats",			(void *)0 },
+	{ 0x08,	"stats-counters",	(void *)0 },
+	{ 0x09,	"display-set",		(void *)0 },
+	{ 0x0a,	"uart-write",		(void *)0 },
+	{ 0x00,	"",					(void *)0 },
+};
+
+enum { binary_argc_max = 8 };
+
+app_action_t application_content_binary(string_t *src, string_t *dst)
+{
+	string_new(, command, 128);
+	string_t name;
+	const application_function_table_t *tableptr;
+	const application_binary_table_t *binaryptr;
+	const uint8_t *frame;
+	unsigned int length, opcode, argc, arg, offset;
+	int32_t argv[binary_argc_max];
+	app_action_t action;
+
+	frame = (const uint8_t *)string_buffer(src);
+	length = string_length(src);
+	opcode = 0;
+
+	trigger_status();
+	stat_cmd_binary++;
+
+	if((length < (application_binary_header_size + 2)) || (frame[0] != application_binary_magic) ||
+			((unsigned int)(frame[1] | (frame[2] << 8)) != (length - application_binary_header_size)))
+	{
+		string_append(dst, "ERROR: invalid binary frame\n");
+		action = app_action_error;
+		goto done;
+	}
+
+	opcode = frame[3];
+	argc = frame[4];
+	offset = application_binary_header_size + 2 + (argc * sizeof(int32_t));
+
+	if(argc > binary_argc_max)
+	{
+		string_format(dst, "ERROR: binary frame has more than %u arguments\n", (unsigned int)binary_argc_max);
+		action = app_action_error;
+		goto done;
+	}
+
+	if(offset > length)
+	{
+		string_format(dst, "ERROR: binary frame too short for %u arguments\n", argc);
+		action = app_action_error;
+		goto done;
+	}
+
+	if(opcode == application_binary_lookup)
+	{
+		string_set(&name, string_buffer_nonconst(src) + offset, length - offset, length - offset);
+
+		if(!(tableptr = find_command(&name)))
+		{
+			string_append(dst, "ERROR: command unknown\n");
+			action = app_action_error;
+			goto done;
+		}
+
+		for(binaryptr = application_binary_table; binaryptr->opcode; binaryptr++)
+			if(!strcmp(binaryptr->command, tableptr->command2))
+				break;
+
+		if(!binaryptr->opcode)
+		{
+			string_format(dst, "ERROR: command %s has no binary opcode\n", tableptr->command2);
+			action = app_action_error;
+			goto done;
+		}
+
+		string_append_char(dst, binaryptr->opcode);
+		action = app_action_normal;
+		goto done;
+	}
+
+	for(binaryptr = application_binary_table; binaryptr->opcode; binaryptr++)
+		if(binaryptr->opcode == opcode)
+			break;
+
+	if(!binaryptr->opcode)
+	{
+		string_format(dst, "ERROR: opcode %u unknown\n", opcode);
+		action = app_action_error;
+		goto done;
+	}
+
+	for(arg = 0; arg < argc; arg++)
+		argv[arg] = frame[5 + (arg * 4) + 0] | (frame[5 + (arg * 4) + 1] << 8) | (frame[5 + (arg * 4) + 2] << 16) | (frame[5 + (arg * 4) + 3] << 24);
+
+	if(binaryptr->function)
+	{
+		if(offset < length)
+		{
+			string_format(dst, "ERROR: %s takes no string argument\n", binaryptr->command);
+			action = app_action_error;
+			goto done;
+		}
+
+		action = binaryptr->function(argc, argv, dst);
+		goto done;
+	}
+
+	string_set(&name, (char *)binaryptr->command, strlen(binaryptr->command), strlen(binaryptr->command));
+
+	if(!(tableptr = find_command(&name)))
+	{
+		string_format(dst, "ERROR: opcode %u: command %s not available\n", opcode, binaryptr->command);
+		action = app_action_error;
+		goto done;
+	}
+
+	// the text handlers need a command line, it must fit completely,
+	// a truncated argument would silently change the command
+
+	string_format(&command, "%s", tableptr->command1);
+
+	for(arg = 0; arg < argc; arg++)
+	{
+		if((string_length(&command) + sizeof(" -2147483648")) > (unsigned int)string_size(&command))
+		{
+			string_append(dst, "ERROR: binary arguments too long\n");
+			action = app_action_error;
+			goto done;
+		}
+
+		string_format(&command, " %d", (int)argv[arg]);
+	}
+
+	if(offset < length)
+	{
+		if((string_length(&command) + 1 + (length - offset)) > (unsigned int)string_size(&command))
+		{
+			string_append(dst, "ERROR: binary string argument too long\n");
+			action = app_action_error;
+			goto done;
+		}
+
+		string_append(&command, " ");
+		string_splice(&command, -1, src, offset, length - offset);
+	}
+
+	action = tableptr->function(&command, dst);
+
+done:
+	binary_reply(dst, opcode, action);
+	return(action);
+}
+
 static app_action_t application_function_config_dump(string_t *src, string_t *dst)
 {
 	config_dump(dst);
@@ -228,6 +560,124 @@ static app_action_t application_function_help(string_t *src, string_t *dst)
 	return(app_action_normal);
 }
 
+// these need the complete (sector sized) reply buffer, carry binary data or (http) take over
+// the connection to stream their reply, they can't run in a batch
+
+static _Bool batch_command_excluded(const string_t *command)
+{
+	static const char *const excluded[] =
+	{
+		"flash-send", "flash-receive", "flash-read", "flash-write", "flash-verify",
+		"flash-write-sector", "flash-write-sector-lz", "flash-checksum", "GET", (const char *)0,
+	};
+	string_new(, name, 32);
+	const application_function_table_t *tableptr;
+	const char *const *entry;
+
+	if((parse_string(0, command, &name, ' ') != parse_ok) || !(tableptr = find_command(&name)))
+		return(false);
+
+	for(entry = excluded; *entry; entry++)
+		if(!strcmp(tableptr->command1, *entry))
+			return(true);
+
+	return(false);
+}
+
+static app_action_t application_function_batch(string_t *src, string_t *dst)
+{
+	static _Bool active = false;
+	static const char *const status_text[] = { "ok", "error", "empty", "disconnect", "ok", "reset" };
+	string_new(, header, 32);
+	string_t command, output;
+	int start, end, used, length, index, errors;
+	app_action_t action;
+	char current;
+
+	// commands are separated by ; using tcp (a newline ends the request), also by newline using udp,
+	// each reply is prefixed with the index and the status of the command
+
+	if(active)
+	{
+		string_append(dst, "ERROR batch: nested batch\n");
+		return(app_action_error);
+	}
+
+	if((start = string_sep(src, 0, 1, ' ')) < 0)
+	{
+		string_append(dst, "ERROR batch: commands required\n");
+		return(app_action_error);
+	}
+
+	active = true;
+	action = app_action_normal;
+
+	for(index = 0, errors = 0; start < string_length(src); start = end + 1)
+	{
+		for(end = start; end < string_length(src); end++)
+			if(((current = string_at(src, end)) == ';') || (current == '\n'))
+				break;
+
+		while((start < end) && (((current = string_at(src, start)) == ' ') || (current == '\r')))
+			start++;
+
+		for(length = end - start; length > 0; length--)
+			if(((current = string_at(src, start + length - 1)) != ' ') && (current != '\r'))
+				break;
+
+		if(length == 0)
+			continue;
+
+		used = string_length(dst);
+		string_set(&command, string_buffer_nonconst(src) + start, length, length);
+		string_set(&output, string_buffer_nonconst(dst) + used, string_size(dst) - used, 0);
+
+		if(batch_command_excluded(&command))
+		{
+			string_append(&output, "ERROR batch: command not allowed in a batch\n");
+			action = app_action_error;
+		}
+		else
+			action = application_content(&command, &output);
+
+		if((action == app_action_error) || (action == app_action_empty))
+			errors++;
+
+		string_clear(&header);
+		string_format(&header, "#%d %s: ", index, status_text[action]);
+
+		length = string_length(&output);
+
+		if((used + string_length(&header) + length) > string_size(dst))
+			length = string_size(dst) - used - string_length(&header);
+
+		if(length < 0)
+		{
+			string_setlength(dst, used);
+			break;
+		}
+
+		memmove(string_buffer_nonconst(dst) + used + string_length(&header), string_buffer(&output), length);
+		memcpy(string_buffer_nonconst(dst) + used, string_buffer(&header), string_length(&header));
+		string_setlength(dst, used + string_length(&header) + length);
+
+		if((string_length(dst) > 0) && (string_at(dst, string_length(dst) - 1) != '\n'))
+			string_append(dst, "\n");
+
+		index++;
+
+		if((action == app_action_disconnect) || (action == app_action_reset))
+			break;
+	}
+
+	active = false;
+
+	if((action == app_action_disconnect) || (action == app_action_reset))
+		return(action);
+
+	return(errors ? app_action_error : app_action_normal);
+}
+
 static app_action_t application_function_identification(string_t *src, string_t *dst)
 {
 	int start;
@@ -294,6 +744,12 @@ static app_action_t application_function_stats_i2c(string_t *src, string_t *dst)
 	return(app_action_normal);
 }
 
+static app_action_t application_function_stats_sockets(string_t *src, string_t *dst)
+{
+	dispatch_stats_sockets(dst);
+	return(app_action_normal);
+}
+
 static app_action_t application_function_stats_wlan(string_t *src, string_t *dst)
 {
 	stats_wlan(dst);
@@ -459,7 +915,7 @@ static app_action_t application_function_sequencer_remove(string_t *src, string_
 static app_action_t application_function_sequencer_add(string_t *src, string_t *dst)
 {
 	static unsigned int start = 0;
-	unsigned int io, pin, duration;
+	unsigned int io, pin, duration, entries, entry, field;
 	int	start_in;
 	uint32_t value;
 	_Bool active;
@@ -470,29 +926,74 @@ static app_action_t application_function_sequencer_add(string_t *src, string_t *
 			(parse_uint(4, src, &value, 0, ' ') != parse_ok) ||
 			(parse_uint(5, src, &duration, 0, ' ') != parse_ok))
 	{
-		string_append(dst, "> usage: sequencer-set index io pin value duration_ms\n");
+		string_append(dst, "> usage: sequencer-set index io pin value duration_ms [io pin value duration_ms ...]\n");
 		return(app_action_error);
 	}
 
 	if(start_in >= 0)
 		start = start_in;
 
-	if(!sequencer_set_entry(start, io, pin, value, duration))
+	// count the entries, a trailing incomplete entry is an error, nothing is written then
+
+	for(entries = 1;; entries++)
+	{
+		for(field = 0; field < 4; field++)
+			if(parse_uint(2 + (entries * 4) + field, src, &value, 0, ' ') != parse_ok)
+				break;
+
+		if(field == 0)
+			break;
+
+		if(field < 4)
+		{
+			string_append(dst, "> usage: sequencer-set index io pin value duration_ms [io pin value duration_ms ...]\n");
+			return(app_action_error);
+		}
+	}
+
+	if(!sequencer_get_entry(start + entries - 1, (_Bool *)0, (int *)0, (int *)0, (uint32_t *)0, (int *)0))
 	{
-		string_append(dst, "> sequencer-set: error setting entry (set)\n");
+		string_format(dst, "> sequencer-set: entries %u-%u out of range\n", start, start + entries - 1);
 		return(app_action_error);
 	}
 
-	if(!sequencer_get_entry(start, &active, &io, &pin, &value, &duration))
+	if(!sequencer_transaction_begin())
 	{
-		string_append(dst, "> sequencer-set: error setting entry (get)\n");
+		string_append(dst, "> sequencer-set: error setting entry (begin)\n");
 		return(app_action_error);
 	}
 
-	string_format(dst, "> sequencer-set: %d: %u/%u %u %u ms %s\n",
-			start, io, pin, value, duration, onoff(active));
+	for(entry = 0; entry < entries; entry++)
+	{
+		if((parse_uint(2 + (entry * 4), src, &io, 0, ' ') != parse_ok) ||
+				(parse_uint(3 + (entry * 4), src, &pin, 0, ' ') != parse_ok) ||
+				(parse_uint(4 + (entry * 4), src, &value, 0, ' ') != parse_ok) ||
+				(parse_uint(5 + (entry * 4), src, &duration, 0, ' ') != parse_ok) ||
+				!sequencer_set_entry(start + entry, io, pin, value, duration))
+		{
+			sequencer_transaction_abort();
+			string_format(dst, "> sequencer-set: error setting entry %u (set)\n", start + entry);
+			return(app_action_error);
+		}
+	}
+
+	if(!sequencer_transaction_commit())
+	{
+		string_append(dst, "> sequencer-set: error setting entry (commit)\n");
+		return(app_action_error);
+	}
+
+	for(entry = 0; entry < entries; entry++, start++)
+	{
+		if(!sequencer_get_entry(start, &active, &io, &pin, &value, &duration))
+		{
+			string_append(dst, "> sequencer-set: error setting entry (get)\n");
+			return(app_action_error);
+		}
 
-	start++;
+		string_format(dst, "> sequencer-set: %d: %u/%u %u %u ms %s\n",
+				start, io, pin, value, duration, onoff(active));
+	}
 
 	return(app_action_normal);
 }
@@ -576,6 +1077,12 @@ static app_action_t application_function_stats_sequencer(string_t *src, string_t
 			sequencer_get_repeats() - 1,
 			(unsigned int)(sequencer_get_current_end_time() - (time_get_us() / 1000)));
 
+		if(sequencer_get_timed())
+			string_format(dst, "> program in ram: %u entries, %u steps late\n",
+				sequencer_get_program_length(), stat_sequencer_steps_late);
+		else
+			string_append(dst, "> program in ram: no, running from flash\n");
+
 		current = sequencer_get_current();
 
 		if(sequencer_get_entry(current, &active, &io, &pin, &value, &duration))
@@ -586,6 +1093,8 @@ static app_action_t application_function_stats_sequencer(string_t *src, string_t
 		}
 	}
 
+	string_format(dst, "> flash sectors written: %u\n", stat_sequencer_sector_writes);
+
 	return(app_action_normal);
 }
 
@@ -773,8 +1282,8 @@ static app_action_t application_function_uart_write(string_t *src, string_t *dst
 			length--;
 	}
 
-	for(; length > 0; length--, start++)
-		uart_send(uart, string_at(src, start));
+	if(length > 0)
+		uart_send_n(uart, string_buffer(src) + start, length);
 
 	uart_flush(uart);
 
@@ -1733,6 +2242,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_quit,
 		"quit",
 	},
+	{
+		"b", "batch",
+		application_function_batch,
+		"batch <command>; <command>; ... (using udp also newline separated)",
+	},
 	{
 		"r", "reset",
 		application_function_reset,
@@ -1758,6 +2272,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_stats_i2c,
 		"stats (i2c)",
 	},
+	{
+		"sk", "stats-sockets",
+		application_function_stats_sockets,
+		"stats (sockets)",
+	},
 	{
 		"ss", "stats-sequencer",
 		application_function_stats_sequencer,
@@ -1878,6 +2397,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_i2c_write_read,
 		"write data to i2c slave and read back data",
 	},
+	{
+		"if", "io-fade",
+		application_function_io_fade,
+		"fade i/o pin to value",
+	},
 	{
 		"im", "io-mode",
 		application_function_io_mode,
@@ -1931,7 +2455,7 @@ static const application_function_table_t application_function_table[] =
 	{
 		"isd", "i2c-sensor-dump",
 		application_function_i2c_sensor_dump,
-		"dump all i2c sensors",
+		"dump all i2c sensors, from the cache, a stale or never sampled sensor is read directly",
 	},
 	{
 		"l", "log-display",
@@ -2093,6 +2617,16 @@ static const application_function_table_t application_function_table[] =
 		application_function_flash_write,
 		"flash-write",
 	},
+	{
+		"flash-write-sector", "flash-write-sector",
+		application_function_flash_write_sector,
+		"flash-write-sector",
+	},
+	{
+		"flash-write-sector-lz", "flash-write-sector-lz",
+		application_function_flash_write_sector_lz,
+		"flash-write-sector-lz",
+	},
 	{
 		"flash-verify", "flash-verify",
 		application_function_flash_verify,
@@ -2103,6 +2637,11 @@ static const application_function_table_t application_function_table[] =
 		application_function_flash_checksum,
 		"flash-checksum",
 	},
+	{
+		"flash-checksum-sectors", "flash-checksum-sectors",
+		application_function_flash_checksum_sectors,
+		"flash-checksum-sectors",
+	},
 	{
 		"flash-select", "flash-select",
 		application_function_flash_select,
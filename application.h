@@ -15,5 +15,22 @@ typedef enum
 
 _Static_assert(sizeof(app_action_t) == 4, "sizeof(app_action_t) != 4");
 
+/*
+ * Binary framing, an opt-in alternative to the text commands, all integers are little endian.
+ * request: magic, length (u16, bytes following), opcode (u8), argc (u8), argc * i32, optional string argument (rest of frame)
+ * reply:   magic, length (u16, bytes following), opcode (u8), status (u8, app_action_t), output of the command
+ * The opcodes are fixed (see application_binary_table), the lookup opcode returns the opcode (u8)
+ * of the command named in the string argument. The io-read and io-write opcodes take their arguments
+ * parsed (io, pin [, value]) and reply with the pin value (u32), the others reply with their text output.
+ */
+
+enum
+{
+	application_binary_magic = 0x01,
+	application_binary_header_size = 3,
+	application_binary_lookup = 0xff,
+};
+
 app_action_t application_content(string_t *src, string_t *dst);
+app_action_t application_content_binary(string_t *src, string_t *dst);
 #endif
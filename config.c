@@ -5,6 +5,7 @@
 #include "i2c_sensor.h"
 #include "ota.h"
 #include "dispatch.h"
+#include "stats.h"
 
 #include <ets_sys.h>
 #include <spi_flash.h>
@@ -16,8 +17,13 @@ enum
 	config_entries_size = 160,
 	config_entry_id_size = 28,
 	config_entry_string_size = 20,
+	config_index_size = 256,
 };
 
+_Static_assert(config_index_size > config_entries_size, "config_index_size <= config_entries_size");
+_Static_assert(config_entries_size < 255, "config_entries_size does not fit config_index");
+_Static_assert((config_index_size & (config_index_size - 1)) == 0, "config_index_size not a power of two");
+
 typedef struct
 {
 	char		id[config_entry_id_size];
@@ -51,6 +57,7 @@ static const config_flag_name_t config_flag_names[] =
 	{	flag_apds6_high_sens,	"apds6-high-sens"	},
 	{	flag_uart1_tx_inv,		"uart1-tx-inv",		},
 	{	flag_udp_term_empty,	"udp-term-empty",	},
+	{	flag_pwm1_spread,		"pwm1-spread",		},
 	{	flag_none,				""					},
 };
 
@@ -58,6 +65,12 @@ uint32_t flags_cache;
 static unsigned int config_entries_length = 0;
 static config_entry_t config_entries[config_entries_size];
 
+// open addressing hash index into config_entries, 0 = empty slot, otherwise entry index + 1
+static uint8_t config_index[config_index_size];
+
+// bumped whenever entries are added or removed, invalidates all cached handles, 0 = never resolved
+static uint32_t config_generation = 1;
+
 void config_flags_to_string(_Bool nl, const char *prefix, string_t *dst)
 {
 	const config_flag_name_t *entry;
@@ -107,29 +120,93 @@ static string_t *expand_varid(const string_t *varid, int index1, int index2)
 	string_clear(&varid_in);
 	string_clear(&varid_out);
 
+	// skip the (expensive) formatting if the id doesn't contain any format specifiers
+
+	if(string_find(varid, 0, '%') < 0)
+	{
+		string_append_string(&varid_out, varid);
+		string_to_cstr(&varid_out);
+		return(&varid_out);
+	}
+
 	string_append_string(&varid_in, varid);
 	string_format_cstr(&varid_out, string_to_cstr(&varid_in), index1, index2);
 
 	return(&varid_out);
 }
 
+attr_pure static unsigned int config_hash(const char *id, int length)
+{
+	return(fnv1a_hash(id, length) & (config_index_size - 1));
+}
+
+static void config_generation_bump(void)
+{
+	if(++config_generation == 0)
+		config_generation = 1;
+}
+
+static void config_index_insert(unsigned int entry)
+{
+	unsigned int slot, probe;
+
+	config_generation_bump();
+
+	slot = config_hash(config_entries[entry].id, strlen(config_entries[entry].id));
+
+	for(probe = 0; probe < config_index_size; probe++, slot = (slot + 1) & (config_index_size - 1))
+	{
+		if(config_index[slot] == 0)
+		{
+			config_index[slot] = entry + 1;
+			return;
+		}
+	}
+
+	log("config: index full\n");
+}
+
+static void config_index_rebuild(void)
+{
+	unsigned int ix;
+
+	memset(config_index, 0, sizeof(config_index));
+	config_generation_bump();
+
+	for(ix = 0; ix < config_entries_length; ix++)
+		if(config_entries[ix].id[0])
+			config_index_insert(ix);
+}
+
 static config_entry_t *find_config_entry(const string_t *id, int index1, int index2)
 {
 	config_entry_t *config_entry;
 	const string_t *varid;
-	unsigned int ix;
+	unsigned int slot, probe;
+	uint32_t time_start;
+
+	time_start = system_get_time();
+	config_entry = (config_entry_t *)0;
 
 	varid = expand_varid(id, index1, index2);
+	slot = config_hash(string_buffer(varid), string_length(varid));
 
-	for(ix = 0; ix < config_entries_length; ix++)
+	for(probe = 0; probe < config_index_size; probe++, slot = (slot + 1) & (config_index_size - 1))
 	{
-		config_entry = &config_entries[ix];
+		if(config_index[slot] == 0)
+			break;
 
-		if(string_match_cstr(varid, config_entry->id))
-			return(config_entry);
+		if(string_match_cstr(varid, config_entries[config_index[slot] - 1].id))
+		{
+			config_entry = &config_entries[config_index[slot] - 1];
+			break;
+		}
 	}
 
-	return((config_entry_t *)0);
+	stat_config_lookups++;
+	stat_config_lookup_time_us += system_get_time() - time_start;
+
+	return(config_entry);
 }
 
 _Bool config_get_string(const string_t *id, int index1, int index2, string_t *value)
@@ -156,6 +233,41 @@ _Bool config_get_int(const string_t *id, int index1, int index2, uint32_t *value
 	return(true);
 }
 
+static config_entry_t *resolve_config_handle(config_handle_t *handle, int index1, int index2)
+{
+	config_entry_t *config_entry;
+
+	if((handle->generation == config_generation) && (handle->index1 == index1) && (handle->index2 == index2))
+	{
+		stat_config_handle_hits++;
+		return((handle->entry < 0) ? (config_entry_t *)0 : &config_entries[handle->entry]);
+	}
+
+	string_new(, id, config_entry_id_size);
+	string_append_cstr_flash(&id, handle->id_flash);
+
+	config_entry = find_config_entry(&id, index1, index2);
+
+	handle->index1 = index1;
+	handle->index2 = index2;
+	handle->generation = config_generation;
+	handle->entry = config_entry ? (config_entry - config_entries) : -1;
+
+	return(config_entry);
+}
+
+_Bool config_handle_get_int(config_handle_t *handle, int index1, int index2, uint32_t *value)
+{
+	config_entry_t *config_entry;
+
+	if(!(config_entry = resolve_config_handle(handle, index1, index2)))
+		return(false);
+
+	*value = config_entry->uint_value;
+
+	return(true);
+}
+
 _Bool config_set_string(const string_t *id, int index1, int index2, const string_t *value, int value_offset, int value_length)
 {
 	string_t string;
@@ -201,6 +313,7 @@ _Bool config_set_string(const string_t *id, int index1, int index2, const string
 
 		varid = expand_varid(id, index1, index2);
 		strecpy(config_current->id, string_to_cstr(varid), config_entry_id_size);
+		config_index_insert(config_current - config_entries);
 	}
 
 	strecpy(config_current->string_value, string_buffer(value) + value_offset, value_length + 1);
@@ -245,6 +358,9 @@ unsigned int config_delete(const string_t *id, int index1, int index2, _Bool wil
 		}
 	}
 
+	if(amount > 0)
+		config_index_rebuild();
+
 	return(amount);
 }
 
@@ -280,6 +396,7 @@ _Bool config_read(void)
 	value_length = 0;
 
 	config_entries_length = 0;
+	config_index_rebuild();
 
 	for(parse_state = state_parse_id; current_index < SPI_FLASH_SEC_SIZE; current_index++)
 	{
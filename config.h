@@ -31,8 +31,25 @@ enum
 	flag_apds6_high_sens =	1 << 13,
 	flag_uart1_tx_inv =		1 << 14,
 	flag_udp_term_empty =	1 << 15,
+	flag_pwm1_spread =		1 << 16,
 };
 
+typedef struct
+{
+	const char	*id_flash;
+	int16_t		index1;
+	int16_t		index2;
+	uint32_t	generation;
+	int16_t		entry;
+} config_handle_t;
+
+// resolves a fixed id + indices once, the resolution is cached until a config entry is added or removed
+// only one index pair is cached, so use handles for ids that are always used with the same indices
+
+#define config_handle_new(_name, _id) \
+	static roflash const char _name ## _id_flash[] = _id; \
+	static config_handle_t _name = { .id_flash = _name ## _id_flash, .index1 = -1, .index2 = -1, .generation = 0, .entry = -1 }
+
 void			config_flags_to_string(_Bool nl, const char *, string_t *);
 _Bool			config_flags_change(const string_t *, _Bool add);
 
@@ -42,6 +59,8 @@ _Bool			config_set_string(const string_t *id, int index1, int index2, const stri
 _Bool			config_set_int(const string_t *id, int index1, int index2, uint32_t value);
 unsigned int	config_delete(const string_t *id, int index1, int index2, _Bool wildcard);
 
+_Bool			config_handle_get_int(config_handle_t *handle, int index1, int index2, uint32_t *value);
+
 _Bool			config_read(void);
 unsigned int	config_write(void);
 void			config_dump(string_t *);
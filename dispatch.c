@@ -2,6 +2,8 @@
 
 #include "util.h"
 #include "application.h"
+#include "http.h"
+#include "metrics.h"
 #include "io.h"
 #include "stats.h"
 #include "i2c.h"
@@ -30,7 +32,7 @@ enum
 	command_task_queue_length		= 12,
 
 	timer_task_id					= USER_TASK_PRIO_0,
-	timer_task_queue_length			= 2,
+	timer_task_queue_length			= 4,
 };
 
 static os_event_t uart_task_queue[uart_task_queue_length];
@@ -41,69 +43,300 @@ string_new(attr_flash_align, flash_sector_buffer, 4096);
 
 string_new(static attr_flash_align, command_socket_receive_buffer, 4096 + 64);
 string_new(static attr_flash_align, command_socket_send_buffer, 4096 + 64);
-unsigned int command_left_to_read;
 static lwip_if_socket_t command_socket;
+static _Bool command_pending = false;
+static _Bool command_strip_nl = false;
 
 string_new(static, uart_socket_receive_buffer, 128);
-string_new(static, uart_socket_send_buffer, 128);
 static lwip_if_socket_t uart_socket;
 
 static _Bool uart_bridge_active = false;
+static _Bool uart_bridge_posted = false;
+static _Bool uart_bridge_arrival_valid = false;
+static uint32_t uart_bridge_arrival;
 
 static ETSTimer fast_timer;
 static ETSTimer slow_timer;
 
-iram void dispatch_post_uart(task_command_t command)
+iram _Bool dispatch_post_uart(task_command_t command)
 {
 	if(system_os_post(uart_task_id, command, 0))
+	{
 		stat_task_uart_posted++;
-	else
-		stat_task_uart_failed++;
+		return(true);
+	}
+
+	stat_task_uart_failed++;
+
+	return(false);
 }
 
-iram void dispatch_post_command(task_command_t command)
+iram _Bool dispatch_post_command(task_command_t command)
 {
 	if(system_os_post(command_task_id, command, 0))
+	{
 		stat_task_command_posted++;
-	else
-		stat_task_command_failed++;
+		return(true);
+	}
+
+	stat_task_command_failed++;
+
+	return(false);
 }
 
-iram void dispatch_post_timer(task_command_t command)
+iram _Bool dispatch_post_timer(task_command_t command)
 {
 	if(system_os_post(timer_task_id, command, 0))
+	{
 		stat_task_timer_posted++;
-	else
-		stat_task_timer_failed++;
+		return(true);
+	}
+
+	stat_task_timer_failed++;
+
+	return(false);
 }
 
-static void background_task_bridge_uart(void)
+iram void dispatch_uart_received(void)
 {
-	if(uart_empty(0) || lwip_if_send_buffer_locked(&uart_socket))
+	if(!uart_bridge_active)
 		return;
 
-	string_clear(&uart_socket_send_buffer);
+	if(!uart_bridge_arrival_valid)
+	{
+		uart_bridge_arrival = system_get_time();
+		uart_bridge_arrival_valid = true;
+	}
+
+	if(!uart_bridge_posted)
+		uart_bridge_posted = dispatch_post_command(command_task_uart_bridge);
+}
+
+static void background_task_bridge_uart(void)
+{
+	const char *data;
+	unsigned int length, total;
+	int sent;
+	uint32_t now;
+
+	uart_bridge_posted = false;
+
+	// send directly from the uart receive queue, lwip copies into its own pbufs
+
+	for(total = 0; (length = uart_receive_peek(0, &data)) > 0; total += sent)
+	{
+		if((sent = lwip_if_send_copy(&uart_socket, data, length)) < 0)
+		{
+			// not connected, discard
+
+			stat_uart_bridge_discarded += length;
+			uart_receive_skip(0, length);
+			sent = 0;
+			continue;
+		}
+
+		uart_receive_skip(0, sent);
+
+		if((unsigned int)sent < length)
+			break;
+	}
+
+	if(total > 0)
+	{
+		now = system_get_time();
+
+		stat_uart_bridge_bytes += total;
+
+		if(uart_bridge_arrival_valid)
+		{
+			stat_uart_bridge_latency_last_us = now - uart_bridge_arrival;
+			stat_uart_bridge_latency_max_us = umax(stat_uart_bridge_latency_max_us, stat_uart_bridge_latency_last_us);
+		}
+
+		// the remaining data arrived somewhere before now, take now as (optimistic) estimate
+
+		uart_bridge_arrival = now;
+	}
+
+	uart_bridge_arrival_valid = !uart_empty(0);
+}
+
+static void socket_uart_callback_data_sent(lwip_if_socket_t *socket, unsigned int acked)
+{
+	if(!uart_empty(0))
+		dispatch_uart_received();
+}
+
+/*
+ * The command socket receive buffer is handled as a stream, it may hold more than one request.
+ * Requests end with a newline, except for the commands that carry binary data, they state their length.
+ * Using udp, a datagram is a complete request, also for the binary data commands.
+ * Binary framed requests (see application.h) state their length in the header.
+ * Http requests end with an empty line, the header lines are not separate requests.
+ * Returns the length of the first request, 0 if it's incomplete or -1 if it can never
+ * be completed (stated length larger than the buffer or a truncated udp datagram),
+ * then the buffer should be discarded.
+ */
+
+static int command_request_length(_Bool udp, int *request_length, _Bool *framed)
+{
+	static const char *const framed_commands[] = { "flash-send ", "flash-write-sector ", "flash-write-sector-lz ", (const char *)0 };
+	const char *const *command;
+	uint32_t chunk_length;
+	int chunk_offset, length;
+
+	*framed = false;
+
+	if((string_length(&command_socket_receive_buffer) > 0) && ((uint8_t)string_at(&command_socket_receive_buffer, 0) == application_binary_magic))
+	{
+		if(string_length(&command_socket_receive_buffer) < application_binary_header_size)
+			return(udp ? -1 : 0);
+
+		length = application_binary_header_size +
+				((uint8_t)string_at(&command_socket_receive_buffer, 1) | ((uint8_t)string_at(&command_socket_receive_buffer, 2) << 8));
+
+		if(length > string_size(&command_socket_receive_buffer))
+			return(-1);
+
+		if(length > string_length(&command_socket_receive_buffer))
+			return(udp ? -1 : 0);
+
+		*request_length = length;
+
+		return(length);
+	}
+
+	for(command = framed_commands; *command; command++)
+		if(string_nmatch_cstr(&command_socket_receive_buffer, *command, strlen(*command)))
+			break;
+
+	if(*command)
+	{
+		if((parse_uint(2, &command_socket_receive_buffer, &chunk_length, 10, ' ') != parse_ok) ||
+				((chunk_offset = string_sep(&command_socket_receive_buffer, 0, 3, ' ')) < 0))
+			return(udp ? -1 : 0);
+
+		if(chunk_length > (unsigned int)string_size(&command_socket_receive_buffer))
+			return(-1);
+
+		if((length = chunk_offset + chunk_length) > string_size(&command_socket_receive_buffer))
+			return(-1);
+
+		if(length > string_length(&command_socket_receive_buffer))
+			return(udp ? -1 : 0);
+
+		*request_length = length;
+		*framed = true;
+
+		return(length);
+	}
+
+	if(udp)
+		length = string_length(&command_socket_receive_buffer);
+	else
+	{
+		if(string_nmatch_cstr(&command_socket_receive_buffer, "GET ", 4))
+		{
+			for(length = 0; (length = string_find(&command_socket_receive_buffer, length, '\n')) >= 0; )
+			{
+				length++;
+
+				if((length < string_length(&command_socket_receive_buffer)) && (string_at(&command_socket_receive_buffer, length) == '\r'))
+					length++;
+
+				if((length < string_length(&command_socket_receive_buffer)) && (string_at(&command_socket_receive_buffer, length) == '\n'))
+					break;
+			}
+
+			if(length < 0)
+				return(0);
+
+			length++;
+		}
+		else
+		{
+			if((length = string_find(&command_socket_receive_buffer, 0, '\n')) < 0)
+				return(0);
+
+			length++;
+		}
+	}
+
+	for(*request_length = length; *request_length > 0; (*request_length)--)
+		if((string_at(&command_socket_receive_buffer, *request_length - 1) != '\n') &&
+				(string_at(&command_socket_receive_buffer, *request_length - 1) != '\r'))
+			break;
+
+	return(length);
+}
+
+static void command_discard(void)
+{
+	log("command: invalid or incomplete request discarded\n");
+	stat_cmd_receive_buffer_overflow++;
+	string_clear(&command_socket_receive_buffer);
+}
+
+static void command_remove_request(int length)
+{
+	int remaining;
 
-	while(!uart_empty(0) && string_space(&uart_socket_send_buffer))
-		string_append_byte(&uart_socket_send_buffer, uart_receive(0));
+	remaining = string_length(&command_socket_receive_buffer) - length;
 
-	if(string_empty(&uart_socket_send_buffer))
+	if(remaining > 0)
+		memmove(string_buffer_nonconst(&command_socket_receive_buffer), string_buffer(&command_socket_receive_buffer) + length, remaining);
+	else
+		remaining = 0;
+
+	string_setlength(&command_socket_receive_buffer, remaining);
+}
+
+// a newline following binary data may arrive separately, don't treat it as an (empty) request
+
+static void command_strip_newlines(void)
+{
+	int length;
+
+	if(!command_strip_nl)
 		return;
 
-	if(!lwip_if_send(&uart_socket))
+	for(length = 0; length < string_length(&command_socket_receive_buffer); length++)
+		if((string_at(&command_socket_receive_buffer, length) != '\r') && (string_at(&command_socket_receive_buffer, length) != '\n'))
+			break;
+
+	command_remove_request(length);
+
+	if(!string_empty(&command_socket_receive_buffer))
+		command_strip_nl = false;
+}
+
+// only when the reply is complete the next request can be taken in, the reply must go to this client
+
+static void command_next(void)
+{
+	int length, request_length;
+	_Bool framed;
+
+	command_strip_newlines();
+
+	if((length = command_request_length(lwip_if_received_udp(&command_socket), &request_length, &framed)) > 0)
+		dispatch_post_command(command_task_received_command);
+	else
 	{
-		stat_uart_send_buffer_overflow++;
-		log("lwip uart send failed\n");
+		if(length < 0)
+			command_discard();
+
+		lwip_if_receive_buffer_unlock(&command_socket);
 	}
 }
 
 static void command_task(os_event_t *event)
 {
 	int trigger_io, trigger_pin;
-	string_init(varname_alert_assoc_io, "trigger.assoc.io");
-	string_init(varname_alert_assoc_pin, "trigger.assoc.pin");
-	string_init(varname_alert_status_io, "trigger.status.io");
-	string_init(varname_alert_status_pin, "trigger.status.pin");
+	config_handle_new(handle_alert_assoc_io, "trigger.assoc.io");
+	config_handle_new(handle_alert_assoc_pin, "trigger.assoc.pin");
+	config_handle_new(handle_alert_status_io, "trigger.status.io");
+	config_handle_new(handle_alert_status_pin, "trigger.status.pin");
 
 	switch(event->sig)
 	{
@@ -138,6 +371,10 @@ static void command_task(os_event_t *event)
 		case(command_task_received_command):
 		{
 			app_action_t action;
+			uint32_t time_start;
+			string_t request;
+			int length, request_length;
+			_Bool framed, binary;
 
 			if(lwip_if_received_tcp(&command_socket))
 				stat_update_command_tcp++;
@@ -145,45 +382,80 @@ static void command_task(os_event_t *event)
 			if(lwip_if_received_udp(&command_socket))
 				stat_update_command_udp++;
 
+			// the previous reply is still being sent, keep the request and retry when it's done
+
 			if(lwip_if_send_buffer_locked(&command_socket))
 			{
 				stat_cmd_send_buffer_overflow++;
-				string_clear(&command_socket_receive_buffer);
+				command_pending = true;
+				break;
+			}
+
+			command_strip_newlines();
+
+			if((length = command_request_length(lwip_if_received_udp(&command_socket), &request_length, &framed)) <= 0)
+			{
+				if(length < 0)
+					command_discard();
+
 				lwip_if_receive_buffer_unlock(&command_socket);
 				break;
 			}
 
+			string_set(&request, string_buffer_nonconst(&command_socket_receive_buffer), length, request_length);
 			string_clear(&command_socket_send_buffer);
 
-			action = application_content(&command_socket_receive_buffer, &command_socket_send_buffer);
+			binary = (uint8_t)string_at(&request, 0) == application_binary_magic;
+
+			time_start = system_get_time();
+
+			if(binary)
+				action = application_content_binary(&request, &command_socket_send_buffer);
+			else
+				action = application_content(&request, &command_socket_send_buffer);
+
+			stat_cmd_time_last_us = system_get_time() - time_start;
+			stat_cmd_time_max_us = umax(stat_cmd_time_max_us, stat_cmd_time_last_us);
+			stat_cmd_time_total_us += stat_cmd_time_last_us;
+			stat_cmd_processed++;
 
-			string_clear(&command_socket_receive_buffer);
-			lwip_if_receive_buffer_unlock(&command_socket);
+			command_remove_request(length);
 
-			if(action == app_action_empty)
+			if(framed)
+				command_strip_nl = true;
+
+			if(!binary && (action == app_action_empty))
 			{
 				string_clear(&command_socket_send_buffer);
 				string_append(&command_socket_send_buffer, "> empty command\n");
 			}
 
-			if(action == app_action_disconnect)
+			if(!binary && (action == app_action_disconnect))
 			{
 				string_clear(&command_socket_send_buffer);
 				string_append(&command_socket_send_buffer, "> disconnect\n");
 			}
 
-			if(action == app_action_reset)
+			if(!binary && (action == app_action_reset))
 			{
 				string_clear(&command_socket_send_buffer);
 				string_append(&command_socket_send_buffer, "> reset\n");
 			}
 
 			if(!lwip_if_send(&command_socket))
+			{
 				log("lwip send failed\n");
+				http_stream_abort();
+			}
 
 			if(action == app_action_disconnect)
 				lwip_if_close(&command_socket);
 
+			// a streamed http reply keeps the receive buffer locked until its last chunk is sent
+
+			if(!http_stream_active())
+				command_next();
+
 			/*
 			 * === ugly workaround ===
 			 *
@@ -202,6 +474,38 @@ static void command_task(os_event_t *event)
 			break;
 		}
 
+		case(command_task_http_stream):
+		{
+			if(!http_stream_active() || lwip_if_send_buffer_locked(&command_socket))
+				break;
+
+			string_clear(&command_socket_send_buffer);
+			http_stream_fill(&command_socket_send_buffer);
+
+			if(!lwip_if_send(&command_socket))
+			{
+				log("lwip send failed\n");
+				http_stream_abort();
+			}
+
+			if(!http_stream_active())
+				command_next();
+
+			break;
+		}
+
+		case(command_task_sample_metrics):
+		{
+			metrics_sample();
+			break;
+		}
+
+		case(command_task_sample_sensors):
+		{
+			i2c_sensors_sample();
+			break;
+		}
+
 		case(command_task_display_update):
 		{
 			stat_update_display++;
@@ -248,8 +552,8 @@ static void command_task(os_event_t *event)
 
 		case(command_task_alert_association):
 		{
-			if((config_get_int(&varname_alert_assoc_io, -1, -1, &trigger_io) &&
-					config_get_int(&varname_alert_assoc_pin, -1, -1, &trigger_pin) &&
+			if((config_handle_get_int(&handle_alert_assoc_io, -1, -1, &trigger_io) &&
+					config_handle_get_int(&handle_alert_assoc_pin, -1, -1, &trigger_pin) &&
 					(trigger_io >= 0) && (trigger_pin >= 0)))
 				io_trigger_pin((string_t *)0, trigger_io, trigger_pin, io_trigger_on);
 
@@ -258,8 +562,8 @@ static void command_task(os_event_t *event)
 
 		case(command_task_alert_disassociation):
 		{
-			if((config_get_int(&varname_alert_assoc_io, -1, -1, &trigger_io) &&
-					config_get_int(&varname_alert_assoc_pin, -1, -1, &trigger_pin) &&
+			if((config_handle_get_int(&handle_alert_assoc_io, -1, -1, &trigger_io) &&
+					config_handle_get_int(&handle_alert_assoc_pin, -1, -1, &trigger_pin) &&
 					(trigger_io >= 0) && (trigger_pin >= 0)))
 				io_trigger_pin((string_t *)0, trigger_io, trigger_pin, io_trigger_off);
 
@@ -268,13 +572,19 @@ static void command_task(os_event_t *event)
 
 		case(command_task_alert_status):
 		{
-			if((config_get_int(&varname_alert_status_io, -1, -1, &trigger_io) &&
-					config_get_int(&varname_alert_status_pin, -1, -1, &trigger_pin) &&
+			if((config_handle_get_int(&handle_alert_status_io, -1, -1, &trigger_io) &&
+					config_handle_get_int(&handle_alert_status_pin, -1, -1, &trigger_pin) &&
 					(trigger_io >= 0) && (trigger_pin >= 0)))
 				io_trigger_pin((string_t *)0, trigger_io, trigger_pin, io_trigger_on);
 
 			break;
 		}
+
+		case(command_task_i2c_transfer_complete):
+		{
+			i2c_transfer_complete();
+			break;
+		}
 	}
 }
 
@@ -293,6 +603,18 @@ iram static void timer_task(os_event_t *event)
 			io_periodic_slow();
 			break;
 		}
+
+		case(timer_task_sensors_poll):
+		{
+			i2c_sensors_poll();
+			break;
+		}
+
+		case(timer_task_i2c_transfer_run):
+		{
+			i2c_transfer_run();
+			break;
+		}
 	}
 }
 
@@ -302,28 +624,69 @@ iram static void fast_timer_callback(void *arg)
 
 	stat_fast_timer++;
 	dispatch_post_timer(timer_task_io_periodic_fast);
+
+	if(i2c_sensors_converting())
+		dispatch_post_timer(timer_task_sensors_poll);
 }
 
 iram static void slow_timer_callback(void *arg)
 {
+	static unsigned int uart_bridge_bytes_previous = 0;
+
 	// run background task every ~100 ms = ~10 Hz
 
 	stat_slow_timer++;
 
 	dispatch_post_command(command_task_update_time);
 
+	// a request waiting for the send buffer of a connection that went away
+
+	if(command_pending && !lwip_if_send_buffer_locked(&command_socket))
+	{
+		command_pending = false;
+		dispatch_post_command(command_task_received_command);
+	}
+
+	if(http_stream_active() && !lwip_if_send_buffer_locked(&command_socket))
+		dispatch_post_command(command_task_http_stream);
+
+	// the bridge is driven by uart receive and tcp sent events, this is only a fallback
+
 	if(uart_bridge_active)
-		dispatch_post_command(command_task_uart_bridge);
+	{
+		if(!uart_empty(0))
+			dispatch_uart_received();
+
+		if((stat_slow_timer % 10) == 0)
+		{
+			stat_uart_bridge_bytes_per_s = stat_uart_bridge_bytes - uart_bridge_bytes_previous;
+			stat_uart_bridge_bytes_per_s_max = umax(stat_uart_bridge_bytes_per_s_max, stat_uart_bridge_bytes_per_s);
+			uart_bridge_bytes_previous = stat_uart_bridge_bytes;
+		}
+	}
 
 	if(display_detected())
 		dispatch_post_command(command_task_display_update);
 
+	// sample pins for the metrics snapshot every second
+
+	if((stat_slow_timer % 10) == 5)
+		dispatch_post_command(command_task_sample_metrics);
+
+	// each sensor has its own sampling interval, the sensor cache picks the one that's due
+
+	dispatch_post_command(command_task_sample_sensors);
+
 	// fallback to config-ap-mode when not connected or no ip within 30 seconds
 
 	if((stat_slow_timer == 300) && (wifi_station_get_connect_status() != STATION_GOT_IP))
 		dispatch_post_command(command_task_fallback_wlan);
 
 	dispatch_post_timer(timer_task_io_periodic_slow);
+
+	// queued i2c transfers whose task event couldn't be posted
+
+	i2c_transfer_poll();
 }
 
 static void wlan_event_handler(System_Event_t *event)
@@ -361,28 +724,39 @@ static void wlan_event_handler(System_Event_t *event)
 
 static void socket_command_callback_data_received(lwip_if_socket_t *socket, unsigned int length)
 {
-	static const uint8_t command_string[] = "flash-send ";
-	uint32_t chunk_length;
-	int chunk_offset;
+	int request_length, request_status;
+	_Bool framed;
 
-	if((command_left_to_read == 0) &&
-			string_nmatch_cstr(&command_socket_receive_buffer, command_string, sizeof(command_string) - 1) &&
-			(parse_uint(2, &command_socket_receive_buffer, &chunk_length, 10, ' ') == parse_ok) &&
-			((chunk_offset = string_sep(&command_socket_receive_buffer, 0, 3, ' ')) >= 0))
-		command_left_to_read = chunk_offset + chunk_length;
+	command_strip_newlines();
 
-	if(command_left_to_read > 0)
+	if((request_status = command_request_length(lwip_if_received_udp(socket), &request_length, &framed)) > 0)
+		dispatch_post_command(command_task_received_command);
+	else
 	{
-		if(length > command_left_to_read)
-			command_left_to_read = 0;
+		if(request_status < 0)
+			command_discard();
 		else
-			command_left_to_read -= length;
+			if(string_length(&command_socket_receive_buffer) >= string_size(&command_socket_receive_buffer))
+			{
+				log("command: request too large\n");
+				stat_cmd_receive_buffer_overflow++;
+				string_clear(&command_socket_receive_buffer);
+			}
+
+		lwip_if_receive_buffer_unlock(&command_socket);
 	}
+}
 
-	if((command_left_to_read == 0) && (string_trim_nl(&command_socket_receive_buffer) || lwip_if_received_udp(socket)))
+static void socket_command_callback_data_sent(lwip_if_socket_t *socket, unsigned int acked)
+{
+	if(command_pending && !lwip_if_send_buffer_locked(socket))
+	{
+		command_pending = false;
 		dispatch_post_command(command_task_received_command);
-	else
-		lwip_if_receive_buffer_unlock(&command_socket);
+	}
+
+	if(http_stream_active() && !lwip_if_send_buffer_locked(socket))
+		dispatch_post_command(command_task_http_stream);
 }
 
 static void socket_uart_callback_data_received(lwip_if_socket_t *socket, unsigned int received)
@@ -397,6 +771,12 @@ static void socket_uart_callback_data_received(lwip_if_socket_t *socket, unsigne
 	strip_telnet = config_flags_match(flag_strip_telnet);
 	telnet_strip_state = ts_copy;
 
+	if(!strip_telnet)
+	{
+		stat_uart_receive_buffer_overflow += length - uart_send_n(0, string_buffer(&uart_socket_receive_buffer), length);
+		length = 0;
+	}
+
 	for(current = 0; current < length; current++)
 	{
 		byte = string_at(&uart_socket_receive_buffer, current);
@@ -435,6 +815,18 @@ static void socket_uart_callback_data_received(lwip_if_socket_t *socket, unsigne
 	uart_flush(0);
 }
 
+void dispatch_stats_sockets(string_t *dst)
+{
+	string_append(dst, "> command socket\n");
+	lwip_if_stats(dst, &command_socket);
+
+	if(uart_bridge_active)
+	{
+		string_append(dst, "> uart bridge socket\n");
+		lwip_if_stats(dst, &uart_socket);
+	}
+}
+
 void dispatch_init1(void)
 {
 	system_os_task(uart_task, uart_task_id, uart_task_queue, uart_task_queue_length);
@@ -465,15 +857,15 @@ void dispatch_init2(void)
 
 	wifi_set_event_handler_cb(wlan_event_handler);
 
-	command_left_to_read = 0;
-
 	lwip_if_socket_create(&command_socket, &command_socket_receive_buffer, &command_socket_send_buffer, cmd_port,
-			config_flags_match(flag_udp_term_empty), socket_command_callback_data_received);
+			lwip_if_slots_size, config_flags_match(flag_udp_term_empty), socket_command_callback_data_received);
+	lwip_if_set_callback_data_sent(&command_socket, socket_command_callback_data_sent);
 
 	if(uart_port > 0)
 	{
-		lwip_if_socket_create(&uart_socket, &uart_socket_receive_buffer, &uart_socket_send_buffer, uart_port,
-			config_flags_match(flag_udp_term_empty), socket_uart_callback_data_received);
+		lwip_if_socket_create(&uart_socket, &uart_socket_receive_buffer, (string_t *)0, uart_port,
+			1, config_flags_match(flag_udp_term_empty), socket_uart_callback_data_received);
+		lwip_if_set_callback_data_sent(&uart_socket, socket_uart_callback_data_sent);
 
 		uart_bridge_active = true;
 	}
@@ -18,6 +18,9 @@ typedef enum
 	command_task_init_i2c_sensors,
 	command_task_init_displays,
 	command_task_received_command,
+	command_task_http_stream,
+	command_task_sample_metrics,
+	command_task_sample_sensors,
 	command_task_display_update,
 	command_task_fallback_wlan,
 	command_task_update_time,
@@ -25,15 +28,20 @@ typedef enum
 	command_task_alert_association,
 	command_task_alert_disassociation,
 	command_task_alert_status,
+	command_task_i2c_transfer_complete,
 	timer_task_io_periodic_slow,
 	timer_task_io_periodic_fast,
+	timer_task_sensors_poll,
+	timer_task_i2c_transfer_run,
 } task_command_t;
 
 extern string_t flash_sector_buffer;
 
 void	dispatch_init1(void);
 void	dispatch_init2(void);
-void	dispatch_post_uart(task_command_t);
-void	dispatch_post_command(task_command_t);
-void	dispatch_post_timer(task_command_t);
+_Bool	dispatch_post_uart(task_command_t);
+_Bool	dispatch_post_command(task_command_t);
+_Bool	dispatch_post_timer(task_command_t);
+void	dispatch_uart_received(void);
+void	dispatch_stats_sockets(string_t *dst);
 #endif
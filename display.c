@@ -431,7 +431,7 @@ _Bool display_periodic(void) // gets called 10 times per second
 	static int expire_counter = 0;
 	int now, flip_timeout;
 	display_info_t *display_info_entry;
-	string_init(varname_fliptimeout, "display.fliptimeout");
+	config_handle_new(handle_fliptimeout, "display.fliptimeout");
 
 	if(!display_detected())
 		return(false);
@@ -445,7 +445,7 @@ _Bool display_periodic(void) // gets called 10 times per second
 		expire_counter = 0;
 		display_expire();
 
-		if(!config_get_int(&varname_fliptimeout, 0, 0, &flip_timeout))
+		if(!config_handle_get_int(&handle_fliptimeout, 0, 0, &flip_timeout))
 			flip_timeout = 4;
 
 		if((last_update > now) || ((last_update + flip_timeout) < now))
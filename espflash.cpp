@@ -1,8 +1,10 @@
 #include <string>
 #include <vector>
+#include <deque>
 #include <ios>
 #include <iomanip>
 #include <iostream>
+#include <fstream>
 
 #include <boost/regex.hpp>
 #include <boost/program_options.hpp>
@@ -16,6 +18,9 @@ namespace po = boost::program_options;
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <errno.h>
 
 #include <openssl/sha.h>
 
@@ -37,6 +42,24 @@ typedef enum
 
 typedef std::vector<std::string> StringVector;
 
+typedef struct
+{
+	std::string port;
+	std::string filename;
+	unsigned int start, length, chunk_size, window;
+	bool use_udp, verbose, verbose2, nocommit, noreset, notemp, use_force, erase_before_write, compress;
+	action_t action;
+} session_options_t;
+
+typedef struct
+{
+	int sectors_sent;
+	int sectors_written;
+	int sectors_erased;
+	int sectors_skipped;
+	int64_t bytes_saved;
+} write_result_t;
+
 class GenericSocket
 {
 	private:
@@ -44,14 +67,18 @@ class GenericSocket
 		int fd;
 		std::string host;
 		std::string service;
+		std::string line_buffer;
 		bool use_udp, verbose;
 
 	public:
 		GenericSocket(const std::string &host, const std::string &port, bool use_udp, bool verbose);
 		~GenericSocket();
 
-		bool send(int timeout_msec, std::string buffer);
+		bool send(int timeout_msec, std::string buffer, bool raw = false);
 		bool receive(int timeout_msec, std::string &buffer, int expected, bool raw);
+		bool receive_line(int timeout_msec, std::string &line);
+		bool receive_exact(int timeout_msec, std::string &data, size_t length);
+		bool udp() const { return(use_udp); }
 		void reconnect();
 };
 
@@ -78,6 +105,8 @@ void GenericSocket::reconnect()
 	if(fd >= 0)
 		close(fd);
 
+	line_buffer.clear();
+
 	if((fd = socket(AF_INET6, use_udp ? SOCK_DGRAM : SOCK_STREAM, 0)) < 0)
 		throw(std::string("socket failed"));
 
@@ -99,12 +128,13 @@ GenericSocket::~GenericSocket()
 		close(fd);
 }
 
-bool GenericSocket::send(int timeout, std::string buffer)
+bool GenericSocket::send(int timeout, std::string buffer, bool raw)
 {
 	struct pollfd pfd;
 	ssize_t chunk;
 
-	buffer += "\r\n";
+	if(!raw)
+		buffer += "\r\n";
 
 	while(buffer.length() > 0)
 	{
@@ -177,6 +207,72 @@ bool GenericSocket::receive(int timeout, std::string &reply, int expected, bool
 	return(true);
 }
 
+bool GenericSocket::receive_line(int timeout, std::string &line)
+{
+	struct pollfd pfd;
+	char buffer[8192];
+	size_t eol;
+	int length;
+
+	// replies of pipelined requests may arrive coalesced or split, return them one line at a time
+
+	while((eol = line_buffer.find('\n')) == std::string::npos)
+	{
+		pfd.fd = fd;
+		pfd.events = POLLIN | POLLERR | POLLHUP;
+		pfd.revents = 0;
+
+		if(poll(&pfd, 1, timeout) != 1)
+			return(false);
+
+		if(pfd.revents & (POLLERR | POLLHUP))
+			return(false);
+
+		if((length = read(fd, buffer, sizeof(buffer))) <= 0)
+			return(false);
+
+		line_buffer.append(buffer, (size_t)length);
+	}
+
+	line = line_buffer.substr(0, eol);
+	line_buffer.erase(0, eol + 1);
+
+	if((line.length() > 0) && (line.back() == '\r'))
+		line.pop_back();
+
+	return(true);
+}
+
+bool GenericSocket::receive_exact(int timeout, std::string &data, size_t length)
+{
+	struct pollfd pfd;
+	char buffer[8192];
+	int chunk;
+
+	while(line_buffer.length() < length)
+	{
+		pfd.fd = fd;
+		pfd.events = POLLIN | POLLERR | POLLHUP;
+		pfd.revents = 0;
+
+		if(poll(&pfd, 1, timeout) != 1)
+			return(false);
+
+		if(pfd.revents & (POLLERR | POLLHUP))
+			return(false);
+
+		if((chunk = read(fd, buffer, sizeof(buffer))) <= 0)
+			return(false);
+
+		line_buffer.append(buffer, (size_t)chunk);
+	}
+
+	data = line_buffer.substr(0, length);
+	line_buffer.erase(0, length);
+
+	return(true);
+}
+
 static std::string sha_hash_to_text(const unsigned char *hash)
 {
 	unsigned int current;
@@ -268,10 +364,408 @@ static void process(GenericSocket &channel, const std::string &send_string, std:
 	}
 }
 
+static void show_write_progress(const struct timeval &time_start, int64_t file_offset, uint64_t file_length,
+		int sectors_sent, int sectors_written, int sectors_erased, int sectors_skipped)
+{
+	struct timeval time_now;
+	int seconds, useconds;
+	double duration, rate;
+
+	gettimeofday(&time_now, 0);
+
+	seconds = time_now.tv_sec - time_start.tv_sec;
+	useconds = time_now.tv_usec - time_start.tv_usec;
+	duration = seconds + (useconds / 1000000.0);
+	rate = file_offset / 1024.0 / duration;
+
+	std::cout << std::setfill(' ');
+	std::cout << "sent "		<< std::setw(3) << (file_offset / 1024) << " kbytes";
+	std::cout << " in "			<< std::setw(4) << std::setprecision(2) << std::fixed << duration << " seconds";
+	std::cout << " at rate "	<< std::setw(3) << std::setprecision(0) << std::fixed << rate << " kbytes/s";
+	std::cout << ", sent "		<< std::setw(2) << sectors_sent << " sectors";
+	std::cout << ", written "	<< std::setw(2) << sectors_written << " sectors";
+	std::cout << ", erased "	<< std::setw(2) << sectors_erased << " sectors";
+	std::cout << ", skipped "	<< std::setw(2) << sectors_skipped << " sectors";
+	std::cout << ", "			<< std::setw(3) << ((file_offset * 100) / file_length) << "%       \r";
+	std::cout.flush();
+}
+
+// LZSS as decompressed by the flash-write-sector-lz command: a flag byte precedes each group of eight items,
+// bit set = literal byte, bit clear = back reference, 12 bits distance - 1 and 4 bits length - 3,
+// a length nibble of 15 is followed by an extra length byte
+
+static std::string lzss_compress(const unsigned char *data, int length)
+{
+	enum
+	{
+		min_match = 3,
+		max_match = 3 + 15 + 255,
+		max_distance = 4096,
+		hash_size = 4096,
+		max_chain = 128,
+	};
+
+	std::vector<int> head(hash_size, -1);
+	std::vector<int> prev(length, -1);
+	std::string out;
+	size_t flags_offset;
+	int bit, position, best_length, best_distance, candidate, chain, match, hash, extra;
+
+	flags_offset = 0;
+
+	for(position = 0, bit = 8; position < length; bit++)
+	{
+		if(bit == 8)
+		{
+			flags_offset = out.length();
+			out.push_back(0);
+			bit = 0;
+		}
+
+		best_length = 0;
+		best_distance = 0;
+
+		if((position + min_match) <= length)
+		{
+			hash = ((data[position] << 8) ^ (data[position + 1] << 4) ^ data[position + 2]) & (hash_size - 1);
+
+			for(candidate = head[hash], chain = max_chain; (candidate >= 0) && ((position - candidate) <= max_distance) && (chain > 0); candidate = prev[candidate], chain--)
+			{
+				for(match = 0; ((position + match) < length) && (match < max_match) && (data[candidate + match] == data[position + match]); match++)
+					;
+
+				if(match > best_length)
+				{
+					best_length = match;
+					best_distance = position - candidate;
+				}
+			}
+		}
+
+		if(best_length >= min_match)
+		{
+			extra = best_length - min_match;
+
+			out.push_back((char)((best_distance - 1) >> 4));
+			out.push_back((char)((((best_distance - 1) & 0x0f) << 4) | (extra < 15 ? extra : 15)));
+
+			if(extra >= 15)
+				out.push_back((char)(extra - 15));
+		}
+		else
+		{
+			out[flags_offset] |= (char)(1 << bit);
+			out.push_back((char)data[position]);
+			best_length = 1;
+		}
+
+		for(; best_length > 0; best_length--, position++)
+		{
+			if((position + min_match) <= length)
+			{
+				hash = ((data[position] << 8) ^ (data[position + 1] << 4) ^ data[position + 2]) & (hash_size - 1);
+				prev[position] = head[hash];
+				head[hash] = position;
+			}
+		}
+	}
+
+	return(out);
+}
+
+typedef struct
+{
+	unsigned int address;
+	int attempt;
+	std::string hash;
+	std::string request;
+} window_entry_t;
+
+static void skip_same_sectors(GenericSocket &channel, std::deque<window_entry_t> &sectors, bool verbose, int &sectors_skipped)
+{
+	boost::regex re("OK flash-checksum-sectors: sectors: ([0-9]+), from address: ([0-9]+), checksums:((?: [0-9a-f]+)*)\\s*");
+	boost::smatch capture;
+	std::deque<window_entry_t> remaining;
+	std::vector<std::string> checksums;
+	std::string reply, list;
+	unsigned int current, count, index;
+	size_t offset;
+
+	// fetch the digests of all sectors to be written, as many per request as the device can return at once,
+	// drop the sectors that already hold the same data, any failure just means the remaining sectors are all sent
+
+	for(current = 0; current < sectors.size(); current += count)
+	{
+		count = 0;
+
+		if(!channel.send(2000, std::string("flash-checksum-sectors ") + std::to_string(sectors[current].address) + " " + std::to_string(sectors.size() - current)) ||
+				!channel.receive_line(10000, reply))
+		{
+			std::cout << "! checksum sectors failed, sending all remaining sectors" << std::endl;
+			channel.reconnect();
+			break;
+		}
+
+		if(verbose)
+			std::cout << "< receive: " << reply << std::endl;
+
+		if(!boost::regex_match(reply, capture, re) || (std::stoul(capture[2]) != sectors[current].address))
+		{
+			std::cout << "! checksum sectors not supported, sending all remaining sectors" << std::endl;
+			break;
+		}
+
+		count = std::stoul(capture[1]);
+		list = capture[3];
+		checksums.clear();
+
+		for(offset = 0; (offset = list.find_first_not_of(' ', offset)) != std::string::npos; offset += checksums.back().length())
+			checksums.push_back(list.substr(offset, list.find(' ', offset) - offset));
+
+		if((count == 0) || (checksums.size() != count) || ((current + count) > sectors.size()))
+		{
+			std::cout << "! checksum sectors returned invalid reply, sending all remaining sectors" << std::endl;
+			break;
+		}
+
+		for(index = 0; index < count; index++)
+		{
+			if(checksums[index] == sectors[current + index].hash)
+				sectors_skipped++;
+			else
+				remaining.push_back(sectors[current + index]);
+		}
+	}
+
+	for(; current < sectors.size(); current++)
+		remaining.push_back(sectors[current]);
+
+	sectors.swap(remaining);
+}
+
+// flash-write-sector without arguments, firmware that has the command complains about the missing address,
+// older firmware doesn't know it, then the write falls back to one chunk at a time
+
+static bool write_sector_supported(GenericSocket &channel, bool verbose)
+{
+	boost::regex re("ERROR flash-write-sector: address required\\s*");
+	std::string reply;
+
+	if(!channel.send(2000, "flash-write-sector") || !channel.receive_line(2000, reply))
+	{
+		channel.reconnect();
+		return(false);
+	}
+
+	if(verbose)
+		std::cout << "< receive: " << reply << std::endl;
+
+	return(boost::regex_match(reply, re));
+}
+
+static void command_write_windowed(GenericSocket &channel, int fd, uint64_t file_length, unsigned int start,
+		int flash_sector_size, unsigned int window, bool skip_same, bool compress, bool verbose, const struct timeval &time_start,
+		SHA_CTX &sha_file_ctx, int &checksummed,
+		int &sectors_sent, int &sectors_written, int &sectors_erased, int &sectors_skipped, int64_t &bytes_saved)
+{
+	boost::regex re("OK flash-write: written bytes: ([0-9]+), to address: ([0-9]+) \\([0-9]+\\), same: (0|1), erased: (0|1), checksum: ([0-9a-f]+)\\s*");
+	boost::smatch capture;
+	unsigned char sector_buffer[flash_sector_size];
+	unsigned char sector_hash[SHA_DIGEST_LENGTH];
+	std::deque<window_entry_t> sectors;
+	std::deque<window_entry_t> outstanding;
+	std::deque<window_entry_t>::iterator it;
+	window_entry_t entry;
+	std::string reply;
+	unsigned int current, address;
+	int sector_length;
+	int64_t acknowledged, bytes_raw, bytes_compressed;
+	std::string compressed;
+	unsigned int total;
+	bool connected;
+
+	bytes_raw = 0;
+	bytes_compressed = 0;
+
+	// keep up to "window" whole sectors in flight, each one is sent and acknowledged by a single flash-write-sector request,
+	// replies are matched by address and only sectors that failed are sent again
+
+	for(current = start;; current += flash_sector_size)
+	{
+		memset(sector_buffer, 0xff, flash_sector_size);
+
+		if((sector_length = read(fd, sector_buffer, flash_sector_size)) < 0)
+			throw(std::string("i/o error in read"));
+
+		if(sector_length == 0)
+			break;
+
+		SHA1(sector_buffer, flash_sector_size, sector_hash);
+		SHA1_Update(&sha_file_ctx, sector_buffer, flash_sector_size);
+		checksummed += flash_sector_size;
+
+		entry.address = current;
+		entry.attempt = 0;
+		entry.hash = sha_hash_to_text(sector_hash);
+		entry.request = std::string("flash-write-sector ") + std::to_string(current) + " " + std::to_string(sector_length) + " ";
+		entry.request.append((const char *)sector_buffer, sector_length);
+
+		if(compress)
+		{
+			compressed = lzss_compress(sector_buffer, flash_sector_size);
+
+			if((int)compressed.length() < sector_length)
+			{
+				entry.request = std::string("flash-write-sector-lz ") + std::to_string(current) + " " + std::to_string(compressed.length()) + " ";
+				entry.request.append(compressed);
+			}
+
+			bytes_raw += sector_length;
+			bytes_compressed += std::min((int)compressed.length(), sector_length);
+		}
+
+		sectors.push_back(entry);
+	}
+
+	if(compress && (bytes_raw > 0))
+		std::cout << "compressed " << bytes_raw << " bytes to " << bytes_compressed << " bytes (" << (bytes_compressed * 100 / bytes_raw) << "%)" << std::endl;
+
+	if(skip_same)
+	{
+		total = sectors.size();
+		skip_same_sectors(channel, sectors, verbose, sectors_skipped);
+		bytes_saved = (int64_t)sectors_skipped * flash_sector_size;
+
+		std::cout << "sectors already up to date: " << sectors_skipped << ", to send: " << sectors.size() << ", bytes saved: " << bytes_saved;
+
+		if(total > 0)
+			std::cout << " (" << (sectors_skipped * 100 / total) << "%)";
+
+		std::cout << std::endl;
+	}
+
+	acknowledged = (int64_t)sectors_skipped * flash_sector_size;
+	connected = true;
+
+	while(!sectors.empty() || !outstanding.empty())
+	{
+		while(!sectors.empty() && (outstanding.size() < window))
+		{
+			entry = sectors.front();
+			sectors.pop_front();
+
+			if(verbose)
+				std::cout << "sending sector at 0x" << std::hex << std::setw(6) << std::setfill('0') << entry.address << std::dec << std::setw(0)
+						<< ", in flight: " << outstanding.size() << std::endl;
+
+			if(connected && !channel.send(2000, entry.request))
+				connected = false;
+
+			outstanding.push_back(entry);
+			sectors_sent++;
+		}
+
+		if(!connected || !channel.receive_line(10000, reply))
+		{
+			if(!verbose)
+				std::cout << std::endl;
+
+			std::cout << "! connection failed, resending " << outstanding.size() << " sectors" << std::endl;
+
+			channel.reconnect();
+			connected = true;
+
+			for(auto &resend : outstanding)
+			{
+				if(++resend.attempt >= max_attempts)
+					throw(std::string("! sending sector failed too many times"));
+
+				if(connected && !channel.send(2000, resend.request))
+					connected = false;
+			}
+
+			continue;
+		}
+
+		if(reply.length() == 0)
+			continue;
+
+		if(verbose)
+			std::cout << "< receive: " << reply << std::endl;
+
+		if(boost::regex_match(reply, capture, re))
+		{
+			address = std::stoul(capture[2]);
+
+			for(it = outstanding.begin(); it != outstanding.end(); it++)
+				if(it->address == address)
+					break;
+
+			if(it == outstanding.end())
+			{
+				if(verbose)
+					std::cout << "ignoring reply for sector not in flight at 0x" << std::hex << address << std::dec << std::endl;
+
+				continue;
+			}
+
+			if((std::stoi(capture[1]) == flash_sector_size) && (capture[5] == it->hash))
+			{
+				if(std::stoi(capture[3]) == 0)
+					sectors_written++;
+				else
+					sectors_skipped++;
+
+				if(std::stoi(capture[4]) != 0)
+					sectors_erased++;
+
+				outstanding.erase(it);
+				acknowledged += flash_sector_size;
+
+				if(!verbose)
+					show_write_progress(time_start, acknowledged < (int64_t)file_length ? acknowledged : file_length, file_length,
+							sectors_sent, sectors_written, sectors_erased, sectors_skipped);
+
+				continue;
+			}
+
+			if(!verbose)
+				std::cout << std::endl;
+
+			std::cout << "! write sector failed: local hash (" << it->hash << ") != remote hash (" << capture[5] << ")";
+		}
+		else
+		{
+			// requests are answered in order, so an error reply belongs to the oldest sector in flight
+
+			it = outstanding.begin();
+
+			if(!verbose)
+				std::cout << std::endl;
+
+			std::cout << "! write sector failed: " << reply;
+		}
+
+		std::cout << ", address 0x" << std::hex << std::setw(6) << std::setfill('0') << it->address << std::dec << std::setw(0);
+		std::cout << ", attempt #" << it->attempt << std::endl;
+
+		entry = *it;
+		outstanding.erase(it);
+
+		if(++entry.attempt >= max_attempts)
+			throw(std::string("! sending sector failed too many times"));
+
+		if(connected && !channel.send(2000, entry.request))
+			connected = false;
+
+		outstanding.push_back(entry);
+	}
+}
+
 void command_write(GenericSocket &channel, int fd,
 		uint64_t file_length, unsigned int start,
-		int flash_sector_size, int chunk_size,
-		bool verbose, action_t action, bool erase_before_write)
+		int flash_sector_size, int chunk_size, unsigned int window, bool compress,
+		bool verbose, action_t action, bool erase_before_write, write_result_t &result)
 {
 	int64_t file_offset;
 	unsigned char sector_buffer[flash_sector_size];
@@ -281,7 +775,8 @@ void command_write(GenericSocket &channel, int fd,
 	int chunk_offset, chunk_attempt;
 	int current, checksummed;
 	int sectors_written, sectors_skipped, sectors_erased;
-	struct timeval time_start, time_now;
+	int64_t bytes_saved;
+	struct timeval time_start;
 	std::string sha_local_hash_text;
 	std::string sha_remote_hash_text;
 	std::string send_string;
@@ -336,235 +831,227 @@ void command_write(GenericSocket &channel, int fd,
 	sectors_written = 0;
 	sectors_skipped = 0;
 	sectors_erased = 0;
+	bytes_saved = 0;
 	current = start;
 	checksummed = 0;
 
-	while(true)
+	if((action == action_write) && (window > 1) && !channel.udp() && !write_sector_supported(channel, verbose))
 	{
-		memset(sector_buffer, 0xff, flash_sector_size);
+		std::cout << "! flash-write-sector not supported by the device, writing one chunk at a time" << std::endl;
+		window = 1;
+	}
 
-		if((sector_length = read(fd, sector_buffer, flash_sector_size)) < 0)
-			throw(std::string("i/o error in read"));
+	if((action == action_write) && (window > 1) && !channel.udp())
+		command_write_windowed(channel, fd, file_length, start, flash_sector_size, window, !erase_before_write, compress, verbose, time_start,
+				sha_file_ctx, checksummed, sector, sectors_written, sectors_erased, sectors_skipped, bytes_saved);
+	else
+	{
+		while(true)
+		{
+			memset(sector_buffer, 0xff, flash_sector_size);
 
-		if((file_offset = lseek(fd, 0, SEEK_CUR)) < 0)
-			throw(std::string("i/o error in seek"));
+			if((sector_length = read(fd, sector_buffer, flash_sector_size)) < 0)
+				throw(std::string("i/o error in read"));
 
-		if(sector_length == 0)
-			break;
+			if((file_offset = lseek(fd, 0, SEEK_CUR)) < 0)
+				throw(std::string("i/o error in seek"));
 
-		SHA1(sector_buffer, flash_sector_size, sector_hash);
-		sha_local_hash_text = sha_hash_to_text(sector_hash);
+			if(sector_length == 0)
+				break;
 
-		if(action != action_simulate)
-		{
-			SHA1_Update(&sha_file_ctx, sector_buffer, flash_sector_size);
-			checksummed += flash_sector_size;
-		}
+			SHA1(sector_buffer, flash_sector_size, sector_hash);
+			sha_local_hash_text = sha_hash_to_text(sector_hash);
 
-		for(sector_attempt = max_attempts; sector_attempt > 0; sector_attempt--)
-		{
-			if(verbose)
-				std::cout << "sending sector: " << (file_offset * 1.0 / flash_sector_size)
-					<< " (offset: " << file_offset << "), length: " << sector_length << ", try #" << (max_attempts - sector_attempt) << std::endl;
+			if(action != action_simulate)
+			{
+				SHA1_Update(&sha_file_ctx, sector_buffer, flash_sector_size);
+				checksummed += flash_sector_size;
+			}
 
-			for(chunk_offset = 0; chunk_offset < (int)flash_sector_size; chunk_offset += chunk_size)
+			for(sector_attempt = max_attempts; sector_attempt > 0; sector_attempt--)
 			{
-				for(chunk_attempt = max_attempts; chunk_attempt > 0; chunk_attempt--)
+				if(verbose)
+					std::cout << "sending sector: " << (file_offset * 1.0 / flash_sector_size)
+						<< " (offset: " << file_offset << "), length: " << sector_length << ", try #" << (max_attempts - sector_attempt) << std::endl;
+
+				for(chunk_offset = 0; chunk_offset < (int)flash_sector_size; chunk_offset += chunk_size)
 				{
-					try
+					for(chunk_attempt = max_attempts; chunk_attempt > 0; chunk_attempt--)
 					{
-						if(verbose)
-							std::cout << "sending chunk: " << chunk_offset / chunk_size << " (offset " << (file_offset / flash_sector_size) - 1
-									<< " length: " << chunk_size << ", try #" << max_attempts - chunk_attempt << std::endl;
+						try
+						{
+							if(verbose)
+								std::cout << "sending chunk: " << chunk_offset / chunk_size << " (offset " << (file_offset / flash_sector_size) - 1
+										<< " length: " << chunk_size << ", try #" << max_attempts - chunk_attempt << std::endl;
 
-						send_string = "flash-send " + std::to_string(chunk_offset) + " " + std::to_string(chunk_size) + " ";
-						send_string.append((const char *)&sector_buffer[chunk_offset], chunk_size);
+							send_string = "flash-send " + std::to_string(chunk_offset) + " " + std::to_string(chunk_size) + " ";
+							send_string.append((const char *)&sector_buffer[chunk_offset], chunk_size);
 
-						process(channel, send_string, reply, "OK flash-send: received bytes: ([0-9]+), at offset: ([0-9]+)\\s*", string_value, int_value, verbose);
+							process(channel, send_string, reply, "OK flash-send: received bytes: ([0-9]+), at offset: ([0-9]+)\\s*", string_value, int_value, verbose);
 
-						if(int_value[0] != chunk_size)
-							throw(std::string("local chunk size (") + std::to_string(chunk_size) + ") != remote chunk size (" + std::to_string(int_value[0]) + ")");
+							if(int_value[0] != chunk_size)
+								throw(std::string("local chunk size (") + std::to_string(chunk_size) + ") != remote chunk size (" + std::to_string(int_value[0]) + ")");
 
-						if(int_value[1] != chunk_offset)
-							throw(std::string("local chunk offset (")  + std::to_string(chunk_offset) + ") != remote chunk offset (" + std::to_string(int_value[1]) + ")");
+							if(int_value[1] != chunk_offset)
+								throw(std::string("local chunk offset (")  + std::to_string(chunk_offset) + ") != remote chunk offset (" + std::to_string(int_value[1]) + ")");
 
-						break;
-					}
-					catch(const std::string &e)
-					{
-						if(!verbose)
-							std::cout << std::endl;
+							break;
+						}
+						catch(const std::string &e)
+						{
+							if(!verbose)
+								std::cout << std::endl;
 
-						std::cout << "! send chunk failed: " << e;
-						std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
-						std::cout << ", chunk " << chunk_offset / chunk_size;
-						std::cout << ", attempt #" << max_attempts - chunk_attempt;
-						std::cout << std::endl;
+							std::cout << "! send chunk failed: " << e;
+							std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
+							std::cout << ", chunk " << chunk_offset / chunk_size;
+							std::cout << ", attempt #" << max_attempts - chunk_attempt;
+							std::cout << std::endl;
+						}
 					}
-				}
 
-				if(chunk_attempt == 0)
-					throw(std::string("sending chunk failed too many times"));
-			}
+					if(chunk_attempt == 0)
+						throw(std::string("sending chunk failed too many times"));
+				}
 
-			if(action != action_simulate)
-			{
-				try
+				if(action != action_simulate)
 				{
-					if(action == action_verify)
+					try
 					{
-						if(verbose)
-							std::cout << "verify sector at 0x" << std::hex << std::setw(6) << std::setfill('0') << current << std::dec << std::setw(0) << std::endl;
-
-						send_string = std::string("flash-verify ") + std::to_string(current);
-						process(channel, send_string, reply, "OK flash-verify: verified bytes: ([0-9]+), at address: ([0-9]+) \\([0-9]+\\), same: (0|1), checksum: ([0-9a-f]+)\\s*", string_value, int_value, verbose);
-
-						sha_remote_hash_text = string_value[3];
-
-						if(verbose)
+						if(action == action_verify)
 						{
-							std::cout << "sector verified";
-							std::cout << ", local hash: " << sha_local_hash_text;
-							std::cout << ", remote hash: " << sha_remote_hash_text << std::endl;
-						}
+							if(verbose)
+								std::cout << "verify sector at 0x" << std::hex << std::setw(6) << std::setfill('0') << current << std::dec << std::setw(0) << std::endl;
 
-						if(int_value[0] != flash_sector_size)
-							throw(std::string("local sector size (") + std::to_string(flash_sector_size) + ") != remote sector size (" + std::to_string(int_value[0]) + ")");
+							send_string = std::string("flash-verify ") + std::to_string(current);
+							process(channel, send_string, reply, "OK flash-verify: verified bytes: ([0-9]+), at address: ([0-9]+) \\([0-9]+\\), same: (0|1), checksum: ([0-9a-f]+)\\s*", string_value, int_value, verbose);
 
-						if(int_value[1] != current)
-							throw(std::string("local address (") + std::to_string(current) + ") != remote address (" + std::to_string(int_value[1]) + ")");
+							sha_remote_hash_text = string_value[3];
 
-						if(int_value[2] != 1)
-							throw(std::string("no match"));
+							if(verbose)
+							{
+								std::cout << "sector verified";
+								std::cout << ", local hash: " << sha_local_hash_text;
+								std::cout << ", remote hash: " << sha_remote_hash_text << std::endl;
+							}
 
-						if(sha_local_hash_text != sha_remote_hash_text)
-							throw(std::string("local hash (") + sha_local_hash_text + ") != remote hash (" + sha_remote_hash_text + ")");
+							if(int_value[0] != flash_sector_size)
+								throw(std::string("local sector size (") + std::to_string(flash_sector_size) + ") != remote sector size (" + std::to_string(int_value[0]) + ")");
 
-						sectors_skipped++;
-					}
-					else
-					{
-						if(verbose)
-							std::cout << "writing sector at 0x" << std::hex << std::setw(6) << std::setfill('0') << current << std::dec << std::setw(0) << std::endl;
+							if(int_value[1] != current)
+								throw(std::string("local address (") + std::to_string(current) + ") != remote address (" + std::to_string(int_value[1]) + ")");
 
-						send_string = std::string("flash-write ") + std::to_string(current);
-						process(channel, send_string, reply, "OK flash-write: written bytes: ([0-9]+), to address: ([0-9]+) \\([0-9]+\\), same: (0|1), erased: (0|1), checksum: ([0-9a-f]+)\\s*", string_value, int_value, verbose);
+							if(int_value[2] != 1)
+								throw(std::string("no match"));
 
-						sha_remote_hash_text = string_value[4];
+							if(sha_local_hash_text != sha_remote_hash_text)
+								throw(std::string("local hash (") + sha_local_hash_text + ") != remote hash (" + sha_remote_hash_text + ")");
 
-						if(verbose)
-						{
-							std::cout << "sector written";
-							std::cout << ", local hash: " << sha_local_hash_text;
-							std::cout << ", remote hash: " << sha_remote_hash_text;
-							std::cout << ", try #" << (max_attempts - sector_attempt) << std::endl;
+							sectors_skipped++;
 						}
+						else
+						{
+							if(verbose)
+								std::cout << "writing sector at 0x" << std::hex << std::setw(6) << std::setfill('0') << current << std::dec << std::setw(0) << std::endl;
 
-						if(int_value[0] != flash_sector_size)
-							throw(std::string("local sector size (") + std::to_string(flash_sector_size) +  ") != remote sector size (" + std::to_string(int_value[0]) + ")");
+							send_string = std::string("flash-write ") + std::to_string(current);
+							process(channel, send_string, reply, "OK flash-write: written bytes: ([0-9]+), to address: ([0-9]+) \\([0-9]+\\), same: (0|1), erased: (0|1), checksum: ([0-9a-f]+)\\s*", string_value, int_value, verbose);
 
-						if(int_value[1] != current)
-							throw(std::string("local address (") + std::to_string(current) + ") != remote address (" + std::to_string(int_value[1]) +  ")");
+							sha_remote_hash_text = string_value[4];
 
-						if(sha_local_hash_text != sha_remote_hash_text)
-							throw(std::string("local hash (") + sha_local_hash_text + ") != remote hash (" + sha_remote_hash_text + ")");
+							if(verbose)
+							{
+								std::cout << "sector written";
+								std::cout << ", local hash: " << sha_local_hash_text;
+								std::cout << ", remote hash: " << sha_remote_hash_text;
+								std::cout << ", try #" << (max_attempts - sector_attempt) << std::endl;
+							}
 
-						if(int_value[2] == 0)
-							sectors_written++;
-						else
-							sectors_skipped++;
+							if(int_value[0] != flash_sector_size)
+								throw(std::string("local sector size (") + std::to_string(flash_sector_size) +  ") != remote sector size (" + std::to_string(int_value[0]) + ")");
 
-						if(int_value[3] != 0)
-							sectors_erased++;
-					}
+							if(int_value[1] != current)
+								throw(std::string("local address (") + std::to_string(current) + ") != remote address (" + std::to_string(int_value[1]) +  ")");
 
-					break;
-				}
-				catch(const std::string &e)
-				{
-					if(!verbose)
-						std::cout << std::endl;
+							if(sha_local_hash_text != sha_remote_hash_text)
+								throw(std::string("local hash (") + sha_local_hash_text + ") != remote hash (" + sha_remote_hash_text + ")");
 
-					if(action == action_verify)
-					{
-						std::cout << "! verify sector failed: " << e;
-						std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
-						std::cout << std::endl;
+							if(int_value[2] == 0)
+								sectors_written++;
+							else
+								sectors_skipped++;
+
+							if(int_value[3] != 0)
+								sectors_erased++;
+						}
 
-						throw(std::string("verify failed"));
+						break;
 					}
-					else
+					catch(const std::string &e)
 					{
-						std::cout << "! write sector failed: " << e;
-						std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
-						std::cout << ", attempt #" << max_attempts - sector_attempt;
-						std::cout << std::endl;
-					}
-				}
-			}
-			else
-			{
-				sectors_skipped++;
-				break;
-			}
-		}
-
-		sector++;
-
-		if(sector_attempt <= 0)
-			throw(std::string("! sending sector failed too many times"));
+						if(!verbose)
+							std::cout << std::endl;
 
-		current += flash_sector_size;
+						if(action == action_verify)
+						{
+							std::cout << "! verify sector failed: " << e;
+							std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
+							std::cout << std::endl;
 
-		if(verbose)
-		{
-			switch(action)
-			{
-				case(action_simulate):
-				{
-					std::cout << "send sector success at ";
-					break;
-				}
-				case(action_verify):
-				{
-					std::cout << "verify sector success at ";
-					break;
-				}
-				case(action_write):
-				{
-					std::cout << "write sector success at ";
-					break;
+							throw(std::string("verify failed"));
+						}
+						else
+						{
+							std::cout << "! write sector failed: " << e;
+							std::cout << ", sector " << sector << "/" << file_length / flash_sector_size;
+							std::cout << ", attempt #" << max_attempts - sector_attempt;
+							std::cout << std::endl;
+						}
+					}
 				}
-				default:
+				else
 				{
+					sectors_skipped++;
 					break;
 				}
 			}
 
-			std::cout << current << std::endl;
-		}
-		else
-		{
-			int seconds, useconds;
-			double duration, rate;
+			sector++;
 
-			gettimeofday(&time_now, 0);
+			if(sector_attempt <= 0)
+				throw(std::string("! sending sector failed too many times"));
 
-			seconds = time_now.tv_sec - time_start.tv_sec;
-			useconds = time_now.tv_usec - time_start.tv_usec;
-			duration = seconds + (useconds / 1000000.0);
-			rate = file_offset / 1024.0 / duration;
+			current += flash_sector_size;
 
-			std::cout << std::setfill(' ');
-			std::cout << "sent "		<< std::setw(3) << (file_offset / 1024) << " kbytes";
-			std::cout << " in "			<< std::setw(4) << std::setprecision(2) << std::fixed << duration << " seconds";
-			std::cout << " at rate "	<< std::setw(3) << std::setprecision(0) << std::fixed << rate << " kbytes/s";
-			std::cout << ", sent "		<< std::setw(2) << sector << " sectors";
-			std::cout << ", written "	<< std::setw(2) << sectors_written << " sectors";
-			std::cout << ", erased "	<< std::setw(2) << sectors_erased << " sectors";
-			std::cout << ", skipped "	<< std::setw(2) << sectors_skipped << " sectors";
-			std::cout << ", "			<< std::setw(3) << ((file_offset * 100) / file_length) << "%       \r";
-			std::cout.flush();
+			if(verbose)
+			{
+				switch(action)
+				{
+					case(action_simulate):
+					{
+						std::cout << "send sector success at ";
+						break;
+					}
+					case(action_verify):
+					{
+						std::cout << "verify sector success at ";
+						break;
+					}
+					case(action_write):
+					{
+						std::cout << "write sector success at ";
+						break;
+					}
+					default:
+					{
+						break;
+					}
+				}
+
+				std::cout << current << std::endl;
+			}
+			else
+				show_write_progress(time_start, file_offset, file_length, sector, sectors_written, sectors_erased, sectors_skipped);
 		}
 	}
 
@@ -599,7 +1086,14 @@ void command_write(GenericSocket &channel, int fd,
 		std::cout << "checksumming done" << std::endl;
 	}
 
-	std::cout << operation << " finished" << std::endl;
+	std::cout << operation << " finished, sent: " << sector << " sectors, written: " << sectors_written << " sectors, erased: " << sectors_erased
+			<< " sectors, skipped: " << sectors_skipped << " sectors, saved: " << bytes_saved << " bytes" << std::endl;
+
+	result.sectors_sent = sector;
+	result.sectors_written = sectors_written;
+	result.sectors_erased = sectors_erased;
+	result.sectors_skipped = sectors_skipped;
+	result.bytes_saved = bytes_saved;
 }
 
 void command_checksum(GenericSocket &channel, int fd, uint64_t file_length, unsigned int start,
@@ -848,136 +1342,226 @@ void command_read(GenericSocket &channel, int fd, int start, int length, int fla
 	std::cout << "checksumming done" << std::endl;
 }
 
-int main(int argc, const char **argv)
+enum
 {
-	po::options_description	options("usage");
-	int fd = -1;
+	binary_magic = 0x01,
+	binary_header_size = 3,
+	binary_lookup = 0xff,
+};
 
-	try
+static std::string binary_frame(unsigned int opcode, const std::vector<int32_t> &args, const std::string &string_arg)
+{
+	std::string frame;
+	unsigned int length;
+
+	length = 2 + (args.size() * 4) + string_arg.length();
+
+	frame.push_back((char)binary_magic);
+	frame.push_back((char)(length & 0xff));
+	frame.push_back((char)((length >> 8) & 0xff));
+	frame.push_back((char)opcode);
+	frame.push_back((char)args.size());
+
+	for(const auto &it : args)
 	{
-		std::string host;
-		std::string port;
-		std::string filename;
-		std::string start_string;
-		std::string length_string;
-		std::string chunk_size_string;
-		unsigned int start, length, chunk_size;
-		bool use_udp = false;
-		bool verbose = false;
-		bool verbose2 = false;
-		bool nocommit = false;
-		bool noreset = false;
-		bool notemp = false;
-		bool otawrite = false;
-		bool use_force = false;
-		bool erase_before_write = false;
-		bool cmd_write = false;
-		bool cmd_simulate = false;
-		bool cmd_verify = false;
-		bool cmd_checksum = false;
-		bool cmd_read = false;
-		bool force_used;
-		action_t action;
+		frame.push_back((char)((it >>  0) & 0xff));
+		frame.push_back((char)((it >>  8) & 0xff));
+		frame.push_back((char)((it >> 16) & 0xff));
+		frame.push_back((char)((it >> 24) & 0xff));
+	}
 
-		options.add_options()
-			("checksum,C",	po::bool_switch(&cmd_checksum)->implicit_value(true),				"CHECKSUM")
-			("chunksize,c",	po::value<std::string>(&chunk_size_string)->default_value("0"),		"send/receive chunk size")
-			("erase,e",		po::bool_switch(&erase_before_write)->implicit_value(true),			"erase before write (instead of during write)")
-			("filename,f",	po::value<std::string>(&filename),									"file name")
-			("force,F",		po::bool_switch(&use_force)->implicit_value(true),					"use force if image seems to be incompatible")
-			("host,h",		po::value<std::string>(&host)->required(),							"host to connect to")
-			("length,l",	po::value<std::string>(&length_string)->default_value("0x1000"),	"read length")
-			("nocommit,n",	po::bool_switch(&nocommit)->implicit_value(true),					"don't commit after writing")
-			("noreset,N",	po::bool_switch(&noreset)->implicit_value(true),					"don't reset after commit")
-			("notemp,t",	po::bool_switch(&notemp)->implicit_value(true),						"don't commit temporarily, commit to flash")
-			("port,p",		po::value<std::string>(&port)->default_value("24"),					"port to connect to")
-			("start,s",		po::value<std::string>(&start_string)->default_value("2147483647"),	"send/receive start address")
-			("read,R",		po::bool_switch(&cmd_read)->implicit_value(true),					"READ")
-			("simulate,S",	po::bool_switch(&cmd_simulate)->implicit_value(true),				"WRITE simulate")
-			("udp,u",		po::bool_switch(&use_udp)->implicit_value(true),					"use UDP instead of TCP")
-			("verbose,v",	po::bool_switch(&verbose)->implicit_value(true),					"verbose output")
-			("verbose2,x",	po::bool_switch(&verbose2)->implicit_value(true),					"less verbose output")
-			("verify,V",	po::bool_switch(&cmd_verify)->implicit_value(true),					"VERIFY")
-			("write,W",		po::bool_switch(&cmd_write)->implicit_value(true),					"WRITE");
+	frame.append(string_arg);
 
-		po::positional_options_description positional_options;
+	return(frame);
+}
 
-		po::variables_map varmap;
-		po::store(po::parse_command_line(argc, argv, options), varmap);
-		po::notify(varmap);
+static void binary_transaction(GenericSocket &channel, const std::string &frame, unsigned int &status, std::string &payload, int &received)
+{
+	std::string header;
+	unsigned int length;
 
-		if(cmd_checksum)
-			action = action_checksum;
-		else
-			if(cmd_verify)
-				action = action_verify;
-			else
-				if(cmd_simulate)
-					action = action_simulate;
-				else
-					if(cmd_write)
-						action = action_write;
-					else
-						if(cmd_read)
-							action = action_read;
-						else
-							action = action_none;
+	if(!channel.send(2000, frame, true))
+		throw(std::string("binary send failed"));
 
-		start = 0;
-		chunk_size = 0;
+	if(!channel.receive_exact(2000, header, binary_header_size + 2))
+		throw(std::string("binary receive header failed"));
 
-		try
-		{
-			chunk_size = std::stoi(chunk_size_string, 0, 0);
-		}
-		catch(...)
-		{
-			throw(std::string("invalid value for chunk size argument"));
-		}
+	if((unsigned char)header[0] != binary_magic)
+		throw(std::string("binary reply invalid"));
 
-		try
-		{
-			start = std::stoi(start_string, 0, 0);
-		}
-		catch(...)
-		{
-			throw(std::string("invalid value for start argument"));
-		}
+	length = (unsigned char)header[1] | ((unsigned char)header[2] << 8);
 
-		try
-		{
-			length = std::stoi(length_string, 0, 0);
-		}
-		catch(...)
-		{
-			throw(std::string("invalid value for length argument"));
-		}
+	if(length < 2)
+		throw(std::string("binary reply too short"));
 
-		std::string reply;
-		std::vector<int> int_value;
-		std::vector<std::string> string_value;
-		unsigned int flash_sector_size, flash_ota, flash_slots, flash_slot;
-		unsigned int flash_address[4];
-		unsigned int preferred_chunk_size;
+	if(!channel.receive_exact(2000, payload, length - 2))
+		throw(std::string("binary receive payload failed"));
 
-		GenericSocket channel(host, port, use_udp, verbose);
+	status = (unsigned char)header[4];
+	received = header.length() + payload.length();
+}
 
-		force_used = false;
+// compare the text and the binary framed protocol for a (single line reply) command,
+// leading numeric arguments are sent as binary arguments, the rest as string argument
 
-		try
-		{
-			process(channel, "flash-info", reply, "OK [^,]+, sector size: ([0-9]+)[^,]+, OTA update available: ([0-9]+), "
-						"slots: ([0-9]+), slot: ([0-9]+), "
-						"address: ([0-9]+), address: ([0-9]+), address: ([0-9]+), address: ([0-9]+)"
-						"(?:, preferred chunk size: ([0-9]+))?"
-						"\\s*",
-						string_value, int_value, verbose);
-		}
-		catch(std::string &e)
+static void command_benchmark(GenericSocket &channel, const std::string &command, int iterations, bool verbose)
+{
+	boost::regex re_token("\\S+");
+	std::vector<std::string> tokens;
+	std::vector<int32_t> args;
+	std::string string_arg, frame, reply;
+	struct timeval time_start, time_now;
+	unsigned int token, opcode, status;
+	int iteration, received, bytes_sent[2], bytes_received[2];
+	double duration, total[2], min[2], max[2];
+	const char *name[2] = { "text", "binary" };
+	char *end;
+	long value;
+	int mode;
+
+	if(channel.udp())
+		throw(std::string("benchmark requires tcp"));
+
+	for(boost::sregex_iterator it(command.begin(), command.end(), re_token), end; it != end; it++)
+		tokens.push_back(it->str());
+
+	if(tokens.empty())
+		throw(std::string("benchmark: command required"));
+
+	for(token = 1; token < tokens.size(); token++)
+	{
+		value = strtol(tokens[token].c_str(), &end, 0);
+
+		if(*end != '\0')
+			break;
+
+		args.push_back((int32_t)value);
+	}
+
+	for(; token < tokens.size(); token++)
+		string_arg += (string_arg.empty() ? "" : " ") + tokens[token];
+
+	binary_transaction(channel, binary_frame(binary_lookup, std::vector<int32_t>(), tokens[0]), status, reply, received);
+
+	if((status != 0) || (reply.length() != 1))
+		throw(std::string("benchmark: command unknown: ") + tokens[0]);
+
+	opcode = (unsigned char)reply[0];
+	frame = binary_frame(opcode, args, string_arg);
+
+	std::cout << "benchmark \"" << command << "\", opcode: " << opcode << ", binary arguments: " << args.size()
+			<< ", string argument: \"" << string_arg << "\", iterations: " << iterations << std::endl;
+
+	for(mode = 0; mode < 2; mode++)
+	{
+		total[mode] = 0;
+		min[mode] = 0;
+		max[mode] = 0;
+		bytes_sent[mode] = 0;
+		bytes_received[mode] = 0;
+
+		for(iteration = 0; iteration < iterations; iteration++)
 		{
-			if(use_force)
+			gettimeofday(&time_start, 0);
+
+			if(mode == 0)
 			{
-				std::cout << "OTA incompatible image, trying to continue due to force flag: " << e << std::endl;
+				if(!channel.send(2000, command) || !channel.receive_line(2000, reply))
+					throw(std::string("benchmark: text request failed"));
+
+				tokens.clear();
+
+				for(boost::sregex_iterator it(reply.begin(), reply.end(), re_token), end; it != end; it++)
+					tokens.push_back(it->str());
+
+				bytes_sent[mode] = command.length() + 2;
+				bytes_received[mode] = reply.length() + 1;
+			}
+			else
+			{
+				binary_transaction(channel, frame, status, reply, received);
+
+				bytes_sent[mode] = frame.length();
+				bytes_received[mode] = received;
+			}
+
+			gettimeofday(&time_now, 0);
+			duration = ((time_now.tv_sec - time_start.tv_sec) * 1000000.0) + (time_now.tv_usec - time_start.tv_usec);
+
+			if(verbose)
+			{
+				std::cout << name[mode] << " #" << iteration << ": " << duration << " us, reply: ";
+
+				// native binary handlers reply with binary values
+
+				for(token = 0; (token < reply.length()) && (isprint((unsigned char)reply[token]) || isspace((unsigned char)reply[token])); token++)
+					;
+
+				if(token < reply.length())
+				{
+					for(token = 0; token < reply.length(); token++)
+						std::cout << std::hex << std::setw(2) << std::setfill('0') << (unsigned int)(unsigned char)reply[token] << " ";
+
+					std::cout << std::dec << std::setw(0) << std::setfill(' ');
+				}
+				else
+					std::cout << reply;
+
+				std::cout << std::endl;
+			}
+
+			total[mode] += duration;
+
+			if((iteration == 0) || (duration < min[mode]))
+				min[mode] = duration;
+
+			if(duration > max[mode])
+				max[mode] = duration;
+		}
+	}
+
+	for(mode = 0; mode < 2; mode++)
+		std::cout << std::setw(6) << name[mode] << ": avg " << std::setprecision(0) << std::fixed << std::setw(6) << (total[mode] / iterations)
+				<< " us, min " << std::setw(6) << min[mode] << " us, max " << std::setw(6) << max[mode]
+				<< " us, request " << std::setw(4) << bytes_sent[mode] << " bytes, reply " << std::setw(4) << bytes_received[mode] << " bytes" << std::endl;
+}
+
+// one session with one host: flash-info, the requested action and after an ota write, the commit and reboot
+
+static void session_run(const std::string &host, const session_options_t &options, write_result_t &result)
+{
+	std::string reply;
+	std::vector<int> int_value;
+	std::vector<std::string> string_value;
+	unsigned int flash_sector_size, flash_ota, flash_slots, flash_slot;
+	unsigned int flash_address[4];
+	unsigned int preferred_chunk_size;
+	unsigned int start = options.start;
+	unsigned int chunk_size = options.chunk_size;
+	bool otawrite = false;
+	bool force_used;
+	int fd = -1;
+
+	GenericSocket channel(host, options.port, options.use_udp, options.verbose);
+
+	try
+	{
+		force_used = false;
+
+		try
+		{
+			process(channel, "flash-info", reply, "OK [^,]+, sector size: ([0-9]+)[^,]+, OTA update available: ([0-9]+), "
+						"slots: ([0-9]+), slot: ([0-9]+), "
+						"address: ([0-9]+), address: ([0-9]+), address: ([0-9]+), address: ([0-9]+)"
+						"(?:, preferred chunk size: ([0-9]+))?"
+						"\\s*",
+						string_value, int_value, options.verbose);
+		}
+		catch(std::string &e)
+		{
+			if(options.use_force)
+			{
+				std::cout << "OTA incompatible image, trying to continue due to force flag: " << e << std::endl;
 				force_used = true;
 			}
 			else
@@ -1034,7 +1618,7 @@ int main(int argc, const char **argv)
 		{
 			if(flash_ota)
 			{
-				if(action == action_write)
+				if(options.action == action_write)
 				{
 					flash_slot++;
 
@@ -1054,14 +1638,14 @@ int main(int argc, const char **argv)
 
 		int64_t file_length = 0;
 
-		if((action != action_none) && (action != action_read))
+		if((options.action != action_none) && (options.action != action_read))
 		{
 			struct stat stat;
 
-			if(filename.empty())
+			if(options.filename.empty())
 				throw(std::string("file name required"));
 
-			if((fd = open(filename.c_str(), O_RDONLY, 0)) < 0)
+			if((fd = open(options.filename.c_str(), O_RDONLY, 0)) < 0)
 				throw(std::string("file not found"));
 
 			fstat(fd, &stat);
@@ -1069,28 +1653,28 @@ int main(int argc, const char **argv)
 			file_length = stat.st_size;
 		}
 
-		if(action == action_read)
+		if(options.action == action_read)
 		{
-			if(filename.empty())
+			if(options.filename.empty())
 				throw(std::string("file name required"));
 
-			if((fd = open(filename.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0777)) < 0)
+			if((fd = open(options.filename.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0777)) < 0)
 				throw(std::string("can't create file"));
 
 			file_length = 0;
 		}
 
-		switch(action)
+		switch(options.action)
 		{
 			case(action_read):
 			{
-				command_read(channel, fd, start, length, flash_sector_size, chunk_size, verbose);
+				command_read(channel, fd, start, options.length, flash_sector_size, chunk_size, options.verbose);
 				break;
 			}
 
 			case(action_checksum):
 			{
-				command_checksum(channel, fd, file_length, start, flash_sector_size, verbose);
+				command_checksum(channel, fd, file_length, start, flash_sector_size, options.verbose);
 				break;
 			}
 
@@ -1098,7 +1682,7 @@ int main(int argc, const char **argv)
 			case(action_simulate):
 			case(action_verify):
 			{
-				command_write(channel, fd, file_length, start, flash_sector_size, chunk_size, verbose, action, erase_before_write);
+				command_write(channel, fd, file_length, start, flash_sector_size, chunk_size, options.window, options.compress, options.verbose, options.action, options.erase_before_write, result);
 				break;
 			}
 
@@ -1108,22 +1692,22 @@ int main(int argc, const char **argv)
 			}
 		}
 
-		if((action == action_write) && otawrite)
+		if((options.action == action_write) && otawrite)
 		{
-			if(!nocommit)
+			if(!options.nocommit)
 			{
 				std::string send_string;
 				std::string reply;
 
-				if(notemp)
+				if(options.notemp)
 				{
 					send_string = std::string("flash-select ") + std::to_string(flash_slot);
-					process(channel, send_string, reply, "OK flash-select: slot ([0-9]+) selected, address ([0-9]+)\\s*", string_value, int_value, verbose || verbose2);
+					process(channel, send_string, reply, "OK flash-select: slot ([0-9]+) selected, address ([0-9]+)\\s*", string_value, int_value, options.verbose || options.verbose2);
 				}
 				else
 				{
 					send_string = std::string("flash-select-once ") + std::to_string(flash_slot);
-					process(channel, send_string, reply, "OK flash-select-once: slot ([0-9]+) selected, address ([0-9]+)\\s*", string_value, int_value, verbose ||verbose2);
+					process(channel, send_string, reply, "OK flash-select-once: slot ([0-9]+) selected, address ([0-9]+)\\s*", string_value, int_value, options.verbose ||options.verbose2);
 				}
 
 				if((unsigned int)int_value[0] != flash_slot)
@@ -1132,14 +1716,14 @@ int main(int argc, const char **argv)
 				if((unsigned int)int_value[1] != start)
 					throw(std::string("flash-select failed, local address (") +  std::to_string(flash_slot) + ") != remote address (" + std::to_string(int_value[0]) + ")");
 
-				if(notemp)
+				if(options.notemp)
 					std::cout << "selected boot slot";
 				else
 					std::cout << "selected one time boot slot";
 
 				std::cout << ": " << flash_slot << ", address: 0x" << std::hex << std::setw(6) << std::setfill('0') << start << std::dec << std::setw(0) << std::endl;
 
-				if(!noreset)
+				if(!options.noreset)
 				{
 					std::cout << "rebooting" << std::endl;
 
@@ -1151,14 +1735,14 @@ int main(int argc, const char **argv)
 
 					std::cout << "reboot finished" << std::endl;
 
-					if(!notemp)
+					if(!options.notemp)
 					{
 						process(channel, "flash-info", reply, "OK [^,]+, sector size: ([0-9]+)[^,]+, OTA update available: ([0-9]+), "
 									"slots: ([0-9]+), slot: ([0-9]+), "
 									"address: ([0-9]+), address: ([0-9]+), address: ([0-9]+), address: ([0-9]+)"
 									"(?:, preferred chunk size: ([0-9]+))?"
 									"\\s*",
-									string_value, int_value, verbose);
+									string_value, int_value, options.verbose);
 
 						if(int_value[3] != (int)flash_slot)
 							std::cout << "boot failed, requested slot: " << flash_slot << ", active slot: " << int_value[3] << std::endl;
@@ -1172,7 +1756,7 @@ int main(int argc, const char **argv)
 							send_string = std::string("flash-select ") + std::to_string(flash_slot);
 							process(channel, send_string, reply,
 									"OK flash-select: slot ([0-9]+) selected, address ([0-9]+)\\s*",
-									string_value, int_value, verbose || verbose2);
+									string_value, int_value, options.verbose || options.verbose2);
 
 							if((unsigned int)int_value[0] != flash_slot)
 								throw(std::string("flash-select failed, local slot (") + std::to_string(flash_slot) + ") != remote slot (" + std::to_string(int_value[0]) + ")");
@@ -1183,12 +1767,467 @@ int main(int argc, const char **argv)
 					}
 				}
 
-				process(channel, "stats", reply, "> firmware version date: ([a-zA-Z0-9: ]+).*", string_value, int_value, verbose, 1000);
+				process(channel, "stats", reply, "> firmware version date: ([a-zA-Z0-9: ]+).*", string_value, int_value, options.verbose, 1000);
 
 				std::cout << "firmware version: " << string_value[0] << std::endl;
 			}
 		}
 	}
+	catch(...)
+	{
+		if(fd >= 0)
+			close(fd);
+
+		throw;
+	}
+
+	if(fd >= 0)
+		close(fd);
+}
+
+// what a fleet session child reports back to the parent through its pipe
+
+typedef struct
+{
+	bool success;
+	write_result_t write;
+	char error[256];
+} fleet_result_t;
+
+typedef struct
+{
+	std::string host;
+	pid_t pid;
+	int fd;
+	struct timeval time_start;
+	double duration;
+	fleet_result_t result;
+	size_t result_length;
+	bool success;
+} fleet_session_t;
+
+// entry point of the child process for one host, it never returns to the caller,
+// the result goes through the pipe and the exit status tells whether the session succeeded
+
+static void fleet_session_child(const std::string &host, const session_options_t &options, int result_fd) __attribute__((noreturn));
+
+static void fleet_session_child(const std::string &host, const session_options_t &options, int result_fd)
+{
+	fleet_result_t result;
+	const char *data;
+	size_t length;
+	ssize_t written;
+	int null_fd;
+
+	memset(&result, 0, sizeof(result));
+
+	// the parent prints one line per host, the session's own output is only shown in verbose mode
+
+	if(!options.verbose && ((null_fd = open("/dev/null", O_WRONLY, 0)) >= 0))
+	{
+		dup2(null_fd, 1);
+		dup2(null_fd, 2);
+		close(null_fd);
+	}
+
+	try
+	{
+		session_run(host, options, result.write);
+		result.success = true;
+	}
+	catch(const std::string &e)
+	{
+		strncpy(result.error, e.c_str(), sizeof(result.error) - 1);
+	}
+	catch(const std::exception &e)
+	{
+		strncpy(result.error, e.what(), sizeof(result.error) - 1);
+	}
+	catch(...)
+	{
+		strncpy(result.error, "unknown exception caught", sizeof(result.error) - 1);
+	}
+
+	std::cout.flush();
+	std::cerr.flush();
+
+	for(data = (const char *)&result, length = sizeof(result); length > 0; data += written, length -= written)
+		if((written = write(result_fd, data, length)) <= 0)
+			_exit(2);
+
+	_exit(result.success ? 0 : 1);
+}
+
+static void fleet_session_finished(fleet_session_t &session, int status)
+{
+	struct timeval time_now;
+
+	gettimeofday(&time_now, 0);
+	session.duration = (time_now.tv_sec - session.time_start.tv_sec) + ((time_now.tv_usec - session.time_start.tv_usec) / 1000000.0);
+	session.success = WIFEXITED(status) && (WEXITSTATUS(status) == 0) && (session.result_length == sizeof(session.result)) && session.result.success;
+
+	std::cout << std::setfill(' ') << std::setw(20) << std::left << session.host << std::right;
+
+	if(session.success)
+		std::cout << " ok, sent " << std::setw(4) << session.result.write.sectors_sent << " sectors, skipped " << std::setw(4) << session.result.write.sectors_skipped << " sectors"
+				<< ", saved " << std::setw(7) << session.result.write.bytes_saved << " bytes";
+	else
+	{
+		std::cout << " FAILED: ";
+
+		if(session.result_length != sizeof(session.result))
+			std::cout << "no result, exit status " << status;
+		else
+			std::cout << session.result.error;
+	}
+
+	std::cout << ", " << std::setprecision(1) << std::fixed << session.duration << " seconds";
+
+	if(session.success && (session.duration > 0))
+		std::cout << ", " << std::setprecision(0) << (session.result.write.sectors_sent * 4096 / 1024.0 / session.duration) << " kbytes/s";
+
+	std::cout << std::endl;
+}
+
+// returns the number of hosts that failed
+
+static unsigned int fleet_run(const std::string &hosts_file, unsigned int parallel, const session_options_t &options)
+{
+	std::vector<fleet_session_t> sessions;
+	std::ifstream hosts_stream(hosts_file);
+	std::string line;
+	struct epoll_event event;
+	struct epoll_event events[16];
+	struct timeval time_start, time_now;
+	unsigned int next, running, failed, sectors_sent, sectors_skipped;
+	int64_t bytes_saved;
+	int epoll_fd, pipe_fd[2], ready, current, status;
+	ssize_t length;
+	double duration;
+	fleet_session_t session;
+
+	// every host gets its own session in a child process, the parent waits on the result pipes with epoll,
+	// starts the next host when one finishes and prints a summary line per host and an overall report
+
+	if(!hosts_stream)
+		throw(std::string("can't open hosts file"));
+
+	while(std::getline(hosts_stream, line))
+	{
+		line.erase(0, line.find_first_not_of(" \t"));
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+
+		if(line.empty() || (line[0] == '#'))
+			continue;
+
+		session.host = line;
+		session.pid = -1;
+		session.fd = -1;
+		session.duration = 0;
+		memset(&session.result, 0, sizeof(session.result));
+		session.result_length = 0;
+		session.success = false;
+		sessions.push_back(session);
+	}
+
+	if(sessions.empty())
+		throw(std::string("no hosts in hosts file"));
+
+	if(parallel == 0)
+		parallel = 1;
+
+	if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		throw(std::string("epoll_create failed"));
+
+	std::cout << "updating " << sessions.size() << " hosts, " << parallel << " at a time" << std::endl;
+
+	gettimeofday(&time_start, 0);
+
+	for(next = 0, running = 0; (next < sessions.size()) || (running > 0);)
+	{
+		for(; (next < sessions.size()) && (running < parallel); next++)
+		{
+			if(pipe2(pipe_fd, O_CLOEXEC))
+				throw(std::string("pipe failed"));
+
+			std::cout.flush();
+			std::cerr.flush();
+
+			if((sessions[next].pid = fork()) < 0)
+				throw(std::string("fork failed"));
+
+			if(sessions[next].pid == 0)
+			{
+				close(pipe_fd[0]);
+				close(epoll_fd);
+
+				for(const auto &it : sessions)
+					if(it.fd >= 0)
+						close(it.fd);
+
+				fleet_session_child(sessions[next].host, options, pipe_fd[1]);
+			}
+
+			close(pipe_fd[1]);
+
+			sessions[next].fd = pipe_fd[0];
+			gettimeofday(&sessions[next].time_start, 0);
+
+			event.events = EPOLLIN;
+			event.data.u32 = next;
+
+			if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pipe_fd[0], &event))
+				throw(std::string("epoll_ctl failed"));
+
+			running++;
+		}
+
+		if((ready = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(*events), -1)) < 0)
+		{
+			if(errno == EINTR)
+				continue;
+
+			throw(std::string("epoll_wait failed"));
+		}
+
+		for(current = 0; current < ready; current++)
+		{
+			fleet_session_t &active = sessions[events[current].data.u32];
+
+			if(active.result_length < sizeof(active.result))
+			{
+				if((length = read(active.fd, (char *)&active.result + active.result_length, sizeof(active.result) - active.result_length)) > 0)
+				{
+					active.result_length += length;
+					continue;
+				}
+
+				if((length < 0) && (errno == EINTR))
+					continue;
+			}
+
+			// end of file (the child exited) or more data than a result, either way the session is over
+
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, active.fd, nullptr);
+			close(active.fd);
+			active.fd = -1;
+
+			while(waitpid(active.pid, &status, 0) < 0)
+				if(errno != EINTR)
+				{
+					status = -1;
+					break;
+				}
+
+			fleet_session_finished(active, status);
+			running--;
+		}
+	}
+
+	close(epoll_fd);
+
+	gettimeofday(&time_now, 0);
+	duration = (time_now.tv_sec - time_start.tv_sec) + ((time_now.tv_usec - time_start.tv_usec) / 1000000.0);
+
+	failed = 0;
+	sectors_sent = 0;
+	sectors_skipped = 0;
+	bytes_saved = 0;
+
+	for(const auto &it : sessions)
+	{
+		if(!it.success)
+		{
+			failed++;
+			continue;
+		}
+
+		sectors_sent += it.result.write.sectors_sent;
+		sectors_skipped += it.result.write.sectors_skipped;
+		bytes_saved += it.result.write.bytes_saved;
+	}
+
+	std::cout << std::endl << "fleet update finished in " << std::setprecision(1) << std::fixed << duration << " seconds";
+	std::cout << ", hosts: " << sessions.size() << ", succeeded: " << (sessions.size() - failed) << ", failed: " << failed;
+	std::cout << ", sent: " << sectors_sent << " sectors, skipped: " << sectors_skipped << " sectors, saved: " << bytes_saved << " bytes";
+
+	if(duration > 0)
+		std::cout << ", aggregate rate: " << std::setprecision(0) << (sectors_sent * 4096 / 1024.0 / duration) << " kbytes/s";
+
+	std::cout << std::endl;
+
+	if(failed > 0)
+	{
+		std::cout << "failed hosts:";
+
+		for(const auto &it : sessions)
+			if(!it.success)
+				std::cout << " " << it.host;
+
+		std::cout << std::endl;
+	}
+
+	return(failed);
+}
+
+int main(int argc, const char **argv)
+{
+	po::options_description	options("usage");
+
+	try
+	{
+		std::string host;
+		std::string port;
+		std::string filename;
+		std::string start_string;
+		std::string length_string;
+		std::string chunk_size_string;
+		std::string window_string;
+		std::string hosts_file;
+		std::string benchmark_command;
+		unsigned int iterations;
+		unsigned int start, length, chunk_size, window, parallel;
+		bool use_udp = false;
+		bool verbose = false;
+		bool verbose2 = false;
+		bool nocommit = false;
+		bool noreset = false;
+		bool notemp = false;
+		bool use_force = false;
+		bool erase_before_write = false;
+		bool compress = false;
+		bool cmd_write = false;
+		bool cmd_simulate = false;
+		bool cmd_verify = false;
+		bool cmd_checksum = false;
+		bool cmd_read = false;
+		action_t action;
+
+		options.add_options()
+			("checksum,C",	po::bool_switch(&cmd_checksum)->implicit_value(true),				"CHECKSUM")
+			("benchmark,b",	po::value<std::string>(&benchmark_command),							"compare text and binary protocol for a command")
+			("chunksize,c",	po::value<std::string>(&chunk_size_string)->default_value("0"),		"send/receive chunk size")
+			("compress,z",	po::bool_switch(&compress)->implicit_value(true),					"compress sectors during windowed write (tcp only)")
+			("erase,e",		po::bool_switch(&erase_before_write)->implicit_value(true),			"erase before write (instead of during write)")
+			("filename,f",	po::value<std::string>(&filename),									"file name")
+			("force,F",		po::bool_switch(&use_force)->implicit_value(true),					"use force if image seems to be incompatible")
+			("host,h",		po::value<std::string>(&host),										"host to connect to")
+			("hosts,H",		po::value<std::string>(&hosts_file),								"file with hosts to update, one per line, instead of --host")
+			("iterations,i",	po::value<unsigned int>(&iterations)->default_value(100),			"benchmark iterations")
+			("length,l",	po::value<std::string>(&length_string)->default_value("0x1000"),	"read length")
+			("nocommit,n",	po::bool_switch(&nocommit)->implicit_value(true),					"don't commit after writing")
+			("noreset,N",	po::bool_switch(&noreset)->implicit_value(true),					"don't reset after commit")
+			("notemp,t",	po::bool_switch(&notemp)->implicit_value(true),						"don't commit temporarily, commit to flash")
+			("parallel,P",	po::value<unsigned int>(&parallel)->default_value(8),				"number of hosts to update concurrently with --hosts")
+			("port,p",		po::value<std::string>(&port)->default_value("24"),					"port to connect to")
+			("start,s",		po::value<std::string>(&start_string)->default_value("2147483647"),	"send/receive start address")
+			("read,R",		po::bool_switch(&cmd_read)->implicit_value(true),					"READ")
+			("simulate,S",	po::bool_switch(&cmd_simulate)->implicit_value(true),				"WRITE simulate")
+			("udp,u",		po::bool_switch(&use_udp)->implicit_value(true),					"use UDP instead of TCP")
+			("verbose,v",	po::bool_switch(&verbose)->implicit_value(true),					"verbose output")
+			("verbose2,x",	po::bool_switch(&verbose2)->implicit_value(true),					"less verbose output")
+			("verify,V",	po::bool_switch(&cmd_verify)->implicit_value(true),					"VERIFY")
+			("window,w",	po::value<std::string>(&window_string)->default_value("4"),			"sectors in flight during write (tcp only), 1 = one chunk at a time, automatic for older firmware")
+			("write,W",		po::bool_switch(&cmd_write)->implicit_value(true),					"WRITE");
+
+		po::positional_options_description positional_options;
+
+		po::variables_map varmap;
+		po::store(po::parse_command_line(argc, argv, options), varmap);
+		po::notify(varmap);
+
+		if(cmd_checksum)
+			action = action_checksum;
+		else
+			if(cmd_verify)
+				action = action_verify;
+			else
+				if(cmd_simulate)
+					action = action_simulate;
+				else
+					if(cmd_write)
+						action = action_write;
+					else
+						if(cmd_read)
+							action = action_read;
+						else
+							action = action_none;
+
+		start = 0;
+		chunk_size = 0;
+
+		try
+		{
+			chunk_size = std::stoi(chunk_size_string, 0, 0);
+		}
+		catch(...)
+		{
+			throw(std::string("invalid value for chunk size argument"));
+		}
+
+		try
+		{
+			start = std::stoi(start_string, 0, 0);
+		}
+		catch(...)
+		{
+			throw(std::string("invalid value for start argument"));
+		}
+
+		try
+		{
+			length = std::stoi(length_string, 0, 0);
+		}
+		catch(...)
+		{
+			throw(std::string("invalid value for length argument"));
+		}
+
+		try
+		{
+			window = std::stoi(window_string, 0, 0);
+		}
+		catch(...)
+		{
+			throw(std::string("invalid value for window argument"));
+		}
+
+		session_options_t session_options;
+		write_result_t result;
+
+		session_options.port = port;
+		session_options.filename = filename;
+		session_options.start = start;
+		session_options.length = length;
+		session_options.chunk_size = chunk_size;
+		session_options.window = window;
+		session_options.use_udp = use_udp;
+		session_options.verbose = verbose;
+		session_options.verbose2 = verbose2;
+		session_options.nocommit = nocommit;
+		session_options.noreset = noreset;
+		session_options.notemp = notemp;
+		session_options.use_force = use_force;
+		session_options.erase_before_write = erase_before_write;
+		session_options.compress = compress;
+		session_options.action = action;
+
+		if(!hosts_file.empty())
+			return(fleet_run(hosts_file, parallel, session_options) > 0 ? 1 : 0);
+
+		if(host.empty())
+			throw(std::string("host or hosts file required"));
+
+		if(!benchmark_command.empty())
+		{
+			GenericSocket channel(host, port, use_udp, verbose);
+
+			command_benchmark(channel, benchmark_command, iterations > 0 ? iterations : 1, verbose);
+			return(0);
+		}
+
+		session_run(host, session_options, result);
+	}
 	catch(const po::error &e)
 	{
 		std::cerr << std::endl << "espflash: " << e.what() << std::endl << options;
@@ -1210,14 +2249,8 @@ int main(int argc, const char **argv)
 		goto error;
 	}
 
-	if(fd >= 0)
-		close(fd);
-
 	return(0);
 
 error:
-	if(fd >= 0)
-		close(fd);
-
 	return(1);
 }
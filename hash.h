@@ -0,0 +1,23 @@
+#ifndef hash_h
+#define hash_h
+
+#include <stdint.h>
+
+#include "attribute.h"
+
+// 32 bit FNV-1a, for the command and config indexes, SDK independent so host-sim can use it
+
+attr_inline attr_pure uint32_t fnv1a_hash(const char *src, int length)
+{
+	uint32_t hash = 2166136261U;
+
+	for(; length > 0; length--, src++)
+	{
+		hash ^= (uint8_t)*src;
+		hash *= 16777619U;
+	}
+
+	return(hash);
+}
+
+#endif
@@ -0,0 +1,764 @@
+#include "queue.h"
+#include "hash.h"
+#include "pwm.h"
+
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Host side checks and benchmarks for the SDK independent modules, see host-sim.h.
+ * Usage: host-sim [name ...], without names everything is run.
+ */
+
+typedef struct
+{
+	const char *name;
+	_Bool (*function)(void);
+	const char *description;
+} host_sim_table_t;
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return(((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec);
+}
+
+// push and pop random amounts across the wrap, every byte must come out once and in order
+
+static _Bool sim_queue(void)
+{
+	enum { size = 64, rounds = 100000 };
+	static char buffer[size];
+	queue_t queue;
+	char chunk[size + 16];
+	unsigned int round, length, space, done, ix;
+	uint8_t next_in, next_out;
+
+	queue_new(&queue, size, buffer);
+	srandom(1);
+
+	for(round = 0, next_in = 0, next_out = 0; round < rounds; round++)
+	{
+		length = random() % sizeof(chunk);
+
+		for(ix = 0; ix < length; ix++)
+			chunk[ix] = (char)(next_in + ix);
+
+		space = queue_space(&queue);
+		done = queue_push_n(&queue, chunk, length);
+
+		if(done != ((length < space) ? length : space))
+		{
+			fprintf(stderr, "queue: round %u: pushed %u of %u\n", round, done, length);
+			return(false);
+		}
+
+		next_in += done;
+
+		if((queue_length(&queue) > size) || (queue_full(&queue) != (queue_length(&queue) == size)))
+		{
+			fprintf(stderr, "queue: round %u: length %u inconsistent\n", round, queue_length(&queue));
+			return(false);
+		}
+
+		length = random() % sizeof(chunk);
+		done = queue_pop_n(&queue, chunk, length);
+
+		for(ix = 0; ix < done; ix++, next_out++)
+		{
+			if((uint8_t)chunk[ix] != next_out)
+			{
+				fprintf(stderr, "queue: round %u: byte %u is %u, expected %u\n", round, ix, (uint8_t)chunk[ix], next_out);
+				return(false);
+			}
+		}
+	}
+
+	return(true);
+}
+
+// the queue as it was before push_n/pop_n: int indexes wrapped with %, one byte per call
+
+typedef struct
+{
+	char *data;
+	int size;
+	int in;
+	int out;
+} queue_modulo_t;
+
+static void queue_modulo_new(queue_modulo_t *queue, int size, char *buffer)
+{
+	queue->data = buffer;
+	queue->size = size;
+	queue->in = 0;
+	queue->out = 0;
+}
+
+static char queue_modulo_empty(const queue_modulo_t *queue)
+{
+	return(queue->in == queue->out);
+}
+
+static char queue_modulo_full(const queue_modulo_t *queue)
+{
+	return(((queue->in + 1) % queue->size) == queue->out);
+}
+
+static void queue_modulo_push(queue_modulo_t *queue, char data)
+{
+	queue->data[queue->in] = data;
+	queue->in = (queue->in + 1) % queue->size;
+}
+
+static char queue_modulo_pop(queue_modulo_t *queue)
+{
+	char data;
+
+	data = queue->data[queue->out];
+	queue->out = (queue->out + 1) % queue->size;
+
+	return(data);
+}
+
+/*
+ * Throughput of the uart receive path: the isr drains the fifo in bursts of 128 bytes
+ * (see fetch_queue) into a 1024 byte queue, the task then empties the queue.
+ * The old queue is read byte by byte, the new one both byte by byte and in blocks.
+ */
+
+static void queue_bench_report(const char *name, uint64_t start, unsigned int total, unsigned int sum)
+{
+	uint64_t spent = time_ns() - start;
+
+	printf("    %-24s %7.1f MB/s (sum %08x)\n", name, (double)total * 1000 / (double)(spent ? spent : 1), sum);
+}
+
+static _Bool sim_queue_bench(void)
+{
+	enum { size = 1024, burst = 128, total = 64 * 1024 * 1024 };
+	static char buffer[size];
+	static volatile int volatile_size = size;
+	char src[burst], dst[size];
+	queue_modulo_t queue_modulo;
+	queue_t queue;
+	unsigned int done, ix, sum[3];
+	uint64_t start;
+
+	for(ix = 0; ix < burst; ix++)
+		src[ix] = (char)(ix * 7);
+
+	queue_modulo_new(&queue_modulo, volatile_size, buffer);
+	start = time_ns();
+
+	for(done = 0, sum[0] = 0; done < total; done += burst)
+	{
+		for(ix = 0; ix < burst; ix++)
+			if(!queue_modulo_full(&queue_modulo))
+				queue_modulo_push(&queue_modulo, src[ix]);
+
+		while(!queue_modulo_empty(&queue_modulo))
+			sum[0] += (uint8_t)queue_modulo_pop(&queue_modulo);
+	}
+
+	queue_bench_report("modulo, byte by byte", start, total, sum[0]);
+
+	queue_new(&queue, volatile_size, buffer);
+	start = time_ns();
+
+	for(done = 0, sum[1] = 0; done < total; done += burst)
+	{
+		for(ix = 0; ix < burst; ix++)
+			if(!queue_full(&queue))
+				queue_push(&queue, src[ix]);
+
+		while(!queue_empty(&queue))
+			sum[1] += (uint8_t)queue_pop(&queue);
+	}
+
+	queue_bench_report("mask, byte by byte", start, total, sum[1]);
+
+	queue_new(&queue, volatile_size, buffer);
+	start = time_ns();
+
+	for(done = 0, sum[2] = 0; done < total; done += burst)
+	{
+		queue_push_n(&queue, src, burst);
+
+		while((ix = queue_pop_n(&queue, dst, sizeof(dst))) > 0)
+			for(; ix > 0; ix--)
+				sum[2] += (uint8_t)dst[ix - 1];
+	}
+
+	queue_bench_report("mask, push_n/pop_n", start, total, sum[2]);
+
+	return((sum[0] == sum[1]) && (sum[1] == sum[2]));
+}
+
+/*
+ * Command lookup, the names are taken from application_function_table (host-sim-commands.h
+ * is generated from application.c). The linear scan is the lookup as it was before the index,
+ * the index uses the same open addressing on fnv1a_hash as find_command in application.c.
+ */
+
+static const char *const command_names[][2] =
+{
+#include "host-sim-commands.h"
+};
+
+enum
+{
+	command_names_size = sizeof(command_names) / sizeof(*command_names),
+	command_index_size = 256,
+};
+
+_Static_assert(command_names_size < command_index_size, "command index too small");
+
+static uint8_t command_index[command_index_size];
+
+attr_pure static _Bool name_match(const char *name, unsigned int length, const char *cstr)
+{
+	return((strlen(cstr) == length) && !memcmp(name, cstr, length));
+}
+
+attr_pure static int lookup_linear(const char *name, unsigned int length)
+{
+	unsigned int entry;
+
+	for(entry = 0; entry < command_names_size; entry++)
+		if(name_match(name, length, command_names[entry][0]) || name_match(name, length, command_names[entry][1]))
+			return(entry);
+
+	return(-1);
+}
+
+static void lookup_index_insert(const char *name, unsigned int entry)
+{
+	unsigned int slot;
+
+	for(slot = fnv1a_hash(name, strlen(name)) & (command_index_size - 1); command_index[slot] != 0; slot = (slot + 1) & (command_index_size - 1))
+		;
+
+	command_index[slot] = entry + 1;
+}
+
+attr_pure static int lookup_index(const char *name, unsigned int length)
+{
+	unsigned int slot, probe;
+
+	slot = fnv1a_hash(name, length) & (command_index_size - 1);
+
+	for(probe = 0; probe < command_index_size; probe++, slot = (slot + 1) & (command_index_size - 1))
+	{
+		if(command_index[slot] == 0)
+			break;
+
+		if(name_match(name, length, command_names[command_index[slot] - 1][0]) ||
+				name_match(name, length, command_names[command_index[slot] - 1][1]))
+			return(command_index[slot] - 1);
+	}
+
+	return(-1);
+}
+
+static _Bool sim_lookup_bench(void)
+{
+	enum { rounds = 20000 };
+	static const char *const names[][2] =
+	{
+		{ "all names",			(const char *)0 },
+		{ "flash-send",			"flash-send" },
+		{ "flash-write-sector",	"flash-write-sector" },
+		{ "unknown",			"no-such-command" },
+	};
+	static const struct
+	{
+		const char *name;
+		int (*function)(const char *, unsigned int);
+	} methods[] =
+	{
+		{ "linear",	lookup_linear },
+		{ "index",	lookup_index },
+	};
+	unsigned int entry, round, ix, method, column, lookups;
+	const char *name;
+	volatile int sink;
+	uint64_t start, spent;
+
+	memset(command_index, 0, sizeof(command_index));
+
+	for(entry = 0; entry < command_names_size; entry++)
+	{
+		if(!*command_names[entry][0])
+			continue;
+
+		lookup_index_insert(command_names[entry][0], entry);
+
+		if(strcmp(command_names[entry][0], command_names[entry][1]))
+			lookup_index_insert(command_names[entry][1], entry);
+	}
+
+	for(entry = 0; entry < command_names_size; entry++)
+	{
+		for(column = 0; (column < 2) && *command_names[entry][column]; column++)
+		{
+			name = command_names[entry][column];
+
+			if(lookup_linear(name, strlen(name)) != lookup_index(name, strlen(name)))
+			{
+				fprintf(stderr, "lookup: %s: linear %d, index %d\n", name,
+						lookup_linear(name, strlen(name)), lookup_index(name, strlen(name)));
+				return(false);
+			}
+		}
+	}
+
+	printf("    %u commands\n", command_names_size - 1);
+
+	for(ix = 0; ix < (sizeof(names) / sizeof(*names)); ix++)
+	{
+		printf("    %-20s", names[ix][0]);
+
+		for(method = 0; method < (sizeof(methods) / sizeof(*methods)); method++)
+		{
+			start = time_ns();
+
+			for(round = 0, lookups = 0; round < rounds; round++)
+			{
+				if(names[ix][1])
+				{
+					sink = methods[method].function(names[ix][1], strlen(names[ix][1]));
+					lookups++;
+					continue;
+				}
+
+				for(entry = 0; entry < command_names_size; entry++)
+				{
+					for(column = 0; (column < 2) && *command_names[entry][column]; column++)
+					{
+						sink = methods[method].function(command_names[entry][column], strlen(command_names[entry][column]));
+						lookups++;
+					}
+				}
+			}
+
+			spent = time_ns() - start;
+
+			printf(" %s %6.1f ns", methods[method].name, (double)spent / lookups);
+		}
+
+		printf("\n");
+	}
+
+	(void)sink;
+
+	return(true);
+}
+
+/*
+ * pwm1 phases, the incremental update must give the same phases as a build from scratch,
+ * for random duty changes, including pins going static, equal duties and too many duties.
+ */
+
+static _Bool pwm_phases_equal(const pwm_phases_t *a, const pwm_phases_t *b)
+{
+	unsigned int phase;
+
+	if((a->amount_phases != b->amount_phases) ||
+			(a->static_pins_on_mask != b->static_pins_on_mask) ||
+			(a->static_pins_off_mask != b->static_pins_off_mask) ||
+			(a->active_pins_all_set_mask != b->active_pins_all_set_mask) ||
+			(a->active_pins_noduty1_set_mask != b->active_pins_noduty1_set_mask) ||
+			(a->active_pins_duty1_clear_mask != b->active_pins_duty1_clear_mask))
+		return(false);
+
+	for(phase = 0; phase < a->amount_phases; phase++)
+		if((a->phase[phase].phase_duty != b->phase[phase].phase_duty) ||
+				(a->phase[phase].phase_delay != b->phase[phase].phase_delay) ||
+				(a->phase[phase].phase_active_pins_clear_mask != b->phase[phase].phase_active_pins_clear_mask))
+			return(false);
+
+	return(true);
+}
+
+// mostly values that hit the special cases, small widths make equal duties likely
+
+static unsigned int pwm_random_duty(const pwm_list_t *list, unsigned int period)
+{
+	unsigned int other = list->duty[random() % pwm_list_pins];
+
+	switch(random() % 8)
+	{
+		case(0): return(0);
+		case(1): return(1);
+		case(2): return(period - 1);
+		case(3): return(period - 2);
+		case(4): return(other);
+		case(5): return((other + 1) % period);
+		default: return(random() % period);
+	}
+}
+
+static _Bool sim_pwm_update(void)
+{
+	enum { rounds = 2000, changes = 200 };
+	pwm_list_t list;
+	pwm_phases_t shadow, reference;
+	unsigned int round, change, width, period, pin, pins, updated, built;
+	_Bool extend, spread;
+	int pdm_pin;
+
+	srandom(1);
+
+	for(round = 0, updated = 0, built = 0; round < rounds; round++)
+	{
+		width = 6 + (random() % 13);
+		period = 1 << width;
+		extend = random() & 0x01;
+		spread = random() & 0x01;
+		pins = 1 + (random() % pwm_list_pins);
+
+		pwm_list_clear(&list);
+		memset(list.duty, 0, sizeof(list.duty));
+
+		for(pin = 0; pin < pins; pin++)
+			pwm_list_insert(&list, pin, pwm_random_duty(&list, period), period);
+
+		pwm_phases_build(&shadow, &list, period, extend, spread);
+
+		for(change = 0; change < changes; change++)
+		{
+			pin = random() % pins;
+
+			pwm_list_remove(&list, pin);
+			pwm_list_insert(&list, pin, pwm_random_duty(&list, period), period);
+
+			if(pwm_phases_update(&shadow, &list, pin, period, extend))
+			{
+				updated++;
+				pdm_pin = -1;
+			}
+			else
+			{
+				built++;
+				pdm_pin = pwm_phases_build(&shadow, &list, period, extend, spread);
+			}
+
+			if((pwm_phases_build(&reference, &list, period, extend, spread) != pdm_pin) || !pwm_phases_equal(&shadow, &reference))
+			{
+				fprintf(stderr, "pwm update: round %u, change %u, pin %u, duty %u, width %u: phases differ from build\n",
+						round, change, pin, list.duty[pin], width);
+				return(false);
+			}
+		}
+	}
+
+	printf("    %u changes, %u updated in place, %u built from scratch\n", updated + built, updated, built);
+
+	return(true);
+}
+
+/*
+ * Golden model of pwm_isr_run in io_gpio.c on a simulated timer, in timer ticks:
+ * at phase 0 the active pins are set (the duty 1 pins only every 8th period if extended)
+ * and the duty 1 pins are cleared again, then every phase clears its pins and waits its delay.
+ * A delay below 2 ticks is skipped (0 ticks), below pwm_table_delay_size (24) it's a busy wait
+ * in the isr, longer delays re-arm the timer and leave the isr (an isr entry).
+ * The timer compensation of pwm_delay_entry[0] is assumed exact, interrupt latency and
+ * wlan nmi contention are not in the model, they add jitter on the real thing.
+ */
+
+enum
+{
+	pwm_model_delay_busy = 24,
+	pwm_model_cycles = 8,
+};
+
+typedef struct
+{
+	uint64_t	ticks;
+	uint64_t	on_ticks[pwm_list_pins];
+	unsigned int	cycle_min;
+	unsigned int	cycle_max;
+	unsigned int	entries;
+	uint64_t	busy_ticks;
+} pwm_model_t;
+
+static void pwm_model_run(const pwm_phases_t *phases, unsigned int cycles, pwm_model_t *model)
+{
+	unsigned int cycle, phase, pin, delay;
+	uint64_t set_at[pwm_list_pins], cycle_start;
+	uint32_t on, mask;
+
+	memset(model, 0, sizeof(*model));
+	model->cycle_min = ~0U;
+
+	for(cycle = 1; cycle <= cycles; cycle++)
+	{
+		cycle_start = model->ticks;
+
+		if(phases->amount_phases < 2)
+		{
+			// the isr is off, only static pins
+
+			model->ticks += 1;
+			on = 0;
+		}
+		else
+		{
+			on = ((cycle % pwm_model_cycles) == 0) ? phases->active_pins_all_set_mask : phases->active_pins_noduty1_set_mask;
+			on &= ~phases->active_pins_duty1_clear_mask;
+
+			for(pin = 0; pin < pwm_list_pins; pin++)
+				set_at[pin] = model->ticks;
+
+			for(phase = 0; phase < phases->amount_phases; phase++)
+			{
+				mask = phases->phase[phase].phase_active_pins_clear_mask & on;
+
+				for(pin = 0; pin < pwm_list_pins; pin++)
+					if(mask & (1 << pin))
+						model->on_ticks[pin] += model->ticks - set_at[pin];
+
+				on &= ~mask;
+				delay = phases->phase[phase].phase_delay;
+
+				if(delay < 2)
+					continue;
+
+				model->ticks += delay;
+
+				if(delay < pwm_model_delay_busy)
+					model->busy_ticks += delay;
+				else
+					model->entries++;
+			}
+		}
+
+		for(pin = 0; pin < pwm_list_pins; pin++)
+			if(phases->static_pins_on_mask & (1 << pin))
+				model->on_ticks[pin] += model->ticks - cycle_start;
+
+		if((model->ticks - cycle_start) < model->cycle_min)
+			model->cycle_min = model->ticks - cycle_start;
+
+		if((model->ticks - cycle_start) > model->cycle_max)
+			model->cycle_max = model->ticks - cycle_start;
+	}
+}
+
+/*
+ * The isr can only clear a pin early, a skipped 1 tick delay clears the next phase's pins
+ * together with the current ones, so every phase before a pin's phase can take one tick
+ * off its duty. The period is one tick short (the delays add up to period - 1) and shorter
+ * still when the last phase's delay is skipped.
+ */
+
+static _Bool sim_pwm_golden(void)
+{
+	enum { rounds = 2000 };
+	pwm_list_t list;
+	pwm_phases_t phases;
+	pwm_model_t model;
+	unsigned int width, period, round, pins, pin, cycle_min;
+	int error, error_max;
+	_Bool ok;
+
+	srandom(1);
+	ok = true;
+
+	printf("    width  period  shortest period  max duty error (ticks)  (%% of period)\n");
+
+	for(width = 6; width <= 18; width++)
+	{
+		period = 1 << width;
+		cycle_min = period;
+		error_max = 0;
+
+		for(round = 0; round < rounds; round++)
+		{
+			pins = 1 + (random() % pwm_max_channels);
+
+			pwm_list_clear(&list);
+			memset(list.duty, 0, sizeof(list.duty));
+
+			for(pin = 0; pin < pins; pin++)
+				pwm_list_insert(&list, pin, pwm_random_duty(&list, period), period);
+
+			pwm_phases_build(&phases, &list, period, false, false);
+			pwm_model_run(&phases, pwm_model_cycles, &model);
+
+			if((phases.amount_phases >= 2) && (model.cycle_min < cycle_min))
+				cycle_min = model.cycle_min;
+
+			if((phases.amount_phases >= 2) && ((model.cycle_max >= period) || (model.cycle_min < (period - 1 - pwm_max_channels))))
+			{
+				fprintf(stderr, "pwm golden: width %u: period %u-%u ticks\n", width, model.cycle_min, model.cycle_max);
+				ok = false;
+			}
+
+			// static pins don't depend on the isr, duty 1 is shorter than a tick
+			// (cleared right after it's set), these aren't in the tick model
+
+			for(pin = 0; pin < pins; pin++)
+			{
+				if(!(phases.active_pins_all_set_mask & (1 << pin)) || (list.duty[pin] == 1))
+					continue;
+
+				error = (int)(model.on_ticks[pin] / pwm_model_cycles) - (int)list.duty[pin];
+
+				if(error < error_max)
+					error_max = error;
+
+				if((error > 0) || (error < -pwm_max_channels))
+				{
+					fprintf(stderr, "pwm golden: width %u, pin %u, duty %u: off by %d ticks\n", width, pin, list.duty[pin], error);
+					ok = false;
+				}
+			}
+		}
+
+		printf("    %5u  %6u  %15u  %22d  %12.4f\n", width, period, cycle_min, error_max, (double)error_max * 100 / period);
+	}
+
+	printf("    jitter: none in the model apart from the skipped 1 tick delays, isr latency and wlan nmi contention aren't modelled\n");
+
+	return(ok);
+}
+
+/*
+ * Isr load against the number of pwm1 channels, isr only and spread (pwm1-spread flag,
+ * the first channel that doesn't fit goes to the sigma-delta generator). Channels get
+ * random different duties, the isr's cost is its entries (one per timer re-arm) and the
+ * busy waits for the short delays, in timer ticks (5 MHz, APB / 16). The entries per second
+ * are what stat_pwm_timer_interrupts counts on the device.
+ */
+
+static _Bool sim_pwm_load_bench(void)
+{
+	enum { rounds = 1000, channels_max = 8, tick_hz = 5000000 };
+	static const unsigned int widths[] = { 10, 16 };
+	pwm_list_t list;
+	pwm_phases_t phases;
+	pwm_model_t model;
+	unsigned int width, ix, period, channels, pin, round, spread, isr_channels, pdm_channels, dropped;
+	uint64_t entries, busy_ticks;
+	int pdm_pin;
+
+	srandom(1);
+
+	printf("    width channels mode    isr pdm dropped  isr entries/s  busy wait %%\n");
+
+	for(width = 0; width < (sizeof(widths) / sizeof(*widths)); width++)
+	{
+		period = 1 << widths[width];
+
+		for(channels = 1; channels <= channels_max; channels++)
+		{
+			for(spread = 0; spread < 2; spread++)
+			{
+				isr_channels = 0;
+				pdm_channels = 0;
+				dropped = 0;
+				entries = 0;
+				busy_ticks = 0;
+
+				for(round = 0; round < rounds; round++)
+				{
+					pwm_list_clear(&list);
+
+					for(pin = 0; pin < channels; pin++)
+					{
+						do
+						{
+							list.duty[pin] = 2 + (random() % (period - 4));
+
+							for(ix = 0; ix < pin; ix++)
+								if(list.duty[ix] == list.duty[pin])
+									break;
+						}
+						while(ix < pin);
+
+						pwm_list_insert(&list, pin, list.duty[pin], period);
+					}
+
+					pdm_pin = pwm_phases_build(&phases, &list, period, false, spread);
+					pwm_model_run(&phases, pwm_model_cycles, &model);
+
+					isr_channels += __builtin_popcount(phases.active_pins_all_set_mask);
+					pdm_channels += (pdm_pin >= 0) ? 1 : 0;
+					dropped += channels - __builtin_popcount(phases.active_pins_all_set_mask) - ((pdm_pin >= 0) ? 1 : 0);
+					entries += model.entries;
+					busy_ticks += model.busy_ticks;
+				}
+
+				printf("    %5u %8u %-6s %4.1f %3.1f %7.1f  %13.0f  %11.3f\n", widths[width], channels, spread ? "spread" : "isr",
+						(double)isr_channels / rounds, (double)pdm_channels / rounds, (double)dropped / rounds,
+						(double)entries * tick_hz / ((double)rounds * pwm_model_cycles * period),
+						(double)busy_ticks * 100 / ((double)rounds * pwm_model_cycles * period));
+			}
+		}
+	}
+
+	return(true);
+}
+
+static const host_sim_table_t host_sim_table[] =
+{
+	{ "queue",			sim_queue,			"queue push_n/pop_n across the wrap" },
+	{ "queue-bench",	sim_queue_bench,	"uart receive queue throughput, old and new queue" },
+	{ "lookup-bench",	sim_lookup_bench,	"command lookup, linear scan and hash index" },
+	{ "pwm-update",		sim_pwm_update,		"pwm1 phases updated in place equal phases built from scratch" },
+	{ "pwm-golden",		sim_pwm_golden,		"pwm1 isr model, duty accuracy and period for all widths" },
+	{ "pwm-load-bench",	sim_pwm_load_bench,	"pwm1 isr load against channels, isr only and spread" },
+	{ (const char *)0, (_Bool (*)(void))0, (const char *)0 },
+};
+
+int main(int argc, char **argv)
+{
+	const host_sim_table_t *entry;
+	int arg, failed;
+	_Bool run;
+
+	for(arg = 1; arg < argc; arg++)
+	{
+		for(entry = host_sim_table; entry->name; entry++)
+			if(!strcmp(argv[arg], entry->name))
+				break;
+
+		if(!entry->name)
+		{
+			fprintf(stderr, "usage: host-sim [name ...]\n");
+
+			for(entry = host_sim_table; entry->name; entry++)
+				fprintf(stderr, "    %-16s %s\n", entry->name, entry->description);
+
+			exit(1);
+		}
+	}
+
+	for(entry = host_sim_table, failed = 0; entry->name; entry++)
+	{
+		for(arg = 1, run = (argc < 2); arg < argc; arg++)
+			if(!strcmp(argv[arg], entry->name))
+				run = true;
+
+		if(!run)
+			continue;
+
+		printf("%s: %s\n", entry->name, entry->description);
+
+		if(entry->function())
+			printf("%s: ok\n", entry->name);
+		else
+		{
+			printf("%s: FAILED\n", entry->name);
+			failed++;
+		}
+	}
+
+	exit(failed ? 1 : 0);
+}
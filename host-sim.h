@@ -0,0 +1,27 @@
+#ifndef host_sim_h
+#define host_sim_h
+
+/*
+ * Stand-ins for the SDK, force included (-include host-sim.h) when the SDK independent
+ * modules are built for the host, see the host-sim target in the Makefile.
+ * Only modules that don't need the SDK, lwip or the 32 bit layout can be built this way.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "attribute.h"
+
+#undef iram
+#define iram
+#undef roflash
+#define roflash
+
+// util.h pulls in the SDK headers, the host-clean modules only need log from it
+
+#define util_h
+#define log(...) fprintf(stderr, __VA_ARGS__)
+
+#endif
@@ -6,19 +6,44 @@
 #include "i2c_sensor.h"
 #include "dispatch.h"
 #include "io_gpio.h"
+#include "metrics.h"
 
 typedef struct
 {
 	const char *description;
 	const char *action;
 	app_action_t (*handler)(const string_t *src, string_t *dst);
+	int (*stream)(const string_t *src, string_t *dst, int cursor);
+	_Bool html;
 } http_handler_t;
 
+/*
+ * Pages are sent using chunked transfer encoding. Handlers that can produce their output
+ * incrementally have a stream function. It renders one piece (e.g. one table row) per call
+ * and returns the cursor of the next piece or -1 when the page is complete. The first chunk
+ * only holds the header, following chunks are rendered from the "sent" callback each time
+ * the send buffer is free again, so the page size isn't limited by the send buffer.
+ */
+
+enum
+{
+	http_stream_reserve = 128,
+};
+
+typedef struct
+{
+	const http_handler_t *handler;
+	int cursor;
+} http_stream_t;
+
 static const http_handler_t handlers[];
 
+static http_stream_t http_stream = { (const http_handler_t *)0, 0 };
+string_new(static, http_stream_src, 64);
+
 roflash static const char roflash_http_header_pre[] =
 {
-	"HTTP/1.0 "
+	"HTTP/1.1 "
 };
 
 roflash static const char roflash_http_eol[] =
@@ -29,12 +54,22 @@ roflash static const char roflash_http_eol[] =
 roflash static const char roflash_http_header_ok[] =
 {
 	"200 OK\r\n"
-	"Content-Type: text/html; charset=UTF-8\r\n"
-	"Content-Length: @@@@\r\n"
+	"Content-Type: %s; charset=UTF-8\r\n"
+	"Transfer-Encoding: chunked\r\n"
 	"Connection: close\r\n"
 	"\r\n"
 };
 
+roflash static const char roflash_http_chunk_size[] =
+{
+	"0000\r\n"
+};
+
+roflash static const char roflash_http_chunk_last[] =
+{
+	"0\r\n\r\n"
+};
+
 roflash static const char roflash_http_header_error[] =
 {
 	"Content-Type: text/html; charset=UTF-8\r\n"
@@ -166,12 +201,118 @@ static app_action_t http_error(string_t *dst, const char *error_string, const ch
 	return(app_action_error);
 }
 
+// the chunk size is a placeholder until the chunk is complete
+
+static int http_chunk_start(string_t *dst)
+{
+	string_append_cstr_flash(dst, roflash_http_chunk_size);
+
+	return(string_length(dst));
+}
+
+static void http_chunk_finish(string_t *dst, int offset)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *size;
+	int length, digit;
+
+	length = string_length(dst) - offset;
+
+	// an empty chunk would terminate the body, leave it out
+
+	if(length <= 0)
+	{
+		string_setlength(dst, offset - (sizeof(roflash_http_chunk_size) - 1));
+		return;
+	}
+
+	size = string_buffer_nonconst(dst) + offset - (sizeof(roflash_http_chunk_size) - 1);
+
+	for(digit = 0; digit < 4; digit++)
+		size[digit] = hex[(length >> (12 - (digit * 4))) & 0x0f];
+
+	string_append_cstr_flash(dst, roflash_http_eol);
+}
+
+// handlers render into the tail of the buffer, keeping room for the chunk framing and the page footer
+
+static void http_tail(string_t *dst, string_t *tail)
+{
+	int size;
+
+	if((size = string_size(dst) - string_length(dst) - http_stream_reserve) < 0)
+		size = 0;
+
+	string_set(tail, string_buffer_nonconst(dst) + string_length(dst), size, 0);
+}
+
+static _Bool http_tail_full(const string_t *tail)
+{
+	return(string_length(tail) >= (string_size(tail) - 1));
+}
+
+_Bool http_stream_active(void)
+{
+	return(!!http_stream.handler);
+}
+
+void http_stream_abort(void)
+{
+	http_stream.handler = (const http_handler_t *)0;
+}
+
+void http_stream_fill(string_t *dst)
+{
+	const http_handler_t *handler;
+	string_t tail;
+	int offset, cursor, pieces;
+
+	if(!(handler = http_stream.handler))
+		return;
+
+	offset = http_chunk_start(dst);
+
+	for(pieces = 0; http_stream.handler; pieces++)
+	{
+		http_tail(dst, &tail);
+
+		if(string_size(&tail) <= 1)
+			break;
+
+		cursor = http_stream.handler->stream(&http_stream_src, &tail, http_stream.cursor);
+
+		// a piece that doesn't fit is rendered again in the next chunk, unless it will never fit
+
+		if(http_tail_full(&tail) && (pieces > 0))
+			break;
+
+		string_setlength(dst, string_length(dst) + string_length(&tail));
+
+		if(cursor < 0)
+			http_stream.handler = (const http_handler_t *)0;
+		else
+			http_stream.cursor = cursor;
+	}
+
+	if(!http_stream.handler && handler->html)
+	{
+		string_append_cstr_flash(dst, roflash_html_link_home);
+		string_append_cstr_flash(dst, roflash_html_footer);
+	}
+
+	http_chunk_finish(dst, offset);
+
+	if(!http_stream.handler)
+		string_append_cstr_flash(dst, roflash_http_chunk_last);
+}
+
 app_action_t application_function_http_get(string_t *src, string_t *dst)
 {
 	string_new(, url, 64);
 	string_new(, afterslash, 64);
 	string_new(, action, 64);
-	int ix, length;
+	string_t tail;
+	int offset;
 	const http_handler_t *handler;
 	app_action_t error;
 
@@ -190,69 +331,97 @@ app_action_t application_function_http_get(string_t *src, string_t *dst)
 		string_append_string(&action, &afterslash);
 	}
 
-	for(handler = &handlers[0]; handler->action && handler->handler; handler++)
+	for(handler = &handlers[0]; handler->action; handler++)
 		if(string_match_cstr(&action, handler->action))
 			break;
 
-	if(!handler->action || !handler->handler)
+	if(!handler->action)
 		return(http_error(dst, "404 Not Found", string_to_cstr(&action)));
 
 	string_clear(dst);
 	string_append_cstr_flash(dst, roflash_http_header_pre);
-	string_append_cstr_flash(dst, roflash_http_header_ok);
-	string_append_cstr_flash(dst, roflash_html_header);
+	string_format_flash_ptr(dst, roflash_http_header_ok, handler->html ? "text/html" : "text/plain; version=0.0.4");
+	offset = http_chunk_start(dst);
 
-	error = handler->handler(&afterslash, dst);
+	if(handler->html)
+		string_append_cstr_flash(dst, roflash_html_header);
 
-	string_append_cstr_flash(dst, roflash_html_link_home);
-	string_append_cstr_flash(dst, roflash_html_footer);
+	// send the header right away, the body follows from the "sent" callback
 
-	if((length = string_length(dst) - (sizeof(roflash_http_header_pre) - 1) - (sizeof(roflash_http_header_ok) - 1)) <= 0)
-		return(http_error(dst, "500 Internal Server Error", 0));
+	if(handler->stream)
+	{
+		http_stream.handler = handler;
+		http_stream.cursor = 0;
+		string_clear(&http_stream_src);
+		string_append_string(&http_stream_src, &afterslash);
+
+		http_chunk_finish(dst, offset);
+
+		return(app_action_http_ok);
+	}
 
-	if((ix = string_find(dst, 0, '@')) <= 0)
-		return(http_error(dst, "501 Not Implemented", 0));
+	http_tail(dst, &tail);
+	error = handler->handler(&afterslash, &tail);
+	string_setlength(dst, string_length(dst) + string_length(&tail));
+
+	if(handler->html)
+	{
+		string_append_cstr_flash(dst, roflash_html_link_home);
+		string_append_cstr_flash(dst, roflash_html_footer);
+	}
 
-	string_replace(dst, ix + 0, (length / 1000) + '0');
-	length %= 1000;
-	string_replace(dst, ix + 1, (length / 100) + '0');
-	length %= 100;
-	string_replace(dst, ix + 2, (length / 10) + '0');
-	length %= 10;
-	string_replace(dst, ix + 3, (length / 1) + '0');
+	http_chunk_finish(dst, offset);
+	string_append_cstr_flash(dst, roflash_http_chunk_last);
 
 	return(error);
 }
 
-static app_action_t handler_root(const string_t *src, string_t *dst)
+// cursor 0 is the table header, cursor n is handler n - 1
+
+static int stream_root(const string_t *src, string_t *dst, int cursor)
 {
 	const http_handler_t *handler;
 
-	string_append_cstr_flash(dst, roflash_html_table_start);
-	string_append(dst, "<tr><th colspan=\"2\">ESP8266 Universal I/O bridge</th></tr>\n");
+	if(cursor == 0)
+	{
+		string_append_cstr_flash(dst, roflash_html_table_start);
+		string_append(dst, "<tr><th colspan=\"2\">ESP8266 Universal I/O bridge</th></tr>\n");
+		return(1);
+	}
 
-	for(handler = &handlers[0]; handler->action && handler->handler; handler++)
-		if(handler->description)
-			string_format(dst, "<tr><td>%s</td><td><a href=\"/%s\">/%s</a></td></tr>\n", handler->description, handler->action, handler->action);
+	handler = &handlers[cursor - 1];
 
-	string_append_cstr_flash(dst, roflash_html_table_end);
+	if(!handler->action)
+	{
+		string_append_cstr_flash(dst, roflash_html_table_end);
+		return(-1);
+	}
 
-	return(app_action_http_ok);
+	if(handler->description)
+		string_format(dst, "<tr><td>%s</td><td><a href=\"/%s\">/%s</a></td></tr>\n", handler->description, handler->action, handler->action);
+
+	return(cursor + 1);
 }
 
-static app_action_t handler_controls(const string_t *src, string_t *dst)
+// cursor is io * max_pins_per_io + pin
+
+static int stream_controls(const string_t *src, string_t *dst, int cursor)
 {
 	int				io, pin;
 	int				low, high, step, current;
 	io_pin_mode_t	mode;
 
-	for(io = 0; io < io_id_size; io++)
-		for(pin = 0; pin < max_pins_per_io; pin++)
-			if(io_traits(0, io, pin, &mode, &low, &high, &step, &current) == io_ok)
-				if(high > 0)
-					http_range_form(dst, io, pin, low, high, step, current);
+	if(cursor >= (io_id_size * max_pins_per_io))
+		return(-1);
 
-	return(app_action_http_ok);
+	io = cursor / max_pins_per_io;
+	pin = cursor % max_pins_per_io;
+
+	if(io_traits(0, io, pin, &mode, &low, &high, &step, &current) == io_ok)
+		if(high > 0)
+			http_range_form(dst, io, pin, low, high, step, current);
+
+	return(cursor + 1);
 }
 
 static app_action_t handler_set(const string_t *src, string_t *dst)
@@ -376,38 +545,65 @@ static app_action_t handler_info_wlan(const string_t *src, string_t *dst)
 	return(app_action_http_ok);
 }
 
-static app_action_t handler_io(const string_t *src, string_t *dst)
+// one table per io
+
+static int stream_io(const string_t *src, string_t *dst, int cursor)
 {
-	io_config_dump(dst, -1, -1, true);
+	if(cursor >= io_id_size)
+		return(-1);
 
-	return(app_action_http_ok);
+	io_config_dump(dst, cursor, -1, true);
+
+	return(cursor + 1);
 }
 
-static app_action_t handler_sensors(const string_t *src, string_t *dst)
+// cursor 0 is the table header, cursor n is sensor n - 1 over all busses
+
+static int stream_sensors(const string_t *src, string_t *dst, int cursor)
 {
 	i2c_sensor_t sensor;
 	int bus;
 	int detected = 0;
 
-	string_append_cstr_flash(dst, roflash_html_table_start);
-	string_append(dst, "<tr><th>bus</th><th>sensor</th><th>address</th><th>name</th><th>type</th><th>value</th></tr>\n");
+	if(cursor == 0)
+	{
+		string_append_cstr_flash(dst, roflash_html_table_start);
+		string_append(dst, "<tr><th>bus</th><th>sensor</th><th>address</th><th>name</th><th>type</th><th>value</th></tr>\n");
+		return(1);
+	}
+
+	if(cursor > (i2c_busses * i2c_sensor_size))
+	{
+		for(bus = 0; bus < i2c_busses; bus++)
+			for(sensor = 0; sensor < i2c_sensor_size; sensor++)
+				if(i2c_sensor_registered(bus, sensor))
+					detected++;
 
-	for(bus = 0; bus < i2c_busses; bus++)
-		for(sensor = 0; sensor < i2c_sensor_size; sensor++)
-			if(i2c_sensor_registered(bus, sensor))
-			{
-				string_append(dst, "<tr><td>");
-				i2c_sensor_read(dst, bus, sensor, false, true);
-				string_append(dst, "</td></tr>\n");
-				detected++;
-			}
+		if(detected < 1)
+			string_append(dst, "<tr><td colspan=\"6\">no sensors detected</td></tr>\n");
 
-	if(detected < 1)
-		string_append(dst, "<tr><td colspan=\"6\">no sensors detected</td></tr>\n");
+		string_append_cstr_flash(dst, roflash_html_table_end);
+		return(-1);
+	}
 
-	string_append_cstr_flash(dst, roflash_html_table_end);
+	bus = (cursor - 1) / i2c_sensor_size;
+	sensor = (cursor - 1) % i2c_sensor_size;
 
-	return(app_action_http_ok);
+	if(i2c_sensor_registered(bus, sensor))
+	{
+		string_append(dst, "<tr><td>");
+		i2c_sensor_read(dst, bus, sensor, false, true);
+		string_append(dst, "</td></tr>\n");
+	}
+
+	return(cursor + 1);
+}
+
+// rendered from the metrics snapshot, doesn't access any bus
+
+static int stream_metrics(const string_t *src, string_t *dst, int cursor)
+{
+	return(metrics_render(dst, cursor));
 }
 
 static app_action_t handler_resetwlanscreen(const string_t *src, string_t *dst)
@@ -498,76 +694,113 @@ static const http_handler_t handlers[] =
 	{
 		"Home",
 		"",
-		handler_root
+		(app_action_t (*)(const string_t *, string_t *))0,
+		stream_root,
+		true
 	},
 	{
 		"Information about the firmware",
 		"info_fw",
-		handler_info_fw
+		handler_info_fw,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Information about the i2c bus",
 		"info_i2c",
-		handler_info_i2c
+		handler_info_i2c,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Information about time keeping",
 		"info_time",
-		handler_info_time
+		handler_info_time,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Information about WLAN",
 		"info_wlan",
-		handler_info_wlan
+		handler_info_wlan,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Statistics",
 		"info_stats",
-		handler_info_stats
+		handler_info_stats,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"List all I/O's",
 		"io",
-		handler_io
+		(app_action_t (*)(const string_t *, string_t *))0,
+		stream_io,
+		true
 	},
 	{
 		"Control outputs",
 		"controls",
-		handler_controls
+		(app_action_t (*)(const string_t *, string_t *))0,
+		stream_controls,
+		true
 	},
 	{
 		"List all sensors",
 		"sensors",
-		handler_sensors,
+		(app_action_t (*)(const string_t *, string_t *))0,
+		stream_sensors,
+		true
+	},
+	{
+		"Metrics (Prometheus text format)",
+		"metrics",
+		(app_action_t (*)(const string_t *, string_t *))0,
+		stream_metrics,
+		false
 	},
 	{
 		"Set an I/O",
 		"set",
-		handler_set
+		handler_set,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Reset WLAN configuration",
 		"resetwlanscreen",
 		handler_resetwlanscreen,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		(const char *)0,
 		"resetwlan",
-		handler_resetwlan
+		handler_resetwlan,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		"Reset",
 		"reset",
-		handler_reset
+		handler_reset,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		(const char *)0,
 		"favicon.ico",
-		handler_favicon
+		handler_favicon,
+		(int (*)(const string_t *, string_t *, int))0,
+		true
 	},
 	{
 		(const char *)0,
 		(const char *)0,
-		(app_action_t (*)(const string_t *, string_t *))0
+		(app_action_t (*)(const string_t *, string_t *))0,
+		(int (*)(const string_t *, string_t *, int))0,
+		false
 	}
 };
@@ -5,5 +5,8 @@
 #include "application.h"
 
 app_action_t application_function_http_get(string_t *src, string_t *dst);
+_Bool http_stream_active(void);
+void http_stream_fill(string_t *dst);
+void http_stream_abort(void);
 
 #endif
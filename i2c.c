@@ -7,6 +7,8 @@
 #include "io_gpio.h"
 #include "attribute.h"
 #include "stats.h"
+#include "time.h"
+#include "dispatch.h"
 
 typedef enum
 {
@@ -570,6 +572,35 @@ iram i2c_error_t i2c_send_receive(int address, int sendlength, const uint8_t *se
 	return(i2c_receive(address, receivelength, receivebytes));
 }
 
+// check if a device answers to its address, a NAK is not a bus error so don't reset the bus
+
+iram i2c_error_t i2c_probe(int address)
+{
+	i2c_error_t error;
+
+	if((error = i2c_send_sequence(address, 0, (const uint8_t *)0)) == i2c_error_address_nak)
+	{
+		state = i2c_state_idle;
+
+		if(send_stop() == i2c_error_ok)
+			return(error);
+	}
+
+	if(error != i2c_error_ok)
+	{
+		i2c_reset();
+		return(error);
+	}
+
+	if((error = send_stop()) != i2c_error_ok)
+	{
+		i2c_reset();
+		return(error);
+	}
+
+	return(i2c_error_ok);
+}
+
 i2c_error_t i2c_send1(int address, int byte0)
 {
 	uint8_t bytes[1] = { byte0 };
@@ -694,6 +725,110 @@ iram i2c_error_t i2c_reset(void)
 	return(i2c_error_ok);
 }
 
+/*
+ * Queued transfers. The hardware timer is taken by pwm, so queued transfers are run
+ * from the timer task instead of an interrupt, one transfer per event, so other tasks can
+ * run in between. The submitter doesn't wait, the done callback is called from the
+ * command task. The descriptor is copied, the callback gets the copy with the error
+ * and the received data. The task queues are short, if an event can't be posted, the
+ * slow timer posts it again.
+ */
+
+static i2c_transfer_t transfer_queue[i2c_transfer_queue_size];
+static unsigned int transfer_in = 0;
+static unsigned int transfer_run = 0;
+static unsigned int transfer_out = 0;
+static _Bool transfer_run_posted = false;
+static _Bool transfer_complete_posted = false;
+
+_Bool i2c_transfer_queue(const i2c_transfer_t *transfer)
+{
+	if(((transfer_in - transfer_out) >= i2c_transfer_queue_size) ||
+			(transfer->send_length > i2c_transfer_data_size) || (transfer->receive_length > i2c_transfer_data_size))
+	{
+		stat_i2c_transfer_overflows++;
+		return(false);
+	}
+
+	transfer_queue[transfer_in % i2c_transfer_queue_size] = *transfer;
+	transfer_in++;
+
+	if(!transfer_run_posted)
+		transfer_run_posted = dispatch_post_timer(timer_task_i2c_transfer_run);
+
+	return(true);
+}
+
+void i2c_transfer_run(void)
+{
+	i2c_transfer_t *transfer;
+	i2c_error_t error;
+	uint64_t start;
+
+	transfer_run_posted = false;
+
+	if(transfer_run == transfer_in)
+		return;
+
+	transfer = &transfer_queue[transfer_run % i2c_transfer_queue_size];
+	start = time_get_us();
+
+	if((error = i2c_select_bus(transfer->bus)) == i2c_error_ok)
+	{
+		if(transfer->send_length && transfer->receive_length)
+			error = i2c_send_receive(transfer->address, transfer->send_length, transfer->send_data, transfer->receive_length, transfer->receive_data);
+		else
+			if(transfer->receive_length)
+				error = i2c_receive(transfer->address, transfer->receive_length, transfer->receive_data);
+			else
+				error = i2c_send(transfer->address, transfer->send_length, transfer->send_data);
+	}
+
+	if(transfer->bus != 0)
+		i2c_select_bus(0);
+
+	transfer->error = error;
+	transfer_run++;
+
+	stat_i2c_transfers++;
+	stat_i2c_transfer_busy_us += time_get_us() - start;
+
+	if(error == i2c_error_ok)
+		stat_i2c_transfer_bytes += 1 + transfer->send_length + (transfer->receive_length ? 1 + transfer->receive_length : 0);
+	else
+		stat_i2c_transfer_errors++;
+
+	if((transfer_run != transfer_in) && !transfer_run_posted)
+		transfer_run_posted = dispatch_post_timer(timer_task_i2c_transfer_run);
+
+	if(!transfer_complete_posted)
+		transfer_complete_posted = dispatch_post_command(command_task_i2c_transfer_complete);
+}
+
+void i2c_transfer_complete(void)
+{
+	const i2c_transfer_t *transfer;
+
+	transfer_complete_posted = false;
+
+	for(; transfer_out != transfer_run; transfer_out++)
+	{
+		transfer = &transfer_queue[transfer_out % i2c_transfer_queue_size];
+
+		if(transfer->done_fn)
+			transfer->done_fn(transfer);
+	}
+}
+
+void i2c_transfer_poll(void)
+{
+	if((transfer_run != transfer_in) && !transfer_run_posted)
+		transfer_run_posted = dispatch_post_timer(timer_task_i2c_transfer_run);
+
+	if((transfer_out != transfer_run) && !transfer_complete_posted)
+		transfer_complete_posted = dispatch_post_command(command_task_i2c_transfer_complete);
+}
+
 void i2c_init(int sda_in, int scl_in, unsigned int speed_delay)
 {
 	uint8_t byte;
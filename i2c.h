@@ -72,6 +72,25 @@ typedef struct attr_packed
 
 assert_size(i2c_info_t, 1);
 
+enum
+{
+	i2c_transfer_queue_size = 8,
+	i2c_transfer_data_size = 8,
+};
+
+typedef struct i2c_transfer_T
+{
+	uint8_t			bus;
+	uint8_t			address;
+	uint8_t			send_length;
+	uint8_t			receive_length;
+	uint8_t			send_data[i2c_transfer_data_size];
+	uint8_t			receive_data[i2c_transfer_data_size];
+	i2c_error_t		error;
+	void			(*done_fn)(const struct i2c_transfer_T *);
+	void			*context;
+} i2c_transfer_t;
+
 void		i2c_init(int sda_index, int scl_index, unsigned int delay);
 void		i2c_error_format_string(string_t *dst, i2c_error_t error);
 i2c_error_t	i2c_select_bus(unsigned int bus);
@@ -80,6 +99,7 @@ void		i2c_get_info(i2c_info_t *);
 i2c_error_t	i2c_send(int address, int length, const uint8_t *bytes);
 i2c_error_t	i2c_receive(int address, int length, uint8_t *bytes);
 i2c_error_t	i2c_send_receive(int address, int sendlength, const uint8_t *sendbytes, int receivelength, uint8_t *receivebytes);
+i2c_error_t	i2c_probe(int address);
 
 i2c_error_t	i2c_send1(int address, int byte0);
 i2c_error_t	i2c_send2(int address, int byte0, int byte1);
@@ -90,4 +110,9 @@ i2c_error_t	i2c_send1_receive(int address, int byte0, int receivelength, uint8_t
 
 i2c_error_t i2c_reset(void);
 
+_Bool		i2c_transfer_queue(const i2c_transfer_t *);
+void		i2c_transfer_run(void);
+void		i2c_transfer_complete(void);
+void		i2c_transfer_poll(void);
+
 #endif
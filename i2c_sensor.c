@@ -7,20 +7,151 @@
 
 static i2c_sensor_device_data_t device_data[i2c_sensor_size];
 
+/*
+ * Sensors with a long conversion time have a step function, so the conversion can run
+ * in the background without waiting. Step 0 starts the conversion, every step sets the
+ * time to wait (ms) before the next step is due, 0 when the value is complete.
+ * The read function of these sensors runs all steps at once.
+ */
+
+typedef i2c_error_t (*sensor_step_fn_t)(int bus, const i2c_sensor_device_table_entry_t *, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *, i2c_sensor_device_data_t *);
+
+enum
+{
+	sensor_steps_max = 32,
+	sensor_samples_per_call = 4,
+};
+
+static i2c_error_t sensor_read_steps(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data, sensor_step_fn_t step_fn)
+{
+	i2c_error_t error;
+	unsigned int step, delay_ms;
+
+	for(step = 0; step < sensor_steps_max; step++)
+	{
+		if((error = step_fn(bus, entry, step, &delay_ms, value, data)) != i2c_error_ok)
+			return(error);
+
+		if(delay_ms == 0)
+			return(i2c_error_ok);
+
+		msleep(delay_ms);
+	}
+
+	return(i2c_error_device_error_5);
+}
+
+// the conversion running in the background, only one at a time
+
+static struct
+{
+	sensor_step_fn_t	step_fn;
+	i2c_sensor_value_t	value;
+	uint32_t			busy_us;
+	uint32_t			due_ms;
+	unsigned int		step;
+	uint8_t				bus;
+	i2c_sensor_t		sensor;
+	unsigned int		active:1;
+} conversion =
+{
+	.active = 0,
+};
+
+static i2c_sensor_info_t sensor_info =
+{
+	.init_started = 0,
+	.init_finished = 0,
+};
+
+/*
+ * Each registered sensor has a cache entry. The sensors are sampled in the background,
+ * each at its own interval (config "i2s.<bus>.<sensor>.interval", in ms), reads are served
+ * from the cache. An entry is stale when it missed two samples, then it's read directly.
+ */
+
+static i2c_sensor_cache_t sensor_cache[i2c_sensor_cache_size];
+static unsigned int sensor_cache_entries = 0;
+
+attr_inline uint32_t cache_now_ms(void)
+{
+	return((uint32_t)(time_get_us() / 1000));
+}
+
+static i2c_sensor_cache_t *cache_find(int bus, i2c_sensor_t sensor)
+{
+	unsigned int slot;
+
+	for(slot = 0; slot < sensor_cache_entries; slot++)
+		if((sensor_cache[slot].bus == bus) && (sensor_cache[slot].sensor == sensor))
+			return(&sensor_cache[slot]);
+
+	return((i2c_sensor_cache_t *)0);
+}
+
+static uint32_t cache_interval(int bus, i2c_sensor_t sensor)
+{
+	int interval;
+	string_init(varname_i2s_interval, "i2s.%u.%u.interval");
+
+	if(!config_get_int(&varname_i2s_interval, bus, sensor, &interval))
+		interval = i2c_sensor_cache_interval_default_ms;
+
+	if(interval < i2c_sensor_cache_interval_min_ms)
+		interval = i2c_sensor_cache_interval_min_ms;
+
+	return(interval);
+}
+
+attr_pure static _Bool cache_stale(const i2c_sensor_cache_t *cache, uint32_t now)
+{
+	return(!cache->valid || ((now - cache->sampled_ms) > (2 * cache->interval_ms)));
+}
+
 static void sensor_register(int bus, i2c_sensor_t sensor_id)
 {
+	i2c_sensor_cache_t *cache;
+
 	if(sensor_id >= i2c_sensor_size)
 		return;
 
 	device_data[sensor_id].registered |= (1 << bus);
+
+	if(cache_find(bus, sensor_id))
+		return;
+
+	if(sensor_cache_entries >= i2c_sensor_cache_size)
+	{
+		sensor_info.cache_overflows++;
+		return;
+	}
+
+	cache = &sensor_cache[sensor_cache_entries++];
+	cache->bus = bus;
+	cache->sensor = sensor_id;
+	cache->interval_ms = cache_interval(bus, sensor_id);
+	cache->due_ms = cache_now_ms();
+	cache->sampled_ms = 0;
+	cache->latency_last_us = 0;
+	cache->latency_max_us = 0;
+	cache->valid = 0;
+	cache->error = 0;
 }
 
 static void sensor_deregister(int bus, i2c_sensor_t sensor_id)
 {
+	i2c_sensor_cache_t *cache;
+
 	if(sensor_id >= i2c_sensor_size)
 		return;
 
 	device_data[sensor_id].registered &= ~(1 << bus);
+
+	if(conversion.active && (conversion.bus == bus) && (conversion.sensor == sensor_id))
+		conversion.active = 0;
+
+	if((cache = cache_find(bus, sensor_id)))
+		*cache = sensor_cache[--sensor_cache_entries];
 }
 
 attr_pure _Bool i2c_sensor_registered(int bus, i2c_sensor_t sensor)
@@ -1622,32 +1753,34 @@ static i2c_error_t sensor_tsl2550_init(int bus, const i2c_sensor_device_table_en
 	return(i2c_error_ok);
 }
 
-static i2c_error_t sensor_tsl2550_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+// every step is an attempt to read both channels, retry until both are valid
+
+static i2c_error_t sensor_tsl2550_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
+	enum { attempts = 16, delay_attempt = 10 };
 	i2c_error_t	error;
 	uint8_t		ch0, ch1;
-	int			attempt, ratio;
+	int			ratio;
 
-	error = i2c_error_ok;
-
-	for(attempt = 16; attempt > 0; attempt--)
-	{
-		// read from channel 0
+	ch0 = ch1 = 0;
 
-		if((error = sensor_tsl2550_rw(entry->address, 0x43, &ch0)) != i2c_error_ok)
-			goto error;
+	// read from channel 0
 
+	if((error = sensor_tsl2550_rw(entry->address, 0x43, &ch0)) == i2c_error_ok)
+	{
 		// read from channel 1
 
-		if((error = sensor_tsl2550_rw(entry->address, 0x83, &ch1)) != i2c_error_ok)
-			goto error;
+		error = sensor_tsl2550_rw(entry->address, 0x83, &ch1);
+	}
 
-		if((ch0 & 0x80) && (ch1 & 0x80))
-			break;
-error:
-		msleep(10);
+	if(((error != i2c_error_ok) || !(ch0 & 0x80) || !(ch1 & 0x80)) && ((step + 1) < attempts))
+	{
+		*delay_ms = delay_attempt;
+		return(i2c_error_ok);
 	}
 
+	*delay_ms = 0;
+
 	if(error != i2c_error_ok)
 		return(error);
 
@@ -1675,6 +1808,11 @@ error:
 	return(i2c_error_ok);
 }
 
+static i2c_error_t sensor_tsl2550_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_read_steps(bus, entry, value, data, sensor_tsl2550_step));
+}
+
 typedef enum
 {
 	bh1750_opcode_powerdown =		0b00000000,	// 0x00
@@ -2855,14 +2993,38 @@ enum
 	hdc1080_max_attempts = 16
 };
 
-static i2c_error_t sensor_hdc1080_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, hdc1080_action_t action, i2c_sensor_device_data_t *data)
+// step 0 starts the conversion, following steps poll for the result
+
+static i2c_error_t sensor_hdc1080_step(const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, hdc1080_action_t action)
 {
+	enum { delay_attempt = 2 };
 	i2c_error_t error;
-	int attempt;
 	uint32_t conf;
 	uint8_t i2c_buffer[3];
 	uint8_t reg;
 
+	if(step > 0)
+	{
+		if(i2c_receive(entry->address, 2, i2c_buffer) != i2c_error_ok)
+		{
+			if(step >= hdc1080_max_attempts)
+				return(i2c_error_device_error_1);
+
+			*delay_ms = delay_attempt;
+			return(i2c_error_ok);
+		}
+
+		value->raw = (i2c_buffer[0] << 8) + i2c_buffer[1];
+
+		if(action == hdc1080_action_temperature)
+			value->cooked = ((value->raw * 165) / (1 << 16)) - 40;
+		else
+			value->cooked = ((value->raw * 100) / (1 << 16));
+
+		*delay_ms = 0;
+		return(i2c_error_ok);
+	}
+
 	value->cooked = value->raw = -1;
 
 	conf = hdc1080_conf_tres_14 | hdc1080_conf_hres_14 | hdc1080_conf_mode_one;
@@ -2882,25 +3044,19 @@ static i2c_error_t sensor_hdc1080_read(int bus, const i2c_sensor_device_table_en
 	if((error = i2c_send1(entry->address, reg)) != i2c_error_ok)
 		return(error);
 
-	for(attempt = hdc1080_max_attempts; attempt > 0; attempt--)
-	{
-		if(i2c_receive(entry->address, 2, i2c_buffer) == i2c_error_ok)
-			break;
+	*delay_ms = delay_attempt;
 
-		msleep(2);
-	}
-
-	if(attempt <= 0)
-		return(i2c_error_device_error_1);
-
-	value->raw = (i2c_buffer[0] << 8) + i2c_buffer[1];
+	return(i2c_error_ok);
+}
 
-	if(action == hdc1080_action_temperature)
-		value->cooked = ((value->raw * 165) / (1 << 16)) - 40;
-	else
-		value->cooked = ((value->raw * 100) / (1 << 16));
+static i2c_error_t sensor_hdc1080_temperature_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_hdc1080_step(entry, step, delay_ms, value, hdc1080_action_temperature));
+}
 
-	return(i2c_error_ok);
+static i2c_error_t sensor_hdc1080_humidity_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_hdc1080_step(entry, step, delay_ms, value, hdc1080_action_humidity));
 }
 
 static i2c_error_t sensor_hdc1080_humidity_init(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_device_data_t *data)
@@ -2934,12 +3090,12 @@ static i2c_error_t sensor_hdc1080_humidity_init(int bus, const i2c_sensor_device
 
 static i2c_error_t sensor_hdc1080_temperature_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_hdc1080_read(bus, entry, value, hdc1080_action_temperature, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_hdc1080_temperature_step));
 }
 
 static i2c_error_t sensor_hdc1080_humidity_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_hdc1080_read(bus, entry, value, hdc1080_action_humidity, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_hdc1080_humidity_step));
 }
 
 enum
@@ -3029,16 +3185,22 @@ static i2c_error_t sensor_htu21_humidity_init(int bus, const i2c_sensor_device_t
 	return(i2c_error_ok);
 }
 
-static i2c_error_t sensor_htu21_read(const i2c_sensor_device_table_entry_t *entry, uint8_t command, uint16_t *result, i2c_sensor_device_data_t *data)
+static i2c_error_t sensor_htu21_step(const i2c_sensor_device_table_entry_t *entry, uint8_t command, unsigned int step, unsigned int *delay_ms, uint16_t *result)
 {
 	i2c_error_t error;
 	uint8_t	i2cbuffer[4];
 	uint8_t crc1, crc2;
 
-	if((error = i2c_send1(entry->address, command)) != i2c_error_ok)
-		return(error);
+	if(step == 0)
+	{
+		if((error = i2c_send1(entry->address, command)) != i2c_error_ok)
+			return(error);
+
+		*delay_ms = htu21_delay_measurement;
+		return(i2c_error_ok);
+	}
 
-	msleep(htu21_delay_measurement);
+	*delay_ms = 0;
 
 	if((error = i2c_receive(entry->address, sizeof(i2cbuffer), i2cbuffer)) != i2c_error_ok)
 		return(error);
@@ -3055,32 +3217,53 @@ static i2c_error_t sensor_htu21_read(const i2c_sensor_device_table_entry_t *entr
 	return(i2c_error_ok);
 }
 
-static i2c_error_t sensor_htu21_temperature_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+static i2c_error_t sensor_htu21_temperature_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
 	i2c_error_t error;
 	uint16_t result;
 
-	if((error = sensor_htu21_read(entry, htu21_cmd_meas_temp_no_hold_master, &result, data)) != i2c_error_ok)
+	if((error = sensor_htu21_step(entry, htu21_cmd_meas_temp_no_hold_master, step, delay_ms, &result)) != i2c_error_ok)
 		return(error);
 
-	value->raw = result;
-	value->cooked = ((value->raw * 175.72) / 65536) - 46.85;
+	if(*delay_ms == 0)
+	{
+		value->raw = result;
+		value->cooked = ((value->raw * 175.72) / 65536) - 46.85;
+	}
 
 	return(i2c_error_ok);
 }
 
-static i2c_error_t sensor_htu21_humidity_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+static i2c_error_t sensor_htu21_temperature_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
+	return(sensor_read_steps(bus, entry, value, data, sensor_htu21_temperature_step));
+}
+
+// steps 0 and 1 measure the temperature for compensation, steps 2 and 3 measure the humidity
+
+static i2c_error_t sensor_htu21_humidity_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	static i2c_sensor_value_t temperature;
 	i2c_error_t error;
 	uint16_t result;
-	i2c_sensor_value_t temperature;
 
-	if((error = sensor_htu21_temperature_read(bus, entry, &temperature, data)) != i2c_error_ok)
-		return(error);
+	if(step < 2)
+	{
+		if((error = sensor_htu21_temperature_step(bus, entry, step, delay_ms, &temperature, data)) != i2c_error_ok)
+			return(error);
+
+		if(*delay_ms == 0)
+			*delay_ms = 1;
+
+		return(i2c_error_ok);
+	}
 
-	if((error = sensor_htu21_read(entry, htu21_cmd_meas_hum_no_hold_master, &result, data)) != i2c_error_ok)
+	if((error = sensor_htu21_step(entry, htu21_cmd_meas_hum_no_hold_master, step - 2, delay_ms, &result)) != i2c_error_ok)
 		return(error);
 
+	if(*delay_ms > 0)
+		return(i2c_error_ok);
+
 	value->raw = ((result * 125.0) / 65536) - 6;
 	value->cooked = value->raw + ((25 - temperature.cooked) * -0.10); // FIXME, TempCoeff guessed
 
@@ -3093,6 +3276,11 @@ static i2c_error_t sensor_htu21_humidity_read(int bus, const i2c_sensor_device_t
 	return(i2c_error_ok);
 }
 
+static i2c_error_t sensor_htu21_humidity_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_read_steps(bus, entry, value, data, sensor_htu21_humidity_step));
+}
+
 static i2c_error_t sensor_bme680_airquality_init(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_device_data_t *data)
 {
 	i2c_error_t error;
@@ -3431,50 +3619,73 @@ static i2c_error_t bmp085_read_reg_3(int address, int reg, uint32_t *value)
 	return(0);
 }
 
-static i2c_error_t bmp085_read(int address, i2c_sensor_value_t *rv_airpressure, i2c_sensor_value_t *rv_temperature, i2c_sensor_device_data_t *data)
+/*
+ * step 0 starts the temperature conversion
+ * step 1 fetches the temperature and starts the air pressure conversion, unless only the temperature is requested
+ * step 2 fetches the air pressure
+ */
+
+static i2c_error_t bmp085_step(int address, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *rv_airpressure, i2c_sensor_value_t *rv_temperature)
 {
+	static int32_t b5;
 	uint16_t	ut;
 	uint32_t	up = 0;
 	int32_t		p;
 	int32_t		x1, x2, x3;
 	uint32_t	b4, b7;
-	int32_t		b3, b5, b6;
+	int32_t		b3, b6;
 	uint8_t		oss = 3;
 	i2c_error_t	error;
 
-	/* set cmd = 0x2e = start temperature measurement */
+	if(step == 0)
+	{
+		/* set cmd = 0x2e = start temperature measurement */
 
-	if((error = bmp085_write_reg_1(address, 0xf4, 0x2e)) != i2c_error_ok)
-		return(error);
+		if((error = bmp085_write_reg_1(address, 0xf4, 0x2e)) != i2c_error_ok)
+			return(error);
 
-	msleep(5);
+		*delay_ms = 5;
+		return(i2c_error_ok);
+	}
 
-	/* fetch result from 0xf6,0xf7 */
+	if(step == 1)
+	{
+		/* fetch result from 0xf6,0xf7 */
 
-	if((error = bmp085_read_reg_2(address, 0xf6, &ut)) != i2c_error_ok)
-		return(error);
+		if((error = bmp085_read_reg_2(address, 0xf6, &ut)) != i2c_error_ok)
+			return(error);
 
-	x1 = ((ut - bmp085.ac6) * bmp085.ac5) / (1 << 15);
+		x1 = ((ut - bmp085.ac6) * bmp085.ac5) / (1 << 15);
 
-	if((x1 + bmp085.md) == 0)
-		return(i2c_error_device_error_1);
+		if((x1 + bmp085.md) == 0)
+			return(i2c_error_device_error_1);
 
-	x2 = (bmp085.mc * (1 << 11)) / (x1 + bmp085.md);
+		x2 = (bmp085.mc * (1 << 11)) / (x1 + bmp085.md);
 
-	b5 = x1 + x2;
+		b5 = x1 + x2;
 
-	if(rv_temperature)
-	{
-		rv_temperature->raw		= ut;
-		rv_temperature->cooked	= ((b5 + 8.0) / 16) / 10;
-	}
+		if(rv_temperature)
+		{
+			rv_temperature->raw		= ut;
+			rv_temperature->cooked	= ((b5 + 8.0) / 16) / 10;
+		}
 
-	/* set cmd = 0x34 = start air pressure measurement */
+		if(rv_temperature && !rv_airpressure)
+		{
+			*delay_ms = 0;
+			return(i2c_error_ok);
+		}
 
-	if((error = bmp085_write_reg_1(address, 0xf4, 0x34 | (oss << 6))) != i2c_error_ok)
-		return(error);
+		/* set cmd = 0x34 = start air pressure measurement */
+
+		if((error = bmp085_write_reg_1(address, 0xf4, 0x34 | (oss << 6))) != i2c_error_ok)
+			return(error);
+
+		*delay_ms = 25;
+		return(i2c_error_ok);
+	}
 
-	msleep(25);
+	*delay_ms = 0;
 
 	/* fetch result from 0xf6,0xf7,0xf8 */
 
@@ -3517,9 +3728,20 @@ static i2c_error_t bmp085_read(int address, i2c_sensor_value_t *rv_airpressure,
 	return(i2c_error_ok);
 }
 
+static i2c_error_t sensor_bmp085_airpressure_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(bmp085_step(entry->address, step, delay_ms, value, (i2c_sensor_value_t *)0));
+}
+
+static i2c_error_t sensor_bmp085_temperature_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(bmp085_step(entry->address, step, delay_ms, (i2c_sensor_value_t *)0, value));
+}
+
 static i2c_error_t sensor_bmp085_init_airpressure(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_device_data_t *data)
 {
 	i2c_error_t error;
+	i2c_sensor_value_t value;
 
 	if((error = bmp085_read_reg_2(entry->address, 0xaa, &bmp085.ac1)) != i2c_error_ok)
 		return(error);
@@ -3551,7 +3773,7 @@ static i2c_error_t sensor_bmp085_init_airpressure(int bus, const i2c_sensor_devi
 	if((error = bmp085_read_reg_2(entry->address, 0xbe, &bmp085.md)) != i2c_error_ok)
 		return(error);
 
-	if((error = bmp085_read(entry->address, (i2c_sensor_value_t *)0, (i2c_sensor_value_t *)0, data)) != i2c_error_ok)
+	if((error = sensor_read_steps(bus, entry, &value, data, sensor_bmp085_airpressure_step)) != i2c_error_ok)
 		return(error);
 
 	sensor_register(bus, entry->id);
@@ -3561,12 +3783,12 @@ static i2c_error_t sensor_bmp085_init_airpressure(int bus, const i2c_sensor_devi
 
 static i2c_error_t sensor_bmp085_read_airpressure(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(bmp085_read(entry->address, value, (i2c_sensor_value_t *)0, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_bmp085_airpressure_step));
 }
 
 static i2c_error_t sensor_bmp085_read_temperature(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(bmp085_read(entry->address, (i2c_sensor_value_t *)0, value, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_bmp085_temperature_step));
 }
 
 typedef enum
@@ -3601,18 +3823,23 @@ attr_pure static uint16_t am2320_crc(int length, const uint8_t *data)
 	return(crc);
 }
 
-static i2c_error_t sensor_am2320_read_registers(int address, int offset, int length, uint8_t *values)
+enum
 {
-	i2c_error_t	error;
-	uint8_t		i2c_buffer[32];
-	uint16_t	crc1, crc2;
+	am2320_delay_read = 10,
+};
 
+static i2c_error_t sensor_am2320_request_registers(int address, int offset, int length)
+{
 	i2c_send(address, 0, 0);
 
-	if((error = i2c_send3(address, 0x03, offset, length)) != i2c_error_ok)
-		return(error);
+	return(i2c_send3(address, 0x03, offset, length));
+}
 
-	msleep(10);
+static i2c_error_t sensor_am2320_collect_registers(int address, int length, uint8_t *values)
+{
+	i2c_error_t	error;
+	uint8_t		i2c_buffer[32];
+	uint16_t	crc1, crc2;
 
 	if((error = i2c_receive(address, length + 4, i2c_buffer)) != i2c_error_ok)
 		return(error);
@@ -3631,16 +3858,37 @@ static i2c_error_t sensor_am2320_read_registers(int address, int offset, int len
 	return(i2c_error_ok);
 }
 
-static i2c_error_t sensor_am2320_read(int address, i2c_sensor_value_t *value, am2320_action_t action, i2c_sensor_device_data_t *data)
+static i2c_error_t sensor_am2320_read_registers(int address, int offset, int length, uint8_t *values)
 {
 	i2c_error_t	error;
+
+	if((error = sensor_am2320_request_registers(address, offset, length)) != i2c_error_ok)
+		return(error);
+
+	msleep(am2320_delay_read);
+
+	return(sensor_am2320_collect_registers(address, length, values));
+}
+
+// step 0 requests the registers, step 1 collects them, when the device doesn't respond, the previous values are returned
+
+static i2c_error_t sensor_am2320_step(int address, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, am2320_action_t action)
+{
 	uint8_t		values[4];
 	int32_t		raw_temp, raw_hum;
 
 	//	0x00	start address: humidity (16 bits), temperature (16 bits)
 	//	0x04	length
 
-	if((error = sensor_am2320_read_registers(address, 0x00, 0x04, values)) == i2c_error_ok)
+	if((step == 0) && (sensor_am2320_request_registers(address, 0x00, 0x04) == i2c_error_ok))
+	{
+		*delay_ms = am2320_delay_read;
+		return(i2c_error_ok);
+	}
+
+	*delay_ms = 0;
+
+	if((step > 0) && (sensor_am2320_collect_registers(address, 0x04, values) == i2c_error_ok))
 	{
 		raw_hum = (values[0] << 8) | values[1];
 
@@ -3689,14 +3937,24 @@ static i2c_error_t sensor_am2320_humidity_init(int bus, const i2c_sensor_device_
 	return(i2c_error_ok);
 }
 
+static i2c_error_t sensor_am2320_humidity_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_am2320_step(entry->address, step, delay_ms, value, am2320_action_humidity));
+}
+
+static i2c_error_t sensor_am2320_temperature_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_am2320_step(entry->address, step, delay_ms, value, am2320_action_temperature));
+}
+
 static i2c_error_t sensor_am2320_humidity_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_am2320_read(entry->address, value, am2320_action_humidity, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_am2320_humidity_step));
 }
 
 static i2c_error_t sensor_am2320_temperature_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_am2320_read(entry->address, value, am2320_action_temperature, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_am2320_temperature_step));
 }
 
 typedef enum
@@ -3713,17 +3971,26 @@ typedef enum
 	hih6130_status_mask =	(1 << 7) | (1 << 6),
 } hih6130_status_t;
 
-static i2c_error_t sensor_hih6130_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, hih6130_action_t action, i2c_sensor_device_data_t *data)
+// step 0 starts the measurement, step 1 fetches the result
+
+static i2c_error_t sensor_hih6130_step(const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, hih6130_action_t action)
 {
+	enum { delay_measurement = 50 };
 	uint8_t i2c_buffer[4];
 	i2c_error_t error;
 
 	value->cooked = value->raw = -1;
 
-	if((error = i2c_send(entry->address, 0, 0)) != i2c_error_ok)
-		return(error);
+	if(step == 0)
+	{
+		if((error = i2c_send(entry->address, 0, 0)) != i2c_error_ok)
+			return(error);
+
+		*delay_ms = delay_measurement;
+		return(i2c_error_ok);
+	}
 
-	msleep(50);
+	*delay_ms = 0;
 
 	if((error = i2c_receive(entry->address, 4, i2c_buffer) != i2c_error_ok) || ((i2c_buffer[0] & hih6130_status_mask) != hih6130_status_normal))
 		return((error == i2c_error_ok) ? i2c_error_device_error_1 : error);
@@ -3758,14 +4025,24 @@ static i2c_error_t sensor_hih6130_humidity_init(int bus, const i2c_sensor_device
 	return(i2c_error_ok);
 }
 
+static i2c_error_t sensor_hih6130_temperature_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_hih6130_step(entry, step, delay_ms, value, hih6130_action_temperature));
+}
+
+static i2c_error_t sensor_hih6130_humidity_step(int bus, const i2c_sensor_device_table_entry_t *entry, unsigned int step, unsigned int *delay_ms, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
+{
+	return(sensor_hih6130_step(entry, step, delay_ms, value, hih6130_action_humidity));
+}
+
 static i2c_error_t sensor_hih6130_temperature_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_hih6130_read(bus, entry, value, hih6130_action_temperature, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_hih6130_temperature_step));
 }
 
 static i2c_error_t sensor_hih6130_humidity_read(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_value_t *value, i2c_sensor_device_data_t *data)
 {
-	return(sensor_hih6130_read(bus, entry, value, hih6130_action_humidity, data));
+	return(sensor_read_steps(bus, entry, value, data, sensor_hih6130_humidity_step));
 }
 
 static i2c_error_t sensor_digipicco_humidity_init(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_device_data_t *data)
@@ -4189,21 +4466,54 @@ static const i2c_sensor_device_table_entry_t device_table[] =
 	},
 };
 
-static i2c_sensor_info_t sensor_info =
-{
-	.init_started = 0,
-	.init_finished = 0,
-};
-
 void i2c_sensor_get_info(i2c_sensor_info_t *sensor_info_ptr)
 {
 	*sensor_info_ptr = sensor_info;
 }
 
+/*
+ * Sensors that share an address are linked in a ring (through address_peer), so the
+ * collision check only has to visit the sensors with the same address. The ring is built
+ * once, it only contains sensors that have an init function and aren't secondary.
+ */
+
+static uint8_t address_peer[i2c_sensor_size];
+static _Bool address_peers_valid = false;
+
+static void address_peers_build(void)
+{
+	const i2c_sensor_device_table_entry_t *entry;
+	unsigned int sensor, last, peer;
+
+	for(sensor = 0; sensor < i2c_sensor_size; sensor++)
+		address_peer[sensor] = sensor;
+
+	for(sensor = 0, entry = device_table; sensor < i2c_sensor_size; sensor++, entry++)
+	{
+		if(!entry->init_fn || entry->secondary)
+			continue;
+
+		for(last = sensor, peer = sensor + 1; peer < i2c_sensor_size; peer++)
+		{
+			if(!device_table[peer].init_fn || device_table[peer].secondary || (device_table[peer].address != entry->address))
+				continue;
+
+			if(address_peer[peer] != peer)
+				break;
+
+			address_peer[last] = peer;
+			address_peer[peer] = sensor;
+			last = peer;
+		}
+	}
+
+	address_peers_valid = true;
+}
+
 i2c_error_t i2c_sensor_init(int bus, i2c_sensor_t sensor)
 {
-	const i2c_sensor_device_table_entry_t *device_table_entry, *device_table_check_entry;
-	unsigned int device_table_check_index;
+	const i2c_sensor_device_table_entry_t *device_table_entry;
+	unsigned int peer;
 	i2c_error_t error;
 
 	if(sensor >= i2c_sensor_size)
@@ -4225,28 +4535,21 @@ i2c_error_t i2c_sensor_init(int bus, i2c_sensor_t sensor)
 	if(!device_table_entry->init_fn)
 		return(i2c_error_disabled);
 
-	for(device_table_check_index = 0, device_table_check_entry = device_table; device_table_check_index < i2c_sensor_size; device_table_check_index++, device_table_check_entry++)
+	if(!address_peers_valid)
+		address_peers_build();
+
+	peer = sensor;
+
+	do
 	{
-		if(device_table_check_entry->init_fn && !device_table_check_entry->secondary &&
-				(device_table_check_entry->address == device_table_entry->address))
-		{
-			if(i2c_sensor_registered(0, device_table_check_entry->id))
-			{
-				//log("*** skipped %s/%s@%u/%x/%u, device %s/%s@%u/%x/%u on bus 0\n",
-						//device_table_entry->name, device_table_entry->type, bus, device_table_entry->address, device_table_entry->id,
-						//device_table_check_entry->name, device_table_check_entry->type, bus, device_table_check_entry->address, device_table_check_entry->id);
-				return(i2c_error_in_use_on_bus_0);
-			}
+		if(i2c_sensor_registered(0, peer))
+			return(i2c_error_in_use_on_bus_0);
 
-			if(i2c_sensor_registered(bus, device_table_check_entry->id))
-			{
-				//log("*** skipped %s/%s@%u/%x/%u, found device %s/%s@%u/%x/%u\n",
-						//device_table_entry->name, device_table_entry->type, bus, device_table_entry->address, device_table_entry->id,
-						//device_table_check_entry->name, device_table_check_entry->type, bus, device_table_check_entry->address, device_table_check_entry->id);
-				return(i2c_error_in_use);
-			}
-		}
-	}
+		if(i2c_sensor_registered(bus, peer))
+			return(i2c_error_in_use);
+
+		peer = address_peer[peer];
+	} while(peer != sensor);
 
 	if((error = i2c_select_bus(bus)) != i2c_error_ok)
 	{
@@ -4264,10 +4567,71 @@ i2c_error_t i2c_sensor_init(int bus, i2c_sensor_t sensor)
 	return(i2c_error_ok);
 }
 
+/*
+ * At boot every bus is probed once for the addresses in the device table, after that
+ * only the sensors whose address answered are initialised. The am2320 sleeps and
+ * doesn't answer the first time it's addressed, so it's always initialised.
+ */
+
+static const i2c_sensor_t probe_always[] =
+{
+	i2c_sensor_am2320_humidity,
+};
+
+static uint32_t probe_answered[i2c_busses][128 / 32];
+static unsigned int probe_buses_done = 0;
+
+attr_inline void probe_set(unsigned int bus, unsigned int address)
+{
+	probe_answered[bus][(address & 0x7f) >> 5] |= 1 << (address & 0x1f);
+}
+
+attr_inline _Bool probe_get(unsigned int bus, unsigned int address)
+{
+	return(!!(probe_answered[bus][(address & 0x7f) >> 5] & (1 << (address & 0x1f))));
+}
+
+static void probe_bus(unsigned int bus)
+{
+	const i2c_sensor_device_table_entry_t *entry;
+	uint32_t tried[128 / 32] = { 0, 0, 0, 0 };
+	unsigned int sensor, ix;
+	uint64_t start;
+
+	start = time_get_us();
+
+	if(i2c_select_bus(bus) == i2c_error_ok)
+	{
+		for(sensor = 0, entry = device_table; sensor < i2c_sensor_size; sensor++, entry++)
+		{
+			if(!entry->init_fn || entry->secondary || (tried[entry->address >> 5] & (1 << (entry->address & 0x1f))))
+				continue;
+
+			tried[entry->address >> 5] |= 1 << (entry->address & 0x1f);
+			sensor_info.init_probes++;
+
+			if(i2c_probe(entry->address) == i2c_error_ok)
+			{
+				probe_set(bus, entry->address);
+				sensor_info.init_probe_acks++;
+			}
+		}
+	}
+
+	i2c_select_bus(0);
+
+	for(ix = 0; ix < (sizeof(probe_always) / sizeof(*probe_always)); ix++)
+		probe_set(bus, device_table[probe_always[ix]].address);
+
+	probe_buses_done |= 1 << bus;
+	sensor_info.init_probe_us += time_get_us() - start;
+}
+
 _Bool i2c_sensors_init(void)
 {
+	const i2c_sensor_device_table_entry_t *entry;
 	i2c_info_t i2c_info;
-	unsigned int buses;
+	unsigned int bus, sensor;
 
 	sensor_info.init_called++;
 
@@ -4280,54 +4644,83 @@ _Bool i2c_sensors_init(void)
 	if(sensor_info.init_finished)
 		return(false);
 
-	switch(i2c_sensor_init(sensor_info.init_current_bus, sensor_info.init_current_sensor))
-	{
-		case(i2c_error_ok):
-		{
-			sensor_info.init_succeeded++;
-			break;
-		}
+	bus = sensor_info.init_current_bus;
 
-		case(i2c_error_in_use_on_bus_0):
-		{
-			sensor_info.init_skip_found_on_bus_0++;
-			break;
-		}
+	if(!(probe_buses_done & (1 << bus)))
+		probe_bus(bus);
 
-		case(i2c_error_disabled):
-		{
-			sensor_info.init_skip_disabled++;
-			break;
-		}
+	// skip the sensors that won't be initialised without touching the bus
 
-		case(i2c_error_init_secondary):
-		{
+	for(sensor = sensor_info.init_current_sensor; sensor < i2c_sensor_size; sensor++)
+	{
+		entry = &device_table[sensor];
+
+		if(entry->secondary)
 			sensor_info.init_skip_secondary++;
-			break;
-		}
+		else
+			if(!entry->init_fn)
+				sensor_info.init_skip_disabled++;
+			else
+				if(!probe_get(bus, entry->address))
+					sensor_info.init_skip_no_ack++;
+				else
+					break;
+	}
 
-		case(i2c_error_in_use):
+	if(sensor < i2c_sensor_size)
+	{
+		switch(i2c_sensor_init(bus, sensor))
 		{
-			sensor_info.init_skip_duplicate_address++;
-			break;
-		}
+			case(i2c_error_ok):
+			{
+				sensor_info.init_succeeded++;
+				break;
+			}
 
-		default:
-		{
-			sensor_info.init_failed++;
-			break;
+			case(i2c_error_in_use_on_bus_0):
+			{
+				sensor_info.init_skip_found_on_bus_0++;
+				break;
+			}
+
+			case(i2c_error_disabled):
+			{
+				sensor_info.init_skip_disabled++;
+				break;
+			}
+
+			case(i2c_error_init_secondary):
+			{
+				sensor_info.init_skip_secondary++;
+				break;
+			}
+
+			case(i2c_error_in_use):
+			{
+				sensor_info.init_skip_duplicate_address++;
+				break;
+			}
+
+			default:
+			{
+				sensor_info.init_failed++;
+				break;
+			}
 		}
+
+		sensor++;
 	}
 
-	i2c_get_info(&i2c_info);
-	buses = i2c_info.buses;
+	sensor_info.init_current_sensor = sensor;
 
-	if(++sensor_info.init_current_sensor >= i2c_sensor_size)
+	if(sensor >= i2c_sensor_size)
 	{
+		i2c_get_info(&i2c_info);
+
 		sensor_info.init_current_sensor = 0;
 		sensor_info.init_current_bus++;
 
-		if(sensor_info.init_current_bus >= buses)
+		if(sensor_info.init_current_bus >= i2c_info.buses)
 		{
 			sensor_info.init_current_sensor = 0;
 			sensor_info.init_current_bus = 0;
@@ -4340,14 +4733,280 @@ _Bool i2c_sensors_init(void)
 	return(true);
 }
 
+static double sensor_calibrate(int bus, i2c_sensor_t sensor, double cooked)
+{
+	int int_factor, int_offset;
+	string_init(varname_i2s_factor, "i2s.%u.%u.factor");
+	string_init(varname_i2s_offset, "i2s.%u.%u.offset");
+
+	if(!config_get_int(&varname_i2s_factor, bus, sensor, &int_factor))
+		int_factor = 1000;
+
+	if(!config_get_int(&varname_i2s_offset, bus, sensor, &int_offset))
+		int_offset = 0;
+
+	return((cooked * int_factor / 1000.0) + (int_offset / 1000.0));
+}
+
+// a failed read keeps the previous value in the cache
+
+static void cache_store(i2c_sensor_cache_t *cache, i2c_error_t error, const i2c_sensor_value_t *value, uint32_t latency_us)
+{
+	uint32_t now;
+
+	cache->latency_last_us = latency_us;
+	cache->latency_max_us = umax(cache->latency_max_us, cache->latency_last_us);
+
+	now = cache_now_ms();
+	cache->interval_ms = cache_interval(cache->bus, cache->sensor);
+	cache->due_ms = now + cache->interval_ms;
+
+	if(error == i2c_error_ok)
+	{
+		cache->value = *value;
+		cache->sampled_ms = now;
+		cache->valid = 1;
+		cache->error = 0;
+	}
+	else
+	{
+		cache->error = 1;
+		sensor_info.cache_sample_errors++;
+	}
+
+	sensor_info.cache_samples++;
+}
+
+// the bus must be selected by the caller
+
+static i2c_error_t sensor_sample(int bus, const i2c_sensor_device_table_entry_t *entry, i2c_sensor_cache_t *cache, i2c_sensor_value_t *value)
+{
+	i2c_error_t error;
+	uint64_t start;
+
+	start = time_get_us();
+	error = entry->read_fn(bus, entry, value, &device_data[entry->id]);
+
+	if(cache)
+		cache_store(cache, error, value, time_get_us() - start);
+
+	return(error);
+}
+
+/*
+ * Background conversions. The command task starts the conversion of a sensor that has
+ * a step function, the following steps run from the timer task when their delay has
+ * passed. Only one conversion runs at a time. The read latency of these sensors is the
+ * time spent in the steps, not the conversion time.
+ */
+
+typedef struct
+{
+	i2c_sensor_t		id;
+	sensor_step_fn_t	step_fn;
+} sensor_conversion_entry_t;
+
+static const sensor_conversion_entry_t conversion_table[] =
+{
+	{ i2c_sensor_tsl2550,				sensor_tsl2550_step },
+	{ i2c_sensor_hdc1080_humidity,		sensor_hdc1080_humidity_step },
+	{ i2c_sensor_hdc1080_temperature,	sensor_hdc1080_temperature_step },
+	{ i2c_sensor_htu21_humidity,		sensor_htu21_humidity_step },
+	{ i2c_sensor_htu21_temperature,		sensor_htu21_temperature_step },
+	{ i2c_sensor_bmp085_airpressure,	sensor_bmp085_airpressure_step },
+	{ i2c_sensor_bmp085_temperature,	sensor_bmp085_temperature_step },
+	{ i2c_sensor_am2320_humidity,		sensor_am2320_humidity_step },
+	{ i2c_sensor_am2320_temperature,	sensor_am2320_temperature_step },
+	{ i2c_sensor_hih6130_humidity,		sensor_hih6130_humidity_step },
+	{ i2c_sensor_hih6130_temperature,	sensor_hih6130_temperature_step },
+};
+
+static sensor_step_fn_t conversion_step_fn(i2c_sensor_t sensor)
+{
+	unsigned int ix;
+
+	for(ix = 0; ix < (sizeof(conversion_table) / sizeof(*conversion_table)); ix++)
+		if(conversion_table[ix].id == sensor)
+			return(conversion_table[ix].step_fn);
+
+	return((sensor_step_fn_t)0);
+}
+
+// a direct read of the same device interferes with a running conversion, abandon it
+
+static void conversion_cancel(int bus, uint8_t address)
+{
+	if(conversion.active && (conversion.bus == bus) && (device_table[conversion.sensor].address == address))
+	{
+		conversion.active = 0;
+		sensor_info.cache_conversions_cancelled++;
+	}
+}
+
+// the bus must be selected by the caller
+
+static void conversion_step(void)
+{
+	i2c_sensor_cache_t *cache;
+	i2c_error_t error;
+	unsigned int delay_ms;
+	uint64_t start;
+
+	start = time_get_us();
+	error = conversion.step_fn(conversion.bus, &device_table[conversion.sensor], conversion.step, &delay_ms, &conversion.value, &device_data[conversion.sensor]);
+	conversion.busy_us += time_get_us() - start;
+
+	if((error == i2c_error_ok) && (delay_ms > 0))
+	{
+		if(++conversion.step < sensor_steps_max)
+		{
+			conversion.due_ms = cache_now_ms() + delay_ms;
+			return;
+		}
+
+		error = i2c_error_device_error_5;
+	}
+
+	conversion.active = 0;
+	sensor_info.cache_conversions++;
+
+	if((cache = cache_find(conversion.bus, conversion.sensor)))
+		cache_store(cache, error, &conversion.value, conversion.busy_us);
+}
+
+iram _Bool i2c_sensors_converting(void)
+{
+	return(conversion.active);
+}
+
+// called from the timer task, runs the next step of the conversion when it's due
+
+void i2c_sensors_poll(void)
+{
+	i2c_sensor_cache_t *cache;
+
+	if(!conversion.active || ((int32_t)(cache_now_ms() - conversion.due_ms) < 0))
+		return;
+
+	if(i2c_select_bus(conversion.bus) == i2c_error_ok)
+		conversion_step();
+	else
+	{
+		conversion.active = 0;
+
+		if((cache = cache_find(conversion.bus, conversion.sensor)))
+			cache_store(cache, i2c_error_bus_lock, &conversion.value, conversion.busy_us);
+	}
+
+	i2c_select_bus(0);
+}
+
+/*
+ * Sample the sensors that are due, at most sensor_samples_per_call per call to bound the time
+ * spent in one timer tick. The scan continues where the previous call stopped, so a
+ * sensor further down the cache isn't starved when many are due at once.
+ * A sensor that needs a conversion stays due while another conversion is running.
+ */
+
+void i2c_sensors_sample(void)
+{
+	static unsigned int next_slot = 0;
+	i2c_sensor_cache_t *cache;
+	const i2c_sensor_device_table_entry_t *entry;
+	i2c_sensor_value_t value;
+	sensor_step_fn_t step_fn;
+	unsigned int slot, scanned, sampled;
+	uint32_t now;
+
+	if(!sensor_info.init_finished || (sensor_cache_entries == 0))
+		return;
+
+	now = cache_now_ms();
+
+	for(scanned = 0, sampled = 0; (scanned < sensor_cache_entries) && (sampled < sensor_samples_per_call); scanned++)
+	{
+		slot = (next_slot + scanned) % sensor_cache_entries;
+		cache = &sensor_cache[slot];
+
+		if((int32_t)(now - cache->due_ms) < 0)
+			continue;
+
+		entry = &device_table[cache->sensor];
+		step_fn = conversion_step_fn(cache->sensor);
+
+		if(step_fn && conversion.active)
+			continue;
+
+		sampled++;
+
+		if(!entry->read_fn || (i2c_select_bus(cache->bus) != i2c_error_ok))
+		{
+			cache->error = 1;
+			cache->due_ms = now + cache->interval_ms;
+			sensor_info.cache_sample_errors++;
+			continue;
+		}
+
+		if(step_fn)
+		{
+			conversion.step_fn = step_fn;
+			conversion.bus = cache->bus;
+			conversion.sensor = cache->sensor;
+			conversion.step = 0;
+			conversion.busy_us = 0;
+			conversion.active = 1;
+
+			conversion_step();
+		}
+		else
+			sensor_sample(cache->bus, entry, cache, &value);
+	}
+
+	next_slot = (next_slot + scanned) % sensor_cache_entries;
+
+	i2c_select_bus(0);
+}
+
+_Bool i2c_sensor_cache_metrics(string_t *dst, unsigned int slot)
+{
+	const i2c_sensor_cache_t *cache;
+	const i2c_sensor_device_table_entry_t *entry;
+	uint32_t now;
+
+	if(slot >= sensor_cache_entries)
+		return(false);
+
+	cache = &sensor_cache[slot];
+	entry = &device_table[cache->sensor];
+	now = cache_now_ms();
+
+	if(cache->valid)
+	{
+		string_format(dst, "espiobridge_sensor_value{bus=\"%u\",sensor=\"%u\",name=\"%s\",type=\"%s\",unity=\"%s\"} ",
+				cache->bus, cache->sensor, entry->name, entry->type, entry->unity);
+		string_double(dst, sensor_calibrate(cache->bus, cache->sensor, cache->value.cooked), entry->precision, 1e10);
+		string_append(dst, "\n");
+		string_format(dst, "espiobridge_sensor_age_seconds{bus=\"%u\",sensor=\"%u\"} %u\n",
+				cache->bus, cache->sensor, (now - cache->sampled_ms) / 1000);
+	}
+
+	string_format(dst, "espiobridge_sensor_stale{bus=\"%u\",sensor=\"%u\"} %u\n", cache->bus, cache->sensor, cache_stale(cache, now) ? 1 : 0);
+	string_format(dst, "espiobridge_sensor_error{bus=\"%u\",sensor=\"%u\"} %u\n", cache->bus, cache->sensor, cache->error);
+	string_format(dst, "espiobridge_sensor_read_latency_us{bus=\"%u\",sensor=\"%u\"} %u\n", cache->bus, cache->sensor, cache->latency_last_us);
+
+	return(true);
+}
+
 _Bool i2c_sensor_read(string_t *dst, int bus, i2c_sensor_t sensor, _Bool verbose, _Bool html)
 {
 	const i2c_sensor_device_table_entry_t *entry;
+	i2c_sensor_cache_t *cache;
 	i2c_error_t error;
 	i2c_sensor_value_t value;
 	int current;
 	int int_factor, int_offset;
 	double extracooked;
+	uint32_t now;
 	string_init(varname_i2s_factor, "i2s.%u.%u.factor");
 	string_init(varname_i2s_offset, "i2s.%u.%u.offset");
 
@@ -4365,30 +5024,42 @@ _Bool i2c_sensor_read(string_t *dst, int bus, i2c_sensor_t sensor, _Bool verbose
 		return(false);
 	}
 
-	if((error = i2c_select_bus(bus)) != i2c_error_ok)
+	now = cache_now_ms();
+
+	if((cache = cache_find(bus, sensor)) && !cache_stale(cache, now))
 	{
-		string_format(dst, "i2c sensor read: select bus #%u error", bus);
-		i2c_error_format_string(dst, error);
-		i2c_select_bus(0);
-		return(false);
+		sensor_info.cache_hits++;
+		value = cache->value;
+		error = i2c_error_ok;
 	}
+	else
+	{
+		if(cache)
+			sensor_info.cache_misses++;
+
+		conversion_cancel(bus, entry->address);
+
+		if((error = i2c_select_bus(bus)) != i2c_error_ok)
+		{
+			string_format(dst, "i2c sensor read: select bus #%u error", bus);
+			i2c_error_format_string(dst, error);
+			i2c_select_bus(0);
+			return(false);
+		}
+
+		error = sensor_sample(bus, entry, cache, &value);
 
-	error = i2c_error_ok;
+		i2c_select_bus(0);
+	}
 
 	if(html)
 		string_format(dst, "%u</td><td align=\"right\">%u</td><td align=\"right\">0x%02x</td><td>%s</td><td>%s</td>", bus, sensor, entry->address, entry->name, entry->type);
 	else
 		string_format(dst, "%s sensor %u/%02u@%02x: %s, %s: ", device_data[sensor].registered ? "+" : " ", bus, sensor, entry->address, entry->name, entry->type);
 
-	if((error = entry->read_fn(bus, entry, &value, &device_data[current])) == i2c_error_ok)
+	if(error == i2c_error_ok)
 	{
-		if(!config_get_int(&varname_i2s_factor, bus, sensor, &int_factor))
-			int_factor = 1000;
-
-		if(!config_get_int(&varname_i2s_offset, bus, sensor, &int_offset))
-			int_offset = 0;
-
-		extracooked = (value.cooked * int_factor / 1000.0) + (int_offset / 1000.0);
+		extracooked = sensor_calibrate(bus, sensor, value.cooked);
 
 		if(html)
 		{
@@ -4437,8 +5108,18 @@ _Bool i2c_sensor_read(string_t *dst, int bus, i2c_sensor_t sensor, _Bool verbose
 		string_double(dst, int_factor / 1000.0, 4, 1e10);
 		string_append(dst, ", offset=");
 		string_double(dst, int_offset / 1000.0, 4, 1e10);
+
+		if(cache)
+		{
+			if(cache->valid)
+				string_format(dst, ", age: %u ms%s", now - cache->sampled_ms, cache_stale(cache, now) ? " (stale)" : "");
+			else
+				string_append(dst, ", age: never");
+
+			string_format(dst, ", interval: %u ms, read time: %u us (max %u us)",
+					cache->interval_ms, cache->latency_last_us, cache->latency_max_us);
+		}
 	}
 
-	i2c_select_bus(0);
 	return(true);
 }
@@ -88,11 +88,22 @@ typedef struct
 	unsigned int	init_skip_secondary;
 	unsigned int	init_skip_found_on_bus_0;
 	unsigned int	init_skip_duplicate_address;
+	unsigned int	init_skip_no_ack;
+	unsigned int	init_probes;
+	unsigned int	init_probe_acks;
+	unsigned int	init_probe_us;
 	unsigned int	init_failed;
 	unsigned int	init_current_bus;
 	i2c_sensor_t	init_current_sensor;
 	unsigned int	init_started:1;
 	unsigned int	init_finished:1;
+	unsigned int	cache_samples;
+	unsigned int	cache_sample_errors;
+	unsigned int	cache_hits;
+	unsigned int	cache_misses;
+	unsigned int	cache_overflows;
+	unsigned int	cache_conversions;
+	unsigned int	cache_conversions_cancelled;
 } i2c_sensor_info_t;
 
 typedef struct
@@ -101,6 +112,27 @@ typedef struct
 	double cooked;
 } i2c_sensor_value_t;
 
+enum
+{
+	i2c_sensor_cache_size = 16,
+	i2c_sensor_cache_interval_default_ms = 5000,
+	i2c_sensor_cache_interval_min_ms = 100,
+};
+
+typedef struct
+{
+	i2c_sensor_value_t	value;
+	uint32_t			sampled_ms;
+	uint32_t			due_ms;
+	uint32_t			interval_ms;
+	uint32_t			latency_last_us;
+	uint32_t			latency_max_us;
+	uint8_t				bus;
+	i2c_sensor_t		sensor;
+	unsigned int		valid:1;
+	unsigned int		error:1;
+} i2c_sensor_cache_t;
+
 typedef struct attr_packed
 {
 	unsigned int registered:7;
@@ -127,5 +159,9 @@ i2c_error_t	i2c_sensor_init(int bus, i2c_sensor_t);
 _Bool		i2c_sensors_init(void);
 _Bool		i2c_sensor_read(string_t *, int bus, i2c_sensor_t, _Bool verbose, _Bool html);
 _Bool		i2c_sensor_registered(int bus, i2c_sensor_t);
+void		i2c_sensors_sample(void);
+void		i2c_sensors_poll(void);
+_Bool		i2c_sensors_converting(void);
+_Bool		i2c_sensor_cache_metrics(string_t *, unsigned int slot);
 
 #endif
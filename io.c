@@ -11,9 +11,12 @@
 #include "time.h"
 #include "sequencer.h"
 #include "dispatch.h"
+#include "stats.h"
 
 io_config_pin_entry_t io_config[io_id_size][max_pins_per_io];
 
+static void io_fade_cancel(int io, int pin);
+
 static const io_info_t io_info =
 {
 	{
@@ -37,7 +40,7 @@ static const io_info_t io_info =
 		io_gpio_init,
 		(void *)0, // postinit
 		io_gpio_pin_max_value,
-		(void *)0, // periodic slow
+		io_gpio_periodic_slow,
 		io_gpio_periodic_fast,
 		io_gpio_init_pin_mode,
 		io_gpio_get_pin_info,
@@ -1074,9 +1077,42 @@ io_error_t io_write_pin(string_t *error, int io, int pin, uint32_t value)
 	pin_config = &io_config[io][pin];
 	pin_data = &data->pin[pin];
 
+	io_fade_cancel(io, pin);
+
 	return(io_write_pin_x(error, info, pin_data, pin_config, pin, value));
 }
 
+io_error_t io_resolve_pin(string_t *error, int io, int pin, io_target_t *target)
+{
+	if((io < 0) || (io >= io_id_size))
+	{
+		if(error)
+			string_append(error, "io out of range\n");
+		return(io_error);
+	}
+
+	if((pin < 0) || (pin >= io_info[io].pins))
+	{
+		if(error)
+			string_append(error, "pin out of range\n");
+		return(io_error);
+	}
+
+	target->info = &io_info[io];
+	target->pin_data = &io_data[io].pin[pin];
+	target->pin_config = &io_config[io][pin];
+	target->pin = pin;
+
+	return(io_ok);
+}
+
+io_error_t io_write_target(string_t *error, const io_target_t *target, uint32_t value)
+{
+	io_fade_cancel(target->info->id, target->pin);
+
+	return(io_write_pin_x(error, target->info, target->pin_data, target->pin_config, target->pin, value));
+}
+
 io_error_t io_set_mask(string_t *error, int io, unsigned int mask, unsigned int pins)
 {
 	const io_info_entry_t *info;
@@ -1120,9 +1156,247 @@ io_error_t io_trigger_pin(string_t *error, int io, int pin, io_trigger_t trigger
 	pin_config = &io_config[io][pin];
 	pin_data = &data->pin[pin];
 
+	io_fade_cancel(io, pin);
+
 	return(io_trigger_pin_x(error, info, pin_data, pin_config, pin, trigger_type));
 }
 
+/*
+ * Fades run from the fast timer (every 10 ms) instead of the slow timer triggers. The
+ * value is computed from the time since the start of the fade, so a late tick doesn't
+ * change the curve, it's counted as a missed deadline. Only the pin that changes is
+ * written, for pwm1 that updates the isr's next phase set.
+ */
+
+enum
+{
+	io_fade_slots = 8,
+};
+
+typedef struct
+{
+	uint32_t		from;
+	uint32_t		to;
+	uint32_t		value;
+	uint32_t		start_ms;
+	uint32_t		last_ms;
+	uint32_t		duration_ms;
+	uint8_t			io;
+	uint8_t			pin;
+	io_fade_curve_t	curve;
+	unsigned int	active:1;
+} io_fade_t;
+
+static io_fade_t io_fades[io_fade_slots];
+
+typedef struct
+{
+	io_fade_curve_t	id;
+	const char		*name;
+} io_fade_curve_name_t;
+
+static const io_fade_curve_name_t io_fade_curve_names[io_fade_size] =
+{
+	{ io_fade_linear,	"linear"	},
+	{ io_fade_in,		"in"		},
+	{ io_fade_out,		"out"		},
+	{ io_fade_in_out,	"in-out"	},
+};
+
+static io_fade_curve_t string_to_fade_curve(const string_t *src)
+{
+	unsigned int ix;
+
+	for(ix = 0; ix < io_fade_size; ix++)
+		if(string_match_cstr(src, io_fade_curve_names[ix].name))
+			return(io_fade_curve_names[ix].id);
+
+	return(io_fade_error);
+}
+
+// progress and result are fractions of 65536
+
+attr_const static uint32_t fade_ease(io_fade_curve_t curve, uint32_t progress)
+{
+	uint64_t remaining;
+
+	switch(curve)
+	{
+		case(io_fade_in):
+		{
+			return(((uint64_t)progress * progress) >> 16);
+		}
+
+		case(io_fade_out):
+		{
+			remaining = 65536 - progress;
+			return(65536 - ((remaining * remaining) >> 16));
+		}
+
+		case(io_fade_in_out):
+		{
+			if(progress < 32768)
+				return(((uint64_t)progress * progress) >> 15);
+
+			remaining = 65536 - progress;
+			return(65536 - ((remaining * remaining) >> 15));
+		}
+
+		default:
+		{
+			return(progress);
+		}
+	}
+}
+
+static void io_fade_cancel(int io, int pin)
+{
+	unsigned int ix;
+
+	for(ix = 0; ix < io_fade_slots; ix++)
+		if(io_fades[ix].active && (io_fades[ix].io == io) && (io_fades[ix].pin == pin))
+			io_fades[ix].active = 0;
+}
+
+io_error_t io_fade_pin(string_t *error, int io, int pin, uint32_t target, unsigned int duration_ms, io_fade_curve_t curve)
+{
+	const io_info_entry_t *info;
+	io_config_pin_entry_t *pin_config;
+	io_data_pin_entry_t *pin_data;
+	io_fade_t *fade, *slot;
+	uint32_t value;
+	unsigned int ix;
+
+	if((io < 0) || (io >= io_id_size))
+	{
+		if(error)
+			string_append(error, "io out of range\n");
+		return(io_error);
+	}
+
+	info = &io_info[io];
+
+	if((pin < 0) || (pin >= info->pins))
+	{
+		if(error)
+			string_append(error, "pin out of range\n");
+		return(io_error);
+	}
+
+	pin_config = &io_config[io][pin];
+	pin_data = &io_data[io].pin[pin];
+
+	if((pin_config->mode != io_pin_output_pwm1) && (pin_config->mode != io_pin_output_pwm2))
+	{
+		if(error)
+			string_append(error, "cannot fade this pin\n");
+		return(io_error);
+	}
+
+	if(target > io_pin_max_value_x(info, pin_data, pin_config, pin))
+	{
+		if(error)
+			string_append(error, "value out of range\n");
+		return(io_error);
+	}
+
+	if(curve >= io_fade_size)
+		curve = io_fade_linear;
+
+	for(fade = (io_fade_t *)0, ix = 0; ix < io_fade_slots; ix++)
+	{
+		slot = &io_fades[ix];
+
+		if(slot->active && (slot->io == io) && (slot->pin == pin))
+		{
+			fade = slot;
+			break;
+		}
+
+		if(!slot->active && !fade)
+			fade = slot;
+	}
+
+	// a running up/down trigger ramp would fight the fade
+
+	pin_data->direction = io_dir_none;
+
+	if((duration_ms == 0) || (io_read_pin_x(error, info, pin_data, pin_config, pin, &value) != io_ok))
+	{
+		io_fade_cancel(io, pin);
+		return(io_write_pin_x(error, info, pin_data, pin_config, pin, target));
+	}
+
+	if(!fade)
+	{
+		if(error)
+			string_append(error, "no free fade slot\n");
+		return(io_error);
+	}
+
+	fade->from = value;
+	fade->to = target;
+	fade->value = value;
+	fade->start_ms = time_get_us() / 1000;
+	fade->last_ms = fade->start_ms;
+	fade->duration_ms = duration_ms;
+	fade->io = io;
+	fade->pin = pin;
+	fade->curve = curve;
+	fade->active = 1;
+
+	return(io_ok);
+}
+
+static void io_fades_run(void)
+{
+	const io_info_entry_t *info;
+	io_fade_t *fade;
+	uint32_t now, elapsed, progress, value;
+	unsigned int ix;
+
+	now = time_get_us() / 1000;
+
+	for(ix = 0; ix < io_fade_slots; ix++)
+	{
+		fade = &io_fades[ix];
+
+		if(!fade->active)
+			continue;
+
+		if((now - fade->last_ms) > (2 * ms_per_fast_tick))
+			stat_io_fade_deadlines_missed++;
+
+		fade->last_ms = now;
+		elapsed = now - fade->start_ms;
+
+		if(elapsed >= fade->duration_ms)
+		{
+			value = fade->to;
+			fade->active = 0;
+		}
+		else
+		{
+			progress = fade_ease(fade->curve, ((uint64_t)elapsed << 16) / fade->duration_ms);
+
+			if(fade->to >= fade->from)
+				value = fade->from + (((uint64_t)(fade->to - fade->from) * progress) >> 16);
+			else
+				value = fade->from - (((uint64_t)(fade->from - fade->to) * progress) >> 16);
+		}
+
+		if(value == fade->value)
+			continue;
+
+		fade->value = value;
+		info = &io_info[fade->io];
+		stat_io_fade_steps++;
+
+		if(io_write_pin_x((string_t *)0, info, &io_data[fade->io].pin[fade->pin], &io_config[fade->io][fade->pin], fade->pin, value) != io_ok)
+			fade->active = 0;
+	}
+}
+
 io_error_t io_traits(string_t *errormsg, int io, int pin, io_pin_mode_t *pinmode, uint32_t *lower_bound, uint32_t *upper_bound, int *step, uint32_t *value)
 {
 	io_error_t error;
@@ -1686,7 +1960,9 @@ iram void io_periodic_fast(void)
 		}
 	}
 
-	if((sequencer_get_repeats() > 0) && ((time_get_us() / 1000) > sequencer_get_current_end_time()))
+	io_fades_run();
+
+	if(!sequencer_get_timed() && (sequencer_get_repeats() > 0) && ((time_get_us() / 1000) > sequencer_get_current_end_time()))
 		dispatch_post_command(command_task_run_sequencer);
 
 	if(flags.counter_triggered)
@@ -1701,8 +1977,6 @@ void io_periodic_slow(void)
 	io_data_pin_entry_t *pin_data;
 	int io, pin;
 	io_flags_t flags = { .counter_triggered = 0 };
-	string_init(varname_trigger_io, "trigger.status.io");
-	string_init(varname_trigger_pin, "trigger.status.pin");
 	static _Bool post_init_run = false;
 
 	for(io = 0; io < io_id_size; io++)
@@ -2557,6 +2831,61 @@ app_action_t application_function_io_trigger(string_t *src, string_t *dst)
 	return(app_action_normal);
 }
 
+static void fade_usage(string_t *dst)
+{
+	unsigned int ix;
+
+	string_append(dst, "usage: io-fade <io> <pin> <value> <duration_ms> [<curve>]\n");
+	string_append(dst, "    curve:");
+
+	for(ix = 0; ix < io_fade_size; ix++)
+		string_format(dst, " %s", io_fade_curve_names[ix].name);
+
+	string_append(dst, "\n");
+}
+
+app_action_t application_function_io_fade(string_t *src, string_t *dst)
+{
+	unsigned int io, pin, duration;
+	uint32_t value;
+	io_fade_curve_t curve;
+
+	if((parse_uint(1, src, &io, 0, ' ') != parse_ok) ||
+			(parse_uint(2, src, &pin, 0, ' ') != parse_ok) ||
+			(parse_uint(3, src, &value, 0, ' ') != parse_ok) ||
+			(parse_uint(4, src, &duration, 0, ' ') != parse_ok))
+	{
+		fade_usage(dst);
+		return(app_action_error);
+	}
+
+	curve = io_fade_linear;
+
+	if(parse_string(5, src, dst, ' ') == parse_ok)
+	{
+		curve = string_to_fade_curve(dst);
+		string_clear(dst);
+
+		if(curve == io_fade_error)
+		{
+			fade_usage(dst);
+			return(app_action_error);
+		}
+	}
+
+	string_format(dst, "fade %u/%u to %u in %u ms: ", io, pin, value, duration);
+
+	if(io_fade_pin(dst, io, pin, value, duration, curve) != io_ok)
+	{
+		string_append(dst, "\n");
+		return(app_action_error);
+	}
+
+	string_append(dst, "ok\n");
+
+	return(app_action_normal);
+}
+
 static app_action_t application_function_io_clear_set_flag(const string_t *src, string_t *dst, uint32_t value)
 {
 	const io_info_entry_t *info;
@@ -66,6 +66,18 @@ typedef enum attr_packed
 
 assert_size(io_trigger_t, 1);
 
+typedef enum attr_packed
+{
+	io_fade_linear,
+	io_fade_in,
+	io_fade_out,
+	io_fade_in_out,
+	io_fade_size,
+	io_fade_error = io_fade_size
+} io_fade_curve_t;
+
+assert_size(io_fade_curve_t, 1);
+
 typedef enum attr_packed
 {
 	io_pin_disabled = 0,
@@ -254,6 +266,16 @@ typedef const struct io_info_entry_T
 
 typedef const io_info_entry_t io_info_t[io_id_size];
 
+// a pin resolved once, for repeated writes without the lookups
+
+typedef struct
+{
+	const io_info_entry_t	*info;
+	io_data_pin_entry_t		*pin_data;
+	io_config_pin_entry_t	*pin_config;
+	int						pin;
+} io_target_t;
+
 extern io_config_pin_entry_t io_config[io_id_size][max_pins_per_io];
 
 assert_size(io_error_t, 4);
@@ -264,8 +286,11 @@ void			io_periodic_fast(void);
 unsigned int	io_pin_max_value(int io, int pin);
 io_error_t		io_read_pin(string_t *, int, int, uint32_t *);
 io_error_t		io_write_pin(string_t *, int, int, uint32_t);
+io_error_t		io_resolve_pin(string_t *, int io, int pin, io_target_t *);
+io_error_t		io_write_target(string_t *, const io_target_t *, uint32_t);
 io_error_t		io_set_mask(string_t *error, int io, unsigned int mask, unsigned int pins);
 io_error_t		io_trigger_pin(string_t *, int, int, io_trigger_t);
+io_error_t		io_fade_pin(string_t *, int io, int pin, uint32_t target, unsigned int duration_ms, io_fade_curve_t);
 io_error_t		io_traits(string_t *, int io, int pin, io_pin_mode_t *mode, uint32_t *lower_bound, uint32_t *upper_bound, int *step, uint32_t *value);
 void			io_config_dump(string_t *dst, int io_id, int pin_id, _Bool html);
 void			io_string_from_ll_mode(string_t *, io_pin_ll_mode_t, int pad);
@@ -274,6 +299,7 @@ app_action_t application_function_io_mode(string_t *src, string_t *dst);
 app_action_t application_function_io_read(string_t *src, string_t *dst);
 app_action_t application_function_io_write(string_t *src, string_t *dst);
 app_action_t application_function_io_trigger(string_t *src, string_t *dst);
+app_action_t application_function_io_fade(string_t *src, string_t *dst);
 app_action_t application_function_io_set_flag(string_t *src, string_t *dst);
 app_action_t application_function_io_clear_flag(string_t *src, string_t *dst);
 app_action_t application_function_io_set_mask(string_t *src, string_t *dst);
@@ -1,7 +1,9 @@
 #include "io_gpio.h"
 
+#include "pwm.h"
 #include "stats.h"
 #include "util.h"
+#include "time.h"
 #include "esp-alt-register.h"
 
 #include <user_interface.h>
@@ -13,9 +15,10 @@
 enum
 {
 	io_gpio_pin_size = 16,
-	io_gpio_pwm_max_channels = 4,
 };
 
+_Static_assert((unsigned int)io_gpio_pin_size <= (unsigned int)pwm_list_pins, "pwm list too small for the gpio pins");
+
 typedef enum
 {
 	io_gpio_func_gpio = 0,
@@ -65,8 +68,6 @@ typedef union
 
 	struct
 	{
-		int pwm_this;
-		int pwm_next;
 		unsigned int pwm_duty;
 	} pwm;
 } gpio_data_pin_t;
@@ -134,6 +135,7 @@ pwm_delay_t pwm_delay_entry[pwm_table_delay_size] =
 };
 
 static void pwm_go(void);
+static void pwm_go_pin(unsigned int pin);
 
 // set GPIO direction
 
@@ -335,29 +337,28 @@ static void pdm_enable(_Bool onoff)
 	write_peri_reg(gpio_pdm_reg, regval);
 }
 
-// PWM
-
-typedef struct
+static void pdm_set_duty(unsigned int value)
 {
-	uint32_t	phase_duty;
-	uint32_t	phase_delay;
-	uint16_t	phase_active_pins_clear_mask;
-} pwm_phase_t;
+	unsigned int prescale;
 
-assert_size(pwm_phase_t, 12);
+	if(value > 255)
+		value = 255;
 
-typedef struct
-{
-	uint32_t		amount_phases;
-	uint32_t		static_pins_on_mask;
-	uint32_t		static_pins_off_mask;
-	uint32_t		active_pins_all_set_mask;
-	uint32_t		active_pins_noduty1_set_mask;	// special case for duty is 1 period, only set intermittently
-	uint32_t		active_pins_duty1_clear_mask;	// special case for duty is 1 period, clear immediately after set
-	pwm_phase_t		phase[io_gpio_pwm_max_channels + 1];
-} pwm_phases_t;
+	prescale = 0;
+
+	if(value > 0)
+	{
+		if(value < 128)
+			prescale = (value * 2) - 1;
+		else
+			prescale = 256 - (value * 2) - 1;
+	}
 
-assert_size(pwm_phases_t, 84);
+	pdm_set_prescale(prescale);
+	pdm_set_target(value);
+}
+
+// PWM
 
 typedef struct
 {
@@ -368,9 +369,23 @@ typedef struct
 
 static unsigned int		pwm_current_phase_set;
 static pwm_phases_t		pwm_phase[2];
+static pwm_phases_t		pwm_phase_shadow;
 static io_gpio_flags_t	io_gpio_flags;
 
-static int pwm_head;
+/*
+ * The pins with a duty between off and on are kept in a list sorted by duty
+ * (pwm_list), the pins that are fully off or fully on are in the static masks.
+ * A duty change only moves the changed pin in the list and in the phases (pwm_phase_shadow,
+ * always up to date, copied into the set handed to the isr), the phases are only
+ * built from scratch when a pin is configured, the width changes or the pins don't fit.
+ *
+ * With the pwm1-spread flag, the first pin that doesn't fit in the isr's phases is
+ * driven by the sigma-delta generator instead, at 8 bits, unless a pwm2 pin uses it.
+ * There is only one generator, so that's one extra channel.
+ */
+
+static pwm_list_t pwm_list = { .head = -1 };
+static int pwm_pdm_pin = -1;
 static unsigned int pwm1_width;
 
 static void pwm_isr(void);
@@ -453,6 +468,44 @@ attr_pure unsigned int io_gpio_pwm1_width_get(void)
 	return(pwm1_width);
 }
 
+// share of the cpu the pwm isr used during the last second, in 1/1000
+
+static unsigned int pwm_isr_load_permille;
+
+unsigned int io_gpio_pwm_isr_load(unsigned int *isr_channels, unsigned int *pdm_channels)
+{
+	*isr_channels = __builtin_popcount(pwm_phase[pwm_current_phase_set].active_pins_all_set_mask);
+	*pdm_channels = (pwm_pdm_pin >= 0) ? 1 : 0;
+
+	return(pwm_isr_load_permille);
+}
+
+/*
+ * The isr only adds to the 32 bits counter (a single store, so it can be read while the isr runs),
+ * the load is taken from the difference once a second, unsigned subtraction takes care of the wrap.
+ * A second is at most 160 M cycles, well within 32 bits.
+ */
+
+void io_gpio_periodic_slow(int io, const struct io_info_entry_T *info, io_data_entry_t *data, io_flags_t *flags)
+{
+	static uint32_t previous_cycles = 0;
+	static uint64_t previous_us = 0;
+	uint64_t now_us;
+	uint32_t cycles;
+
+	now_us = time_get_us();
+
+	if((now_us - previous_us) < 1000000)
+		return;
+
+	cycles = stat_pwm_isr_cycles;
+
+	pwm_isr_load_permille = (uint64_t)(cycles - previous_cycles) * 1000 / ((now_us - previous_us) * (config_flags_match(flag_cpu_high_speed) ? 160 : 80));
+
+	previous_cycles = cycles;
+	previous_us = now_us;
+}
+
 static void pwm_isr_setup(void)
 {
 	NmiTimSetFunc(pwm_isr);
@@ -490,13 +543,11 @@ attr_inline uint32_t pwm_timer_get(void)
 	return(read_peri_reg(TIMER0_COUNT_REG));
 }
 
-iram static void pwm_isr(void)
+attr_inline void pwm_isr_run(void)
 {
 	static unsigned int	phase, ticks_to_next_phase;
 	const pwm_phases_t *current_phase_set;
 
-	stat_pwm_timer_interrupts++;
-
 	if(!pwm_isr_enabled())
 	{
 		stat_pwm_timer_interrupts_while_nmi_masked++;
@@ -555,175 +606,115 @@ iram static void pwm_isr(void)
 	}
 }
 
-iram static void pwm_go(void)
+// the cycles include the busy waits for short phases, that's the cpu time the isr takes
+
+iram static void pwm_isr(void)
 {
-	io_config_pin_entry_t *pin1_config;
-	gpio_info_t *pin1_info;
-	gpio_data_pin_t *pin1_data, *pin2_data, *pin3_data;
-	int pin1, pin2, pin3;
-	pwm_phases_t *phase_data;
-	unsigned int duty, delta, new_phase_set;
-	uint32_t timer_value;
-	_Bool isr_enabled;
+	uint32_t start;
 
-	isr_enabled = pwm_isr_enabled();
-	pwm_isr_enable(false);
-	timer_value = pwm_timer_get();
+	start = ccount();
+	stat_pwm_timer_interrupts++;
 
-	if(timer_value < 32)
-		timer_value = 32;
+	pwm_isr_run();
 
-	if(timer_value > pwm1_period())
-		timer_value = pwm1_period();
+	stat_pwm_isr_cycles += ccount() - start;
+}
 
-	// if next set is already active or ISR is off, suspend ISR and re-configure current set
+iram static void pwm_pin_insert(unsigned int pin)
+{
+	if(gpio_data[pin].pwm.pwm_duty >= pwm1_period())
+		gpio_data[pin].pwm.pwm_duty = pwm1_period() - 1;
 
-	if(io_gpio_flags.pwm_next_phase_set || !isr_enabled)
-		new_phase_set = pwm_current_phase_set;
-	else // configure new set, release ISR using current set
-	{
-		new_phase_set = (pwm_current_phase_set + 1) & 0x01;
-		pwm_timer_set(timer_value);
-		pwm_isr_enable(true);
-	}
+	pwm_list_insert(&pwm_list, pin, gpio_data[pin].pwm.pwm_duty, pwm1_period());
+}
 
-	pwm_head = -1;
+iram static void pwm_list_build(void)
+{
+	unsigned int pin;
 
-	// reset linked list
+	pwm_list_clear(&pwm_list);
 
-	for(pin1 = 0; pin1 < io_gpio_pin_size; pin1++)
-	{
-		pin1_config	= &io_config[io_id_gpio][pin1];
-		pin1_info	= &gpio_info_table[pin1];
-		pin1_data	= &gpio_data[pin1];
+	for(pin = 0; pin < io_gpio_pin_size; pin++)
+		if(gpio_info_table[pin].valid && (io_config[io_id_gpio][pin].llmode == io_pin_ll_output_pwm1))
+			pwm_pin_insert(pin);
+}
 
-		if((pin1_info->valid) &&
-				(pin1_config->llmode == io_pin_ll_output_pwm1))
-		{
-			pin1_data->pwm.pwm_this = pin1;
-			pin1_data->pwm.pwm_next = -1;
+static _Bool pwm_pdm_available(void)
+{
+	unsigned int pin;
 
-			if(pin1_data->pwm.pwm_duty >= pwm1_period())
-				pin1_data->pwm.pwm_duty = pwm1_period() - 1;
-		}
-	}
+	if(!config_flags_match(flag_pwm1_spread))
+		return(false);
 
-	// create linked list
+	for(pin = 0; pin < io_gpio_pin_size; pin++)
+		if(gpio_info_table[pin].valid && (io_config[io_id_gpio][pin].llmode == io_pin_ll_output_pwm2))
+			return(false);
 
-	phase_data = &pwm_phase[new_phase_set];
-	phase_data->static_pins_off_mask = 0;
-	phase_data->static_pins_on_mask = 0;
+	return(true);
+}
 
-	for(pin1 = 0; pin1 < io_gpio_pin_size; pin1++)
+static void pwm_pdm_route(int pin)
+{
+	if(pin != pwm_pdm_pin)
 	{
-		pin1_info	= &gpio_info_table[pin1];
-		pin1_config	= &io_config[io_id_gpio][pin1];
-		pin1_data	= &gpio_data[pin1];
+		if(pwm_pdm_pin >= 0)
+			gpio_enable_pdm(pwm_pdm_pin, false);
 
-		if(!pin1_info->valid || (pin1_config->llmode != io_pin_ll_output_pwm1))
-			continue;
+		if((pin >= 0) && (pwm_pdm_pin < 0))
+			pdm_enable(true);
 
-		if(pin1_data->pwm.pwm_duty == 0)
-			phase_data->static_pins_off_mask |= 1 << pin1;
-		else
-			if((pin1_data->pwm.pwm_duty + 1) >= pwm1_period())
-				phase_data->static_pins_on_mask |= 1 << pin1;
-			else
-				if(pwm_head < 0)
-				{
-					pwm_head = pin1;
-					pin1_data->pwm.pwm_next = -1;
-				}
-				else
-				{
-					pin2 = pwm_head;
-					pin2_data = &gpio_data[pin2];
+		if((pin < 0) && (pwm_pdm_pin >= 0))
+			pdm_enable(false);
 
-					if(pin2_data->pwm.pwm_duty > pin1_data->pwm.pwm_duty)
-					{
-						pwm_head = pin1;
-						pin1_data->pwm.pwm_next = pin2;
-					}
-					else
-					{
-						for(pin2 = pwm_head; pin2 >= 0; pin2 = pin3)
-						{
-							pin2_data	= &gpio_data[pin2];
-							pin3		= pin2_data->pwm.pwm_next;
-
-							if(pin3 < 0)
-							{
-								pin1_data->pwm.pwm_next = -1;
-								pin2_data->pwm.pwm_next = pin1;
-
-								break;
-							}
-							else
-							{
-								pin3_data = &gpio_data[pin3];
-
-								if(pin3_data->pwm.pwm_duty > pin1_data->pwm.pwm_duty)
-								{
-									pin1_data->pwm.pwm_next = pin3;
-									pin2_data->pwm.pwm_next = pin1;
-
-									break;
-								}
-							}
-						}
-					}
-				}
+		if(pin >= 0)
+			gpio_enable_pdm(pin, true);
+
+		pwm_pdm_pin = pin;
 	}
 
-	phase_data->phase[0].phase_duty = 0;
-	phase_data->phase[0].phase_delay = 0;
-	phase_data->phase[0].phase_active_pins_clear_mask = 0x0000;
-	phase_data->amount_phases = 1;
-	phase_data->active_pins_all_set_mask = 0x0000;
-	phase_data->active_pins_noduty1_set_mask = 0x0000;
-	phase_data->active_pins_duty1_clear_mask = 0x0000;
+	if(pin >= 0)
+		pdm_set_duty(((gpio_data[pin].pwm.pwm_duty << 8) >> pwm1_width) | 0x01);
+}
 
-	for(pin1 = pwm_head, duty = 0; (phase_data->amount_phases < (io_gpio_pwm_max_channels + 1)) && (pin1 >= 0); pin1 = pin1_data->pwm.pwm_next)
-	{
-		pin1_data = &gpio_data[pin1];
+// update the phases for the moved pin (or build them for pin -1) and hand them to the isr,
+// the phases are made before the isr is held, then only a copy is done while it's held
 
-		delta = pin1_data->pwm.pwm_duty - duty;
-		duty = pin1_data->pwm.pwm_duty;
+iram static void pwm_commit(int pin)
+{
+	int pdm_pin;
+	unsigned int new_phase_set;
+	uint32_t timer_value;
+	_Bool isr_enabled, extend;
 
-		/*
-		 * treat pins with duty == 1 specially:
-		 * 	- add it to the duty1_clear_mask, so it gets cleared immediately
-		 * 	  after settings to ensure the smallest "on time"
-		 *  - if pwm1_extended is set, don't add it to the noduty1_set_mask,
-		 *    so it only gets set intermittently, to realise an even smaller
-		 *    duty cycle, using an effectively lower refresh cycle
-		 */
+	extend = config_flags_match(flag_pwm1_extend);
 
-		phase_data->active_pins_all_set_mask |= 1 << pin1;
-		phase_data->active_pins_noduty1_set_mask |= 1 << pin1;
+	if((pin < 0) || !pwm_phases_update(&pwm_phase_shadow, &pwm_list, pin, pwm1_period(), extend))
+		pdm_pin = pwm_phases_build(&pwm_phase_shadow, &pwm_list, pwm1_period(), extend, pwm_pdm_available());
+	else
+		pdm_pin = -1;
 
-		if(duty == 1)
-		{
-			phase_data->active_pins_duty1_clear_mask |= 1 << pin1;
+	isr_enabled = pwm_isr_enabled();
+	pwm_isr_enable(false);
+	timer_value = pwm_timer_get();
 
-			if(config_flags_match(flag_pwm1_extend))
-				phase_data->active_pins_noduty1_set_mask &= ~(1 << pin1);
-		}
+	if(timer_value < 32)
+		timer_value = 32;
 
-		if(delta != 0)
-		{
-			phase_data->phase[phase_data->amount_phases - 1].phase_delay = delta;
-			phase_data->phase[phase_data->amount_phases].phase_duty = pin1_data->pwm.pwm_duty;
-			phase_data->phase[phase_data->amount_phases].phase_delay = pwm1_period() - 1 - pin1_data->pwm.pwm_duty;
-			phase_data->phase[phase_data->amount_phases].phase_active_pins_clear_mask = 1 << pin1;
-			phase_data->amount_phases++;
-		}
-		else
-			phase_data->phase[phase_data->amount_phases - 1].phase_active_pins_clear_mask |= 1 << pin1;
+	if(timer_value > pwm1_period())
+		timer_value = pwm1_period();
+
+	// if next set is already active or ISR is off, suspend ISR and re-configure current set
+
+	if(io_gpio_flags.pwm_next_phase_set || !isr_enabled)
+		new_phase_set = pwm_current_phase_set;
+	else // configure new set, release ISR using current set
+	{
+		new_phase_set = (pwm_current_phase_set + 1) & 0x01;
+		pwm_timer_set(timer_value);
+		pwm_isr_enable(true);
 	}
 
-	if(phase_data->amount_phases < 2)
-		phase_data->amount_phases = 0;
+	pwm_phase[new_phase_set] = pwm_phase_shadow;
 
 	if(new_phase_set == pwm_current_phase_set)
 	{
@@ -737,6 +728,21 @@ iram static void pwm_go(void)
 		io_gpio_flags.pwm_reset_phase_set = 0;
 		io_gpio_flags.pwm_next_phase_set = 1;
 	}
+
+	pwm_pdm_route(pdm_pin);
+}
+
+iram static void pwm_go(void)
+{
+	pwm_list_build();
+	pwm_commit(-1);
+}
+
+iram static void pwm_go_pin(unsigned int pin)
+{
+	pwm_list_remove(&pwm_list, pin);
+	pwm_pin_insert(pin);
+	pwm_commit(pin);
 }
 
 // other
@@ -762,6 +768,7 @@ io_error_t io_gpio_init(const struct io_info_entry_T *info)
 
 	pwm_phase[0].amount_phases = 0;
 	pwm_phase[1].amount_phases = 0;
+	pwm_phase_shadow.amount_phases = 0;
 
 	gpio_init();
 	pwm_isr_setup();
@@ -882,6 +889,11 @@ io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_info_e
 		return(io_error);
 	}
 
+	pwm_list_remove(&pwm_list, pin);
+
+	if(pin == pwm_pdm_pin)
+		pwm_pdm_route(-1);
+
 	gpio_func_select(pin, io_gpio_func_gpio);
 	gpio_pin_intr_state_set(pin, GPIO_PIN_INTR_DISABLE);
 
@@ -928,6 +940,11 @@ io_error_t io_gpio_init_pin_mode(string_t *error_message, const struct io_info_e
 
 		case(io_pin_ll_output_pwm2):
 		{
+			// the generator now belongs to this pin, move a spread pwm1 channel back to the isr
+
+			if(pwm_pdm_pin >= 0)
+				pwm_go();
+
 			gpio_direction(pin, true);
 			gpio_enable_open_drain(pin, false);
 			gpio_set(pin, false);
@@ -1224,7 +1241,7 @@ io_error_t io_gpio_write_pin(string_t *error_message, const struct io_info_entry
 			if(gpio_pin_data->pwm.pwm_duty != value)
 			{
 				gpio_pin_data->pwm.pwm_duty = value;
-				pwm_go();
+				pwm_go_pin(pin);
 			}
 
 			break;
@@ -1232,26 +1249,8 @@ io_error_t io_gpio_write_pin(string_t *error_message, const struct io_info_entry
 
 		case(io_pin_ll_output_pwm2):
 		{
-			unsigned int prescale, target;
-
 			gpio_pin_data->pwm.pwm_duty = value;
-
-			if(value > 255)
-				value = 255;
-
-			prescale = 0;
-			target = value;
-
-			if(value > 0)
-			{
-				if(value < 128)
-					prescale = (target * 2) - 1;
-				else
-					prescale = 256 - (target * 2) - 1;
-			}
-
-			pdm_set_prescale(prescale);
-			pdm_set_target(target);
+			pdm_set_duty(value);
 
 			break;
 		}
@@ -8,6 +8,7 @@
 #include <eagle_soc.h>
 
 void			io_gpio_reset_all_pins(void);
+void			io_gpio_periodic_slow(int io, const struct io_info_entry_T *, io_data_entry_t *, io_flags_t *);
 void			io_gpio_periodic_fast(int io, const struct io_info_entry_T *, io_data_entry_t *, io_flags_t *);
 io_error_t		io_gpio_init(const struct io_info_entry_T *);
 unsigned int	io_gpio_pin_max_value(const struct io_info_entry_T *, io_data_pin_entry_t *, const io_config_pin_entry_t *, unsigned int pin);
@@ -18,6 +19,7 @@ io_error_t		io_gpio_write_pin(string_t *, const struct io_info_entry_T *, io_dat
 int				io_gpio_get_uart_from_pin(unsigned int pin);
 _Bool			io_gpio_pwm1_width_set(unsigned int period, _Bool load, _Bool save);
 unsigned int	io_gpio_pwm1_width_get(void);
+unsigned int	io_gpio_pwm_isr_load(unsigned int *isr_channels, unsigned int *pdm_channels);
 
 // generic
 
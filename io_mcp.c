@@ -1,6 +1,7 @@
 #include "io_mcp.h"
 #include "i2c.h"
 #include "util.h"
+#include "dispatch.h"
 
 #include <user_interface.h>
 
@@ -26,6 +27,7 @@ enum
 
 static uint8_t pin_output_cache[io_mcp_instance_size][2];
 static mcp_data_pin_t mcp_data_pin_table[io_mcp_instance_size][16];
+static _Bool intf_queued[io_mcp_instance_size];
 
 attr_inline int IODIR(int s)		{ return(0x00 + s);	}
 attr_inline int IPOL(int s)			{ return(0x02 + s);	}
@@ -168,17 +170,16 @@ attr_pure unsigned int io_mcp_pin_max_value(const struct io_info_entry_T *info,
 	return(value);
 }
 
-void io_mcp_periodic_slow(int io, const struct io_info_entry_T *info, io_data_entry_t *data, io_flags_t *flags)
+// the interrupt flags and captures are read through the i2c transfer queue, the counters are updated when it completes
+
+static _Bool intf_update(const struct io_info_entry_T *info, const uint8_t *i2c_buffer)
 {
-	uint8_t i2c_buffer[4];
 	unsigned int intf[2];
 	unsigned int intcap[2];
 	unsigned int pin, bank, bankpin;
 	mcp_data_pin_t *mcp_pin_data;
 	io_config_pin_entry_t *pin_config;
-
-	if(i2c_send1_receive(info->address, INTF(0), sizeof(i2c_buffer), i2c_buffer) != i2c_error_ok) // INTFA, INTFB, INTCAPA, INTCAPB
-		return;
+	_Bool counter_triggered = false;
 
 	intf[0] = i2c_buffer[0];
 	intf[1] = i2c_buffer[1];
@@ -191,7 +192,7 @@ void io_mcp_periodic_slow(int io, const struct io_info_entry_T *info, io_data_en
 		bankpin = pin & 0x07;
 
 		mcp_pin_data = &mcp_data_pin_table[info->instance][pin];
-		pin_config = &io_config[io][pin];
+		pin_config = &io_config[info->id][pin];
 
 		if(pin_config->llmode == io_pin_ll_counter)
 		{
@@ -208,11 +209,57 @@ void io_mcp_periodic_slow(int io, const struct io_info_entry_T *info, io_data_en
 				{
 					mcp_pin_data->counter++;
 					mcp_pin_data->debounce = pin_config->speed;
-					flags->counter_triggered = 1;
+					counter_triggered = true;
 				}
 			}
 		}
 	}
+
+	return(counter_triggered);
+}
+
+static void intf_done(const i2c_transfer_t *transfer)
+{
+	const struct io_info_entry_T *info = (const struct io_info_entry_T *)transfer->context;
+
+	intf_queued[info->instance] = false;
+
+	if(transfer->error != i2c_error_ok)
+		return;
+
+	if(intf_update(info, transfer->receive_data))
+		dispatch_post_command(command_task_alert_status);
+}
+
+void io_mcp_periodic_slow(int io, const struct io_info_entry_T *info, io_data_entry_t *data, io_flags_t *flags)
+{
+	i2c_transfer_t transfer;
+	uint8_t i2c_buffer[4];
+
+	if(intf_queued[info->instance])
+		return;
+
+	transfer.bus = 0;
+	transfer.address = info->address;
+	transfer.send_length = 1;
+	transfer.send_data[0] = INTF(0); // INTFA, INTFB, INTCAPA, INTCAPB
+	transfer.receive_length = sizeof(i2c_buffer);
+	transfer.done_fn = intf_done;
+	transfer.context = (void *)info;
+
+	if(i2c_transfer_queue(&transfer))
+	{
+		intf_queued[info->instance] = true;
+		return;
+	}
+
+	// queue full, read directly
+
+	if(i2c_send1_receive(info->address, INTF(0), sizeof(i2c_buffer), i2c_buffer) != i2c_error_ok)
+		return;
+
+	if(intf_update(info, i2c_buffer))
+		flags->counter_triggered = 1;
 }
 
 io_error_t io_mcp_init_pin_mode(string_t *error_message, const struct io_info_entry_T *info, io_data_pin_entry_t *pin_data, const io_config_pin_entry_t *pin_config, int pin)
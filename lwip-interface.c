@@ -75,9 +75,16 @@ _Bool attr_nonnull attr_pure lwip_if_received_udp(lwip_if_socket_t *socket)
 	return(socket->peer.port != 0);
 }
 
+static void process_pending(lwip_if_socket_t *socket);
+
 attr_nonnull void lwip_if_receive_buffer_unlock(lwip_if_socket_t *socket)
 {
 	socket->receive_buffer_locked = 0;
+
+	if(string_empty(socket->receive_buffer))
+		socket->owner = -1;
+
+	process_pending(socket);
 }
 
 attr_nonnull attr_pure _Bool lwip_if_send_buffer_locked(lwip_if_socket_t *socket)
@@ -85,46 +92,298 @@ attr_nonnull attr_pure _Bool lwip_if_send_buffer_locked(lwip_if_socket_t *socket
 	return((socket->sending_remaining > 0) || (socket->sent_remaining > 0));
 }
 
-static void received_callback(_Bool tcp, lwip_if_socket_t *socket, struct pbuf *pbuf_received, const ip_addr_t *address, u16_t port)
+/*
+ * The receive and send buffers are shared between all slots (tcp connections
+ * and udp peers). The receive buffer belongs to one slot from the first byte
+ * of a request until the request has been processed, data for other slots is
+ * held in the slot (without acknowledging it to the tcp peer) until it's their turn.
+ * When the owner has only sent part of a request and another slot has data waiting,
+ * the partial request is moved back to the owner's slot ("parked") and the buffer is
+ * handed on, the owner gets its turn again when more data for it arrives.
+ * Switching the tcp connection replies are sent on, requires the send buffer to be idle.
+ */
+
+static _Bool slot_deliverable(const lwip_if_slot_t *slot)
 {
-	struct pbuf *pbuf;
-	unsigned int length;
+	return(slot->pbuf_pending && (((const struct pbuf *)slot->pbuf_pending)->tot_len > slot->parked));
+}
+
+static _Bool receive_available(const lwip_if_socket_t *socket, const lwip_if_slot_t *slot)
+{
+	int ix = slot - socket->slot;
 
 	if(socket->receive_buffer_locked)
+		return(false);
+
+	if(!string_empty(socket->receive_buffer) && (socket->owner != ix))
+		return(false);
+
+	if(string_length(socket->receive_buffer) >= string_size(socket->receive_buffer))
+		return(false);
+
+	if(slot->pcb && (slot->pcb != socket->tcp.pcb) && ((socket->sending_remaining > 0) || (socket->sent_remaining > 0)))
+		return(false);
+
+	return(true);
+}
+
+// drop length bytes from the start of a pbuf chain, return what's left
+
+static struct pbuf *pbuf_skip_bytes(struct pbuf *pbuf, unsigned int length)
+{
+	struct pbuf *next;
+
+	while(pbuf && (length >= pbuf->len))
 	{
-		log("received callback: %s: receive buffer locked\n", tcp ? "tcp" : "udp");
-		return;
+		length -= pbuf->len;
+		next = pbuf->next;
+		pbuf->next = (struct pbuf *)0;
+		pbuf->tot_len = pbuf->len;
+		pbuf_free(pbuf);
+		pbuf = next;
 	}
 
+	if(pbuf && (length > 0))
+		pbuf_header(pbuf, 0 - (s16_t)length);
+
+	return(pbuf);
+}
+
+static void deliver(lwip_if_socket_t *socket, lwip_if_slot_t *slot, struct pbuf *pbuf_received, const ip_addr_t *address, u16_t port)
+{
+	struct pbuf *pbuf;
+	unsigned int length, chunk, space, parked;
+
 	socket->peer.address = *address;
 	socket->peer.port = port;
+	socket->owner = slot - socket->slot;
+
+	if(slot->pcb)
+		socket->tcp.pcb = slot->pcb;
+
+	space = string_size(socket->receive_buffer) - string_length(socket->receive_buffer);
 
-	for(pbuf = pbuf_received, length = 0; pbuf; pbuf = pbuf->next)
+	for(pbuf = pbuf_received, length = 0; pbuf && (length < space); pbuf = pbuf->next)
 	{
-		length += pbuf->len;
-		string_append_bytes(socket->receive_buffer, pbuf->payload, pbuf->len);
+		chunk = pbuf->len;
+
+		if(chunk > (space - length))
+			chunk = space - length;
+
+		string_append_bytes(socket->receive_buffer, pbuf->payload, chunk);
+		length += chunk;
 	}
 
-    pbuf_free(pbuf_received);
+	// parked bytes have been acknowledged already, when they were first taken in
+
+	parked = (length < slot->parked) ? length : slot->parked;
+	slot->parked -= parked;
+
+	if(slot->pcb)
+	{
+		// tcp is a stream, keep what doesn't fit for later
+
+		if(length > parked)
+			tcp_recved((struct tcp_pcb *)slot->pcb, length - parked);
+
+		slot->pbuf_pending = pbuf_skip_bytes(pbuf_received, length);
+	}
+	else
+	{
+		pbuf_free(pbuf_received);
+		slot->parked = 0;
+	}
+
+	slot->requests++;
+	slot->last_active = system_get_time();
 
 	socket->receive_buffer_locked = 1;
 
 	socket->callback_data_received(socket, length);
 }
 
+// move a partial request out of the receive buffer when another slot is waiting for it
+
+static void park_partial(lwip_if_socket_t *socket)
+{
+	lwip_if_slot_t *owner;
+	struct pbuf *pbuf;
+	unsigned int ix, length;
+
+	if(socket->receive_buffer_locked || (socket->owner < 0) || string_empty(socket->receive_buffer))
+		return;
+
+	for(ix = 0; ix < socket->slots; ix++)
+		if((ix != (unsigned int)socket->owner) && slot_deliverable(&socket->slot[ix]))
+			break;
+
+	if(ix >= socket->slots)
+		return;
+
+	owner = &socket->slot[socket->owner];
+	length = string_length(socket->receive_buffer);
+
+	if(!(pbuf = pbuf_alloc(PBUF_RAW, length, PBUF_RAM)))
+		return;
+
+	pbuf_take(pbuf, string_buffer(socket->receive_buffer), length);
+
+	if(owner->pbuf_pending)
+		pbuf_cat(pbuf, (struct pbuf *)owner->pbuf_pending);
+
+	owner->pbuf_pending = pbuf;
+	owner->parked = length;
+
+	string_clear(socket->receive_buffer);
+	socket->owner = -1;
+}
+
+static void process_pending(lwip_if_socket_t *socket)
+{
+	lwip_if_slot_t *slot;
+	struct pbuf *pbuf;
+	unsigned int current, ix;
+
+	park_partial(socket);
+
+	for(current = 0; current < socket->slots; current++)
+	{
+		ix = (socket->slot_next + current) % socket->slots;
+		slot = &socket->slot[ix];
+
+		if(slot_deliverable(slot) && receive_available(socket, slot))
+		{
+			socket->slot_next = (ix + 1) % socket->slots;
+			pbuf = (struct pbuf *)slot->pbuf_pending;
+			slot->pbuf_pending = (struct pbuf *)0;
+
+			if(slot->pcb)
+				deliver(socket, slot, pbuf, IP_ADDR_ANY, 0);
+			else
+				deliver(socket, slot, pbuf, &slot->address, slot->port);
+
+			return;
+		}
+	}
+}
+
+static void slot_reset(lwip_if_slot_t *slot)
+{
+	slot->pcb = (struct tcp_pcb *)0;
+	slot->pbuf_pending = (struct pbuf *)0;
+	slot->parked = 0;
+	slot->address = ip_addr_any;
+	slot->port = 0;
+	slot->last_active = system_get_time();
+	slot->requests = 0;
+	slot->deferred = 0;
+	slot->dropped = 0;
+}
+
+static void slot_free(lwip_if_slot_t *slot)
+{
+	lwip_if_socket_t *socket = slot->socket;
+
+	if(slot->pbuf_pending)
+		pbuf_free((struct pbuf *)slot->pbuf_pending);
+
+	slot->pbuf_pending = (struct pbuf *)0;
+	slot->parked = 0;
+
+	if(slot->pcb && (slot->pcb == socket->tcp.pcb))
+	{
+		socket->tcp.pcb = (struct tcp_pcb *)0;
+		socket->sending_remaining = 0;
+		socket->sent_remaining = 0;
+		socket->send_timing = 0;
+	}
+
+	// discard partial request of this slot
+
+	if((socket->owner == (slot - socket->slot)) && !socket->receive_buffer_locked)
+	{
+		string_clear(socket->receive_buffer);
+		socket->owner = -1;
+	}
+
+	slot->pcb = (struct tcp_pcb *)0;
+	slot->port = 0;
+
+	process_pending(socket);
+}
+
+static lwip_if_slot_t *slot_find_udp(lwip_if_socket_t *socket, const ip_addr_t *address, u16_t port)
+{
+	lwip_if_slot_t *slot, *unused, *idle;
+	unsigned int ix;
+	uint32_t now = system_get_time();
+
+	for(ix = 0, unused = idle = (lwip_if_slot_t *)0; ix < socket->slots; ix++)
+	{
+		slot = &socket->slot[ix];
+
+		if(slot->pcb)
+			continue;
+
+		if((slot->port == port) && ip_addr_cmp(&slot->address, address))
+			return(slot);
+
+		if(!slot->port)
+		{
+			if(!unused)
+				unused = slot;
+		}
+		else
+			if(!slot->pbuf_pending && (!idle || ((now - slot->last_active) > (now - idle->last_active))))
+				idle = slot;
+	}
+
+	if(!(slot = unused ? unused : idle))
+		return((lwip_if_slot_t *)0);
+
+	slot_reset(slot);
+	slot->address = *address;
+	slot->port = port;
+
+	return(slot);
+}
+
 static void *udp_received_callback(void *callback_arg, struct udp_pcb *pcb, struct pbuf *pbuf_received, const ip_addr_t *address, u16_t port)
 {
 	lwip_if_socket_t *socket = (lwip_if_socket_t *)callback_arg;
+	lwip_if_slot_t *slot;
 
-	received_callback(false, socket, pbuf_received, address, port);
+	if(!(slot = slot_find_udp(socket, address, port)))
+	{
+		log("udp received callback: no free slot\n");
+		pbuf_free(pbuf_received);
+		return((void *)0);
+	}
+
+	if(!slot->pbuf_pending && receive_available(socket, slot))
+		deliver(socket, slot, pbuf_received, address, port);
+	else
+	{
+		if(slot->pbuf_pending) // udp can't hold more than one datagram per peer
+		{
+			slot->dropped++;
+			pbuf_free(pbuf_received);
+		}
+		else
+		{
+			slot->deferred++;
+			slot->pbuf_pending = pbuf_received;
+			process_pending(socket);
+		}
+	}
 
 	return((void *)0);
 }
 
 static err_t tcp_received_callback(void *callback_arg, struct tcp_pcb *pcb, struct pbuf *pbuf, err_t error)
 {
-	lwip_if_socket_t *socket = (lwip_if_socket_t *)callback_arg;
-	struct tcp_pcb **pcb_tcp = (struct pcb_tcp **)&socket->tcp.pcb;
+	lwip_if_slot_t *slot = (lwip_if_slot_t *)callback_arg;
+	lwip_if_socket_t *socket = slot->socket;
 
 	/* connection closed */
 	if((pcb == (struct tcp_pcb *)0) || (pbuf == (struct pbuf *)0))
@@ -138,18 +397,16 @@ static err_t tcp_received_callback(void *callback_arg, struct tcp_pcb *pcb, stru
 		if(pbuf)
 			pbuf_free(pbuf);
 
-		if(*pcb_tcp)
+		if(slot->pcb)
 		{
-			if((error = tcp_close(*pcb_tcp)) != ERR_OK)
+			if((error = tcp_close((struct tcp_pcb *)slot->pcb)) != ERR_OK)
 			{
 				log("tcp received callback: tcp close: error: ");
 				log_error(error);
 			}
 		}
 
-		*pcb_tcp = (struct pcb_tcp *)0;
-		socket->sending_remaining = 0;
-		socket->sent_remaining = 0;
+		slot_free(slot);
 		return(ERR_OK);
 	}
 
@@ -161,122 +418,221 @@ static err_t tcp_received_callback(void *callback_arg, struct tcp_pcb *pcb, stru
 		if(pbuf)
 			pbuf_free(pbuf);
 
-		if(*pcb_tcp)
-			tcp_abort(*pcb_tcp);
+		if(slot->pcb)
+			tcp_abort((struct tcp_pcb *)slot->pcb);
 
-		*pcb_tcp = (struct pcb_tcp *)0;
-		socket->sending_remaining = 0;
-		socket->sent_remaining = 0;
 		return(ERR_ABRT);
 	}
 
-	if(pcb != *pcb_tcp)
-		log("tcp received callback: pcb != *pcb_tcp\n");
+	if(pcb != slot->pcb)
+		log("tcp received callback: pcb != slot pcb\n");
 
-	received_callback(true, socket, pbuf, IP_ADDR_ANY, 0);
+	if(!slot->pbuf_pending && receive_available(socket, slot))
+		deliver(socket, slot, pbuf, IP_ADDR_ANY, 0);
+	else
+	{
+		slot->deferred++;
+
+		if(slot->pbuf_pending)
+			pbuf_cat((struct pbuf *)slot->pbuf_pending, pbuf);
+		else
+			slot->pbuf_pending = pbuf;
 
-	tcp_recved(pcb, pbuf->tot_len);
+		process_pending(socket);
+	}
 
 	return(ERR_OK);
 }
 
-static err_t tcp_sent_callback(void *callback_arg, struct tcp_pcb *pcb, u16_t len)
-{
-	lwip_if_socket_t *socket = (lwip_if_socket_t *)callback_arg;
-	err_t error = ERR_OK;
-	int apiflags, offset, chunk_size;
+/* queue as much of the send buffer as lwip accepts, one segment per tcp_write,
+ * limited by the send buffer space and the send queue length, the rest is queued from the sent callback */
 
-	if(len > socket->sent_remaining)
-	{
-		log("tcp sent callback: acked (%u) > sent_remaining (%u)\n", len, socket->sent_remaining);
-		socket->sent_remaining = 0;
-	}
-	else
-		socket->sent_remaining -= len;
-
-	if(socket->sent_remaining > 0)
-		return(ERR_OK);
+static err_t tcp_queue_send_buffer(lwip_if_socket_t *socket, struct tcp_pcb *pcb)
+{
+	err_t error;
+	int offset, chunk_size, apiflags;
 
-	if(socket->sending_remaining > 0)
+	while(socket->sending_remaining > 0)
 	{
-		apiflags = 0;
+		if(tcp_sndqueuelen(pcb) >= TCP_SND_QUEUELEN)
+			break;
 
 		chunk_size = socket->sending_remaining;
 
 		if(chunk_size > lwip_tcp_max_payload)
-		{
 			chunk_size = lwip_tcp_max_payload;
-			apiflags |= TCP_WRITE_FLAG_MORE;
-		}
 
+		if(chunk_size > tcp_sndbuf(pcb))
+			chunk_size = tcp_sndbuf(pcb);
+
+		if(chunk_size == 0)
+			break;
+
+		apiflags = (chunk_size < socket->sending_remaining) ? TCP_WRITE_FLAG_MORE : 0;
 		offset = string_length(socket->send_buffer) - socket->sending_remaining;
 
 		if((error = tcp_write(pcb, string_buffer(socket->send_buffer) + offset, chunk_size, apiflags)) != ERR_OK)
 		{
-			log("tcp sent callback: tcp_write error: ");
-			log_error(error);
-			goto error;
-		}
+			// ERR_MEM means the send queue is full after all, continue when data has been acked
 
-		if((error = tcp_output(pcb)) != ERR_OK)
-		{
-			log("tcp sent callback: tcp_output error: ");
+			if((error == ERR_MEM) && (socket->sent_remaining > 0))
+				break;
+
+			log("tcp queue send buffer: tcp_write error: ");
 			log_error(error);
-			goto error;
+			return(error);
 		}
 
-		socket->sent_remaining = chunk_size;
+		socket->sent_remaining += chunk_size;
 		socket->sending_remaining -= chunk_size;
 	}
 
+	if((error = tcp_output(pcb)) != ERR_OK)
+	{
+		log("tcp queue send buffer: tcp_output error: ");
+		log_error(error);
+		return(error);
+	}
+
 	return(ERR_OK);
+}
 
-error:
-	socket->sending_remaining = socket->sent_remaining = 0;
-	return(error);
+static void send_timing_done(lwip_if_socket_t *socket)
+{
+	unsigned int spent;
+
+	if(!socket->send_timing)
+		return;
+
+	socket->send_timing = 0;
+
+	spent = system_get_time() - socket->send_start_us;
+
+	stat_tcp_send_large++;
+	stat_tcp_send_ttlb_last_us = spent;
+	stat_tcp_send_ttlb_total_us += spent;
+
+	if(spent > stat_tcp_send_ttlb_max_us)
+		stat_tcp_send_ttlb_max_us = spent;
+}
+
+static err_t tcp_sent_callback(void *callback_arg, struct tcp_pcb *pcb, u16_t len)
+{
+	lwip_if_slot_t *slot = (lwip_if_slot_t *)callback_arg;
+	lwip_if_socket_t *socket = slot->socket;
+	err_t error;
+
+	if(len > socket->sent_remaining)
+	{
+		log("tcp sent callback: acked (%u) > sent_remaining (%u)\n", len, socket->sent_remaining);
+		socket->sent_remaining = 0;
+	}
+	else
+		socket->sent_remaining -= len;
+
+	if(socket->callback_data_sent)
+		socket->callback_data_sent(socket, len);
+
+	if((socket->sending_remaining > 0) && ((error = tcp_queue_send_buffer(socket, pcb)) != ERR_OK))
+	{
+		socket->sending_remaining = socket->sent_remaining = 0;
+		socket->send_timing = 0;
+		return(error);
+	}
+
+	if((socket->sending_remaining > 0) || (socket->sent_remaining > 0))
+		return(ERR_OK);
+
+	send_timing_done(socket);
+
+	if(!lwip_if_send_buffer_locked(socket))
+		process_pending(socket);
+
+	return(ERR_OK);
 }
 
 static void tcp_error_callback(void *callback_arg, err_t error)
 {
-	lwip_if_socket_t *socket = (lwip_if_socket_t *)callback_arg;
-	struct tcp_pcb **pcb_tcp = (struct pcb_tcp **)&socket->tcp.pcb;
+	lwip_if_slot_t *slot = (lwip_if_slot_t *)callback_arg;
+	lwip_if_socket_t *socket = slot->socket;
 
-	log("tcp error callback: socket %p, tcp pcb: %p, error: ", socket, *pcb_tcp);
+	log("tcp error callback: socket %p, slot %u, tcp pcb: %p, error: ", socket, slot - socket->slot, slot->pcb);
 	log_error(error);
 
 	if(socket->reboot_pending)
 		reset();
 
-	*pcb_tcp = (struct tcp_pcb *)0;
-	socket->sending_remaining = 0;
-	socket->sent_remaining = 0;
+	slot_free(slot);
 }
 
 static err_t tcp_accepted_callback(void *callback_arg, struct tcp_pcb *pcb, err_t error)
 {
 	lwip_if_socket_t *socket = (lwip_if_socket_t *)callback_arg;
-	struct tcp_pcb **pcb_tcp = (struct tcp_pcb **)&socket->tcp.pcb;
+	lwip_if_slot_t *slot, *unused, *idle, *oldest;
+	unsigned int ix;
+	uint32_t now = system_get_time();
 
 	if(error != ERR_OK)
 	{
-		log("tcp accepted callback: socket  %p, pcb: %p, tcp_pcb: %p, error: ", socket, pcb, *pcb_tcp);
+		log("tcp accepted callback: socket  %p, pcb: %p, tcp_pcb: %p, error: ", socket, pcb, socket->tcp.pcb);
 		log_error(error);
 	}
 
-	if(*pcb_tcp != (struct tcp_pcb *)0)
+	// prefer an unused slot, then an idle udp peer, otherwise drop the least recently active connection,
+	// but never the connection a request is being processed or a reply is being sent for,
+	// the rest of the reply would go to the new connection
+
+	for(ix = 0, unused = idle = oldest = (lwip_if_slot_t *)0; ix < socket->slots; ix++)
 	{
-		log("tcp accepted callback: abort current\n");
-		tcp_abort(*pcb_tcp);
+		slot = &socket->slot[ix];
+
+		if(slot->pcb)
+		{
+			if((slot->pcb == socket->tcp.pcb) && (socket->receive_buffer_locked || lwip_if_send_buffer_locked(socket)))
+				continue;
+
+			if(!oldest || ((now - slot->last_active) > (now - oldest->last_active)))
+				oldest = slot;
+		}
+		else
+		{
+			if(!slot->port)
+			{
+				if(!unused)
+					unused = slot;
+			}
+			else
+				if(!slot->pbuf_pending && (!idle || ((now - slot->last_active) > (now - idle->last_active))))
+					idle = slot;
+		}
 	}
 
-	*pcb_tcp = pcb;
+	if(!(slot = unused ? unused : idle))
+	{
+		if(!oldest)
+		{
+			log("tcp accepted callback: no free slot\n");
+			tcp_abort(pcb);
+			return(ERR_ABRT);
+		}
+
+		log("tcp accepted callback: abort slot %u\n", oldest - socket->slot);
+		slot = oldest;
+		tcp_abort((struct tcp_pcb *)slot->pcb);
+	}
 
-	tcp_nagle_disable(*pcb_tcp);
+	slot_reset(slot);
+	slot->pcb = pcb;
 
-	tcp_arg(*pcb_tcp, socket);
-	tcp_err(*pcb_tcp, tcp_error_callback);
-	tcp_recv(*pcb_tcp, tcp_received_callback);
-	tcp_sent(*pcb_tcp, tcp_sent_callback);
+	if(!socket->tcp.pcb)
+		socket->tcp.pcb = pcb;
+
+	tcp_nagle_disable(pcb);
+
+	tcp_arg(pcb, slot);
+	tcp_err(pcb, tcp_error_callback);
+	tcp_recv(pcb, tcp_received_callback);
+	tcp_sent(pcb, tcp_sent_callback);
 
 	return(ERR_OK);
 }
@@ -318,6 +674,12 @@ attr_nonnull _Bool lwip_if_send(lwip_if_socket_t *socket)
 {
 	err_t error;
 
+	if(!socket->send_buffer)
+	{
+		log("lwip if send: socket has no send buffer\n");
+		return(false);
+	}
+
 	/* this means the output buffer been changed+sent while it still was sending
 	 * very bad! */
 
@@ -375,7 +737,6 @@ attr_nonnull _Bool lwip_if_send(lwip_if_socket_t *socket)
 	else // received packet from TCP, reply using TCP
 	{
 		struct tcp_pcb *pcb_tcp = (struct pcb_tcp *)socket->tcp.pcb;
-		int chunk_size, apiflags;
 
 		if(pcb_tcp == (struct tcp_pcb *)0)
 		{
@@ -383,40 +744,98 @@ attr_nonnull _Bool lwip_if_send(lwip_if_socket_t *socket)
 			return(false);
 		}
 
-		apiflags = 0;
+		socket->sent_remaining = 0;
+		socket->sending_remaining = string_length(socket->send_buffer);
 
-		chunk_size = socket->sent_remaining = string_length(socket->send_buffer);
+		// only replies that don't fit in one segment are timed until the last byte is acked
 
-		if(chunk_size > lwip_tcp_max_payload)
+		socket->send_timing = socket->sending_remaining > lwip_tcp_max_payload ? 1 : 0;
+		socket->send_start_us = system_get_time();
+
+		if((error = tcp_queue_send_buffer(socket, pcb_tcp)) != ERR_OK)
 		{
-			chunk_size = lwip_tcp_max_payload;
-			apiflags |= TCP_WRITE_FLAG_MORE;
+			log("lwip if send: tcp send: error: ");
+			log_error(error);
+			goto error;
 		}
+	}
+
+	return(true);
+
+error:
+	socket->sending_remaining = 0;
+	socket->sent_remaining = 0;
+	socket->send_timing = 0;
+	return(false);
+}
+
+/* stream data without an intermediate send buffer, lwip copies the data into its own pbufs,
+ * so the caller can release it immediately, returns the amount of data accepted, -1 when not connected */
 
-		if((error = tcp_write(pcb_tcp, string_buffer(socket->send_buffer), chunk_size, apiflags)) != ERR_OK)
+attr_nonnull int lwip_if_send_copy(lwip_if_socket_t *socket, const char *data, unsigned int length)
+{
+	err_t error;
+
+	if(socket->sending_remaining > 0)
+		return(0);
+
+	if(socket->peer.port) // received packet from UDP, reply using UDP
+	{
+		struct udp_pcb *pcb_udp = (struct pcb_udp *)socket->udp.pcb;
+		struct pbuf *pbuf;
+
+		if(length > lwip_udp_max_payload)
+			length = lwip_udp_max_payload;
+
+		if(!(pbuf = pbuf_alloc(PBUF_TRANSPORT, length, PBUF_RAM)))
+			return(0);
+
+		memcpy(pbuf->payload, data, length);
+
+		if((error = udp_sendto(pcb_udp, pbuf, &socket->peer.address, socket->peer.port)) != ERR_OK)
 		{
-			log("lwip if send: tcp_send: error: ");
+			log("lwip if send copy: udp send failed: length: %u, error: ", length);
 			log_error(error);
-			goto error;
+		}
+
+		pbuf_free(pbuf);
+	}
+	else // received packet from TCP, reply using TCP
+	{
+		struct tcp_pcb *pcb_tcp = (struct pcb_tcp *)socket->tcp.pcb;
+
+		if(pcb_tcp == (struct tcp_pcb *)0)
+			return(-1);
+
+		if(length > tcp_sndbuf(pcb_tcp))
+			length = tcp_sndbuf(pcb_tcp);
+
+		if(length == 0)
+			return(0);
+
+		// ERR_MEM means the send queue is full, try again when data has been acked
+
+		if((error = tcp_write(pcb_tcp, data, length, TCP_WRITE_FLAG_COPY)) != ERR_OK)
+		{
+			if(error != ERR_MEM)
+			{
+				log("lwip if send copy: tcp_write: error: ");
+				log_error(error);
+			}
+
+			return(0);
 		}
 
 		if((error = tcp_output(pcb_tcp)) != ERR_OK)
 		{
-			log("lwip if send: tcp send: tcp_output: error: ");
+			log("lwip if send copy: tcp_output: error: ");
 			log_error(error);
-			goto error;
 		}
 
-		socket->sent_remaining = chunk_size;
-		socket->sending_remaining = string_length(socket->send_buffer) - chunk_size;
+		socket->sent_remaining += length;
 	}
 
-	return(true);
-
-error:
-	socket->sending_remaining = 0;
-	socket->sent_remaining = 0;
-	return(false);
+	return(length);
 }
 
 attr_nonnull _Bool lwip_if_reboot(lwip_if_socket_t *socket)
@@ -433,10 +852,11 @@ attr_nonnull _Bool lwip_if_reboot(lwip_if_socket_t *socket)
 	return(true);
 }
 
-attr_nonnull _Bool lwip_if_socket_create(lwip_if_socket_t *socket, string_t *receive_buffer, string_t *send_buffer,
-		unsigned int port, _Bool udp_term_empty, callback_data_received_fn_t callback_data_received)
+_Bool lwip_if_socket_create(lwip_if_socket_t *socket, string_t *receive_buffer, string_t *send_buffer,
+		unsigned int port, unsigned int slots, _Bool udp_term_empty, callback_data_received_fn_t callback_data_received)
 {
 	err_t error;
+	unsigned int ix;
 
 	socket->udp.pcb = (struct udp_pcb *)0;
 	socket->tcp.listen_pcb = (struct tcp_pcb *)0;
@@ -450,7 +870,19 @@ attr_nonnull _Bool lwip_if_socket_create(lwip_if_socket_t *socket, string_t *rec
 	socket->receive_buffer_locked = 0;
 	socket->reboot_pending = 0;
 	socket->udp_term_empty = udp_term_empty ? 1 : 0;
+	socket->send_timing = 0;
+	socket->send_start_us = 0;
 	socket->callback_data_received = callback_data_received;
+	socket->callback_data_sent = (callback_data_sent_fn_t)0;
+	socket->slots = ((slots > 0) && (slots <= lwip_if_slots_size)) ? slots : lwip_if_slots_size;
+	socket->owner = -1;
+	socket->slot_next = 0;
+
+	for(ix = 0; ix < lwip_if_slots_size; ix++)
+	{
+		socket->slot[ix].socket = socket;
+		slot_reset(&socket->slot[ix]);
+	}
 
 	if(!(socket->udp.pbuf_send = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_ROM)))
 	{
@@ -498,6 +930,11 @@ attr_nonnull _Bool lwip_if_socket_create(lwip_if_socket_t *socket, string_t *rec
 	return(true);
 }
 
+attr_nonnull void lwip_if_set_callback_data_sent(lwip_if_socket_t *socket, callback_data_sent_fn_t callback_data_sent)
+{
+	socket->callback_data_sent = callback_data_sent;
+}
+
 _Bool attr_nonnull lwip_if_join_mc(int o1, int o2, int o3, int o4)
 {
 	struct ip_info info;
@@ -514,3 +951,37 @@ _Bool attr_nonnull lwip_if_join_mc(int o1, int o2, int o3, int o4)
 
 	return(igmp_joingroup(&local_ip.ip_addr, &mc_ip.ip_addr) == ERR_OK);
 }
+
+attr_nonnull void lwip_if_stats(string_t *dst, const lwip_if_socket_t *socket)
+{
+	const lwip_if_slot_t *slot;
+	unsigned int ix;
+
+	for(ix = 0; ix < socket->slots; ix++)
+	{
+		slot = &socket->slot[ix];
+
+		string_format(dst, ">  slot %u: ", ix);
+
+		if(slot->pcb)
+		{
+			string_append(dst, "tcp ");
+			string_ip(dst, ((const struct tcp_pcb *)slot->pcb)->remote_ip);
+			string_format(dst, ":%u", ((const struct tcp_pcb *)slot->pcb)->remote_port);
+		}
+		else
+			if(slot->port)
+			{
+				string_append(dst, "udp ");
+				string_ip(dst, slot->address);
+				string_format(dst, ":%u", slot->port);
+			}
+			else
+				string_append(dst, "unused");
+
+		string_format(dst, "%s, requests: %u, deferred: %u, dropped: %u%s\n",
+				(socket->tcp.pcb && (slot->pcb == socket->tcp.pcb)) ? " (current)" : "",
+				slot->requests, slot->deferred, slot->dropped,
+				slot_deliverable(slot) ? ", pending" : (slot->pbuf_pending ? ", partial request" : ""));
+	}
+}
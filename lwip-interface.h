@@ -17,9 +17,31 @@
 
 #include "util.h"
 
+enum
+{
+	lwip_if_slots_size = 4,
+};
+
 struct _lwip_if_socket_t;
 
+typedef struct
+{
+	struct _lwip_if_socket_t *socket;
+	void			*pcb;			// tcp connection, 0 for udp peer or unused
+	void			*pbuf_pending;	// received while the receive buffer was busy
+	unsigned int	parked;			// bytes at the start of pbuf_pending that are a partial request already taken in
+	ip_addr_t		address;		// udp peer
+	unsigned int	port;			// udp peer, 0 for tcp connection or unused
+	uint32_t		last_active;
+	unsigned int	requests;
+	unsigned int	deferred;
+	unsigned int	dropped;
+} lwip_if_slot_t;
+
+assert_size(lwip_if_slot_t, 40);
+
 typedef void (*callback_data_received_fn_t)(struct _lwip_if_socket_t *, unsigned int);
+typedef void (*callback_data_sent_fn_t)(struct _lwip_if_socket_t *, unsigned int);
 
 typedef struct _lwip_if_socket_t
 {
@@ -40,6 +62,7 @@ typedef struct _lwip_if_socket_t
 		unsigned int receive_buffer_locked:1;
 		unsigned int reboot_pending:1;
 		unsigned int udp_term_empty:1;
+		unsigned int send_timing:1;
 	};
 
 	struct
@@ -52,21 +75,31 @@ typedef struct _lwip_if_socket_t
 	string_t	*send_buffer;
 	int			sending_remaining;
 	int			sent_remaining;
+	uint32_t	send_start_us;
 
 	callback_data_received_fn_t callback_data_received;
+	callback_data_sent_fn_t callback_data_sent;
+
+	unsigned int	slots;
+	int				owner;		// slot the contents of the receive buffer belong to, -1 = none
+	unsigned int	slot_next;	// round robin
+	lwip_if_slot_t	slot[lwip_if_slots_size];
 
 } lwip_if_socket_t;
 
-assert_size(lwip_if_socket_t, 48);
+assert_size(lwip_if_socket_t, 228);
 
 _Bool	attr_nonnull lwip_if_received_tcp(lwip_if_socket_t *);
 _Bool	attr_nonnull lwip_if_received_udp(lwip_if_socket_t *);
 void	attr_nonnull lwip_if_receive_buffer_unlock(lwip_if_socket_t *);
 _Bool	attr_nonnull lwip_if_send_buffer_locked(lwip_if_socket_t *);
 _Bool	attr_nonnull lwip_if_send(lwip_if_socket_t *socket);
+int		attr_nonnull lwip_if_send_copy(lwip_if_socket_t *socket, const char *data, unsigned int length);
 _Bool	attr_nonnull lwip_if_close(lwip_if_socket_t *socket);
 _Bool	attr_nonnull lwip_if_reboot(lwip_if_socket_t *socket);
-_Bool	attr_nonnull lwip_if_socket_create(lwip_if_socket_t *socket, string_t *receive_buffer, string_t *send_buffer,
-			unsigned int port, _Bool flag_udp_term_empty, callback_data_received_fn_t callback_data_received);
+_Bool	lwip_if_socket_create(lwip_if_socket_t *socket, string_t *receive_buffer, string_t *send_buffer,
+			unsigned int port, unsigned int slots, _Bool flag_udp_term_empty, callback_data_received_fn_t callback_data_received);
+void	attr_nonnull lwip_if_set_callback_data_sent(lwip_if_socket_t *socket, callback_data_sent_fn_t callback_data_sent);
 _Bool	attr_nonnull lwip_if_join_mc(int o1, int o2, int o3, int o4);
+void	attr_nonnull lwip_if_stats(string_t *dst, const lwip_if_socket_t *socket);
 #endif
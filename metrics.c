@@ -0,0 +1,73 @@
+#include "metrics.h"
+
+#include "util.h"
+#include "io.h"
+#include "stats.h"
+#include "i2c_sensor.h"
+
+/*
+ * Machine readable state (Prometheus text format) for scraping. Pin values are sampled
+ * in the background, sensor values come from the sensor cache, so a scrape never waits
+ * for an i2c transaction.
+ */
+
+static uint32_t io_snapshot[io_id_size][max_pins_per_io];
+static uint16_t io_snapshot_valid[io_id_size];
+
+void metrics_sample(void)
+{
+	const io_config_pin_entry_t *pin_config;
+	unsigned int io, pin;
+	uint32_t value;
+
+	for(io = 0; io < io_id_size; io++)
+	{
+		io_snapshot_valid[io] = 0;
+
+		for(pin = 0; pin < max_pins_per_io; pin++)
+		{
+			pin_config = &io_config[io][pin];
+
+			// don't let the scraper reset counters
+
+			if((pin_config->mode == io_pin_disabled) || (pin_config->mode == io_pin_trigger) ||
+					((pin_config->mode == io_pin_counter) && pin_config->flags.reset_on_read))
+				continue;
+
+			if(io_read_pin((string_t *)0, io, pin, &value) != io_ok)
+				continue;
+
+			io_snapshot[io][pin] = value;
+			io_snapshot_valid[io] |= 1 << pin;
+		}
+	}
+}
+
+// cursor 0 is the counters, then one io per cursor, then one sensor per cursor
+
+int metrics_render(string_t *dst, int cursor)
+{
+	unsigned int io, pin;
+
+	if(cursor == 0)
+	{
+		stats_metrics(dst);
+		return(1);
+	}
+
+	if(cursor <= io_id_size)
+	{
+		io = cursor - 1;
+
+		for(pin = 0; pin < max_pins_per_io; pin++)
+			if(io_snapshot_valid[io] & (1 << pin))
+				string_format(dst, "espiobridge_io_pin_value{io=\"%u\",pin=\"%u\"} %u\n", io, pin, io_snapshot[io][pin]);
+
+		return(cursor + 1);
+	}
+
+	if(!i2c_sensor_cache_metrics(dst, cursor - io_id_size - 1))
+		return(-1);
+
+	return(cursor + 1);
+}
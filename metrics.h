@@ -0,0 +1,9 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include "util.h"
+
+void	metrics_sample(void);
+int		metrics_render(string_t *dst, int cursor);
+
+#endif
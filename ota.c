@@ -3,6 +3,7 @@
 #include "config.h"
 #include "dispatch.h"
 #include "rboot-interface.h"
+#include "stats.h"
 
 #include <spi_flash.h>
 #include <user_interface.h>
@@ -301,7 +302,7 @@ static app_action_t flash_write_verify_(const string_t *src, string_t *dst, _Boo
 		else
 			string_append(dst, "ERROR flash-write");
 
-		string_append(dst, ": address should be divisible by flash sector size");
+		string_append(dst, ": address should be divisible by flash sector size\n");
 
 		return(app_action_error);
 	}
@@ -368,6 +369,141 @@ app_action_t application_function_flash_verify(const string_t *src, string_t *ds
 	return(flash_write_verify_(src, dst, true));
 }
 
+// LZSS as produced by espflash --compress: a flag byte precedes each group of eight items, bit set = literal byte,
+// bit clear = back reference of two bytes, 12 bits distance - 1 and 4 bits length - 3, length nibble 15 means
+// an extra byte follows that is added to the length. References point into the output, so no window buffer is needed.
+
+static int lzss_decompress(const string_t *src, int src_offset, int src_length, string_t *dst)
+{
+	const uint8_t *in, *in_end;
+	uint8_t *out, *out_start, *out_end;
+	unsigned int flags, bit, distance, run;
+
+	in = (const uint8_t *)string_buffer(src) + src_offset;
+	in_end = in + src_length;
+	out_start = out = (uint8_t *)string_buffer_nonconst(dst);
+	out_end = out + string_size(dst);
+
+	while(in < in_end)
+	{
+		flags = *in++;
+
+		for(bit = 0; (bit < 8) && (in < in_end); bit++, flags >>= 1)
+		{
+			if(flags & 0x01)
+			{
+				if(out >= out_end)
+					return(-1);
+
+				*out++ = *in++;
+				continue;
+			}
+
+			if((in + 2) > in_end)
+				return(-1);
+
+			distance = ((in[0] << 4) | (in[1] >> 4)) + 1;
+			run = (in[1] & 0x0f) + 3;
+			in += 2;
+
+			if(run == 18)
+			{
+				if(in >= in_end)
+					return(-1);
+
+				run += *in++;
+			}
+
+			if((distance > (unsigned int)(out - out_start)) || ((out + run) > out_end))
+				return(-1);
+
+			for(; run > 0; run--, out++)
+				*out = *(out - distance);
+		}
+	}
+
+	return(out - out_start);
+}
+
+static app_action_t flash_write_sector_(const string_t *src, string_t *dst, _Bool compressed)
+{
+	const char *cmdname = compressed ? "flash-write-sector-lz" : "flash-write-sector";
+	unsigned int address, length;
+	int data_offset, sector_length;
+
+	// flash-send + flash-write in one request, so the whole sector is acknowledged at once
+
+	if(string_size(&flash_sector_buffer) < SPI_FLASH_SEC_SIZE)
+	{
+		string_format(dst, "ERROR %s: flash sector buffer too small: %u\n", cmdname, string_size(&flash_sector_buffer));
+		return(app_action_error);
+	}
+
+	if(parse_uint(1, src, &address, 0, ' ') != parse_ok)
+	{
+		string_format(dst, "ERROR %s: address required\n", cmdname);
+		return(app_action_error);
+	}
+
+	if(parse_uint(2, src, &length, 0, ' ') != parse_ok)
+	{
+		string_format(dst, "ERROR %s: length required, address: %u\n", cmdname, address);
+		return(app_action_error);
+	}
+
+	if((length == 0) || (length > SPI_FLASH_SEC_SIZE))
+	{
+		string_format(dst, "ERROR %s: invalid length: %u, address: %u\n", cmdname, length, address);
+		return(app_action_error);
+	}
+
+	if((data_offset = string_sep(src, 0, 3, ' ')) < 0)
+	{
+		string_format(dst, "ERROR %s: missing data, address: %u\n", cmdname, address);
+		return(app_action_error);
+	}
+
+	if((string_length(src) - data_offset) != (int)length)
+	{
+		string_format(dst, "ERROR %s: data length mismatch: %d != %u, address: %u\n", cmdname, string_length(src) - data_offset, length, address);
+		return(app_action_error);
+	}
+
+	if(compressed)
+	{
+		if((sector_length = lzss_decompress(src, data_offset, length, &flash_sector_buffer)) < 0)
+		{
+			string_format(dst, "ERROR %s: invalid compressed data, address: %u\n", cmdname, address);
+			return(app_action_error);
+		}
+
+		stat_flash_compressed_bytes += length;
+		stat_flash_decompressed_bytes += sector_length;
+	}
+	else
+	{
+		string_splice(&flash_sector_buffer, 0, src, data_offset, length);
+		sector_length = length;
+	}
+
+	if(sector_length < SPI_FLASH_SEC_SIZE)
+		memset(string_buffer_nonconst(&flash_sector_buffer) + sector_length, 0xff, SPI_FLASH_SEC_SIZE - sector_length);
+
+	string_setlength(&flash_sector_buffer, SPI_FLASH_SEC_SIZE);
+
+	return(flash_write_verify_(src, dst, false));
+}
+
+app_action_t application_function_flash_write_sector(const string_t *src, string_t *dst)
+{
+	return(flash_write_sector_(src, dst, false));
+}
+
+app_action_t application_function_flash_write_sector_lz(const string_t *src, string_t *dst)
+{
+	return(flash_write_sector_(src, dst, true));
+}
+
 app_action_t application_function_flash_checksum(const string_t *src, string_t *dst)
 {
 	unsigned int address, current, length, done;
@@ -425,6 +561,72 @@ app_action_t application_function_flash_checksum(const string_t *src, string_t *
 	return(app_action_normal);
 }
 
+app_action_t application_function_flash_checksum_sectors(const string_t *src, string_t *dst)
+{
+	unsigned int address, sectors, sector, max_sectors;
+
+	SHA_CTX sha_context;
+	uint8_t sha_result[SHA_DIGEST_LENGTH];
+
+	// one digest per sector, so a client can find out which sectors differ in one round trip,
+	// the flash sector buffer is used as scratch buffer, dst holds the digests
+
+	if(string_size(&flash_sector_buffer) < SPI_FLASH_SEC_SIZE)
+	{
+		string_format(dst, "ERROR flash-checksum-sectors: flash sector buffer too small: %u\n", string_size(&flash_sector_buffer));
+		return(app_action_error);
+	}
+
+	if(parse_uint(1, src, &address, 0, ' ') != parse_ok)
+	{
+		string_append(dst, "ERROR flash-checksum-sectors: address required\n");
+		return(app_action_error);
+	}
+
+	if(parse_uint(2, src, &sectors, 0, ' ') != parse_ok)
+	{
+		string_append(dst, "ERROR flash-checksum-sectors: sector count required\n");
+		return(app_action_error);
+	}
+
+	if((address % SPI_FLASH_SEC_SIZE) != 0)
+	{
+		string_append(dst, "ERROR flash-checksum-sectors: address should be divisible by flash sector size\n");
+		return(app_action_error);
+	}
+
+	max_sectors = (string_size(dst) - 96) / ((SHA_DIGEST_LENGTH * 2) + 1);
+
+	if(sectors > max_sectors)
+		sectors = max_sectors;
+
+	string_format(dst, "OK flash-checksum-sectors: sectors: %u, from address: %u, checksums:", sectors, address);
+
+	// a sector that can't be read gets "error" instead of a digest, the client then sends it
+
+	for(sector = 0; sector < sectors; sector++)
+	{
+		system_soft_wdt_feed();
+
+		if(spi_flash_read(address + (sector * SPI_FLASH_SEC_SIZE), string_buffer_nonconst(&flash_sector_buffer), SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
+		{
+			string_append(dst, " error");
+			continue;
+		}
+
+		SHA1Init(&sha_context);
+		SHA1Update(&sha_context, string_buffer(&flash_sector_buffer), SPI_FLASH_SEC_SIZE);
+		SHA1Final(sha_result, &sha_context);
+
+		string_append(dst, " ");
+		string_bin_to_hex(dst, sha_result, SHA_DIGEST_LENGTH);
+	}
+
+	string_append(dst, "\n");
+
+	return(app_action_normal);
+}
+
 static app_action_t flash_select(const string_t *src, string_t *dst, _Bool once)
 {
 	const char *cmdname = once ? "flash-select-once" : "flash-select";
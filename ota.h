@@ -11,7 +11,10 @@ app_action_t application_function_flash_receive(const string_t *, string_t *);
 app_action_t application_function_flash_write(const string_t *, string_t *);
 app_action_t application_function_flash_read(const string_t *, string_t *);
 app_action_t application_function_flash_verify(const string_t *, string_t *);
+app_action_t application_function_flash_write_sector(const string_t *, string_t *);
+app_action_t application_function_flash_write_sector_lz(const string_t *, string_t *);
 app_action_t application_function_flash_checksum(const string_t *, string_t *);
+app_action_t application_function_flash_checksum_sectors(const string_t *, string_t *);
 app_action_t application_function_flash_select(const string_t *, string_t *);
 app_action_t application_function_flash_select_once(const string_t *, string_t *);
 #endif
@@ -0,0 +1,245 @@
+#include "pwm.h"
+
+void pwm_list_clear(pwm_list_t *list)
+{
+	list->head = -1;
+	list->active_mask = 0;
+	list->static_on_mask = 0;
+	list->static_off_mask = 0;
+}
+
+// duty must be below period
+
+iram void pwm_list_insert(pwm_list_t *list, unsigned int pin, unsigned int duty, unsigned int period)
+{
+	int previous, current;
+
+	list->duty[pin] = duty;
+
+	if(duty == 0)
+	{
+		list->static_off_mask |= 1 << pin;
+		return;
+	}
+
+	if((duty + 1) >= period)
+	{
+		list->static_on_mask |= 1 << pin;
+		return;
+	}
+
+	// pins with equal duty keep the order they were inserted in
+
+	for(previous = -1, current = list->head; current >= 0; previous = current, current = list->next[current])
+		if(list->duty[current] > duty)
+			break;
+
+	list->next[pin] = current;
+
+	if(previous < 0)
+		list->head = pin;
+	else
+		list->next[previous] = pin;
+
+	list->active_mask |= 1 << pin;
+}
+
+iram void pwm_list_remove(pwm_list_t *list, unsigned int pin)
+{
+	int previous, current;
+
+	list->static_off_mask &= ~(1 << pin);
+	list->static_on_mask &= ~(1 << pin);
+
+	if(!(list->active_mask & (1 << pin)))
+		return;
+
+	list->active_mask &= ~(1 << pin);
+
+	for(previous = -1, current = list->head; current >= 0; previous = current, current = list->next[current])
+	{
+		if(current == (int)pin)
+		{
+			if(previous < 0)
+				list->head = list->next[current];
+			else
+				list->next[previous] = list->next[current];
+
+			break;
+		}
+	}
+}
+
+// returns the first pin that didn't fit in the phases if spread is set, otherwise -1
+
+iram int pwm_phases_build(pwm_phases_t *phases, const pwm_list_t *list, unsigned int period, _Bool extend, _Bool spread)
+{
+	unsigned int duty, delta;
+	int pin, pdm_pin;
+
+	phases->static_pins_off_mask = list->static_off_mask;
+	phases->static_pins_on_mask = list->static_on_mask;
+	phases->phase[0].phase_duty = 0;
+	phases->phase[0].phase_delay = 0;
+	phases->phase[0].phase_active_pins_clear_mask = 0x0000;
+	phases->amount_phases = 1;
+	phases->active_pins_all_set_mask = 0x0000;
+	phases->active_pins_noduty1_set_mask = 0x0000;
+	phases->active_pins_duty1_clear_mask = 0x0000;
+
+	for(pin = list->head, duty = 0, pdm_pin = -1; pin >= 0; pin = list->next[pin])
+	{
+		// all phases are in use, only pins with the same duty as the last phase still fit
+
+		if((phases->amount_phases >= (pwm_max_channels + 1)) && (list->duty[pin] != duty))
+		{
+			if(spread && (pdm_pin < 0))
+				pdm_pin = pin;
+
+			continue;
+		}
+
+		delta = list->duty[pin] - duty;
+		duty = list->duty[pin];
+
+		/*
+		 * treat pins with duty == 1 specially:
+		 * 	- add it to the duty1_clear_mask, so it gets cleared immediately
+		 * 	  after settings to ensure the smallest "on time"
+		 *  - if pwm1_extended is set, don't add it to the noduty1_set_mask,
+		 *    so it only gets set intermittently, to realise an even smaller
+		 *    duty cycle, using an effectively lower refresh cycle
+		 */
+
+		phases->active_pins_all_set_mask |= 1 << pin;
+		phases->active_pins_noduty1_set_mask |= 1 << pin;
+
+		if(duty == 1)
+		{
+			phases->active_pins_duty1_clear_mask |= 1 << pin;
+
+			if(extend)
+				phases->active_pins_noduty1_set_mask &= ~(1 << pin);
+		}
+
+		if(delta != 0)
+		{
+			phases->phase[phases->amount_phases - 1].phase_delay = delta;
+			phases->phase[phases->amount_phases].phase_duty = duty;
+			phases->phase[phases->amount_phases].phase_delay = period - 1 - duty;
+			phases->phase[phases->amount_phases].phase_active_pins_clear_mask = 1 << pin;
+			phases->amount_phases++;
+		}
+		else
+			phases->phase[phases->amount_phases - 1].phase_active_pins_clear_mask |= 1 << pin;
+	}
+
+	if(phases->amount_phases < 2)
+		phases->amount_phases = 0;
+
+	return(pdm_pin);
+}
+
+/*
+ * Move one pin in phases that were built from the list before the pin was moved in the list.
+ * The pin is taken out of its phase, an emptied phase is merged into the previous one,
+ * then it's added to the phase with its new duty or a new phase is split off.
+ * Returns false if the result isn't what pwm_phases_build would make, i.e. a new phase
+ * is needed when all are in use, or a pin that didn't fit before may fit now;
+ * the phases are then left half way and must be built from scratch.
+ */
+
+iram _Bool pwm_phases_update(pwm_phases_t *phases, const pwm_list_t *list, unsigned int pin, unsigned int period, _Bool extend)
+{
+	unsigned int duty, phase, ix, delay;
+	uint32_t mask;
+
+	duty = list->duty[pin];
+	mask = 1 << pin;
+
+	if(phases->amount_phases == 0)
+	{
+		phases->phase[0].phase_duty = 0;
+		phases->phase[0].phase_delay = period - 1;
+		phases->phase[0].phase_active_pins_clear_mask = 0x0000;
+		phases->amount_phases = 1;
+	}
+
+	phases->static_pins_off_mask &= ~mask;
+	phases->static_pins_on_mask &= ~mask;
+
+	if(phases->active_pins_all_set_mask & mask)
+	{
+		for(phase = 1; phase < phases->amount_phases; phase++)
+			if(phases->phase[phase].phase_active_pins_clear_mask & mask)
+				break;
+
+		if(phase >= phases->amount_phases)
+			return(false);
+
+		phases->phase[phase].phase_active_pins_clear_mask &= ~mask;
+
+		if(phases->phase[phase].phase_active_pins_clear_mask == 0x0000)
+		{
+			phases->phase[phase - 1].phase_delay += phases->phase[phase].phase_delay;
+
+			for(ix = phase; (ix + 1) < phases->amount_phases; ix++)
+				phases->phase[ix] = phases->phase[ix + 1];
+
+			phases->amount_phases--;
+		}
+
+		phases->active_pins_all_set_mask &= ~mask;
+		phases->active_pins_noduty1_set_mask &= ~mask;
+		phases->active_pins_duty1_clear_mask &= ~mask;
+	}
+
+	if(list->static_off_mask & mask)
+		phases->static_pins_off_mask |= mask;
+	else
+		if(list->static_on_mask & mask)
+			phases->static_pins_on_mask |= mask;
+		else
+			if(list->active_mask & mask)
+			{
+				for(phase = 1; (phase < phases->amount_phases) && (phases->phase[phase].phase_duty < duty); phase++)
+					;
+
+				if((phase < phases->amount_phases) && (phases->phase[phase].phase_duty == duty))
+					phases->phase[phase].phase_active_pins_clear_mask |= mask;
+				else
+				{
+					if(phases->amount_phases >= (pwm_max_channels + 1))
+						return(false);
+
+					for(ix = phases->amount_phases; ix > phase; ix--)
+						phases->phase[ix] = phases->phase[ix - 1];
+
+					delay = phases->phase[phase - 1].phase_delay;
+					phases->phase[phase - 1].phase_delay = duty - phases->phase[phase - 1].phase_duty;
+					phases->phase[phase].phase_duty = duty;
+					phases->phase[phase].phase_delay = delay - phases->phase[phase - 1].phase_delay;
+					phases->phase[phase].phase_active_pins_clear_mask = mask;
+					phases->amount_phases++;
+				}
+
+				phases->active_pins_all_set_mask |= mask;
+				phases->active_pins_noduty1_set_mask |= mask;
+
+				if(duty == 1)
+				{
+					phases->active_pins_duty1_clear_mask |= mask;
+
+					if(extend)
+						phases->active_pins_noduty1_set_mask &= ~mask;
+				}
+			}
+
+	if(phases->amount_phases < 2)
+	{
+		phases->phase[0].phase_delay = 0;
+		phases->amount_phases = 0;
+	}
+
+	return(phases->active_pins_all_set_mask == list->active_mask);
+}
@@ -0,0 +1,60 @@
+#ifndef pwm_h
+#define pwm_h
+
+#include <stdint.h>
+
+#include "util.h"
+
+/*
+ * The pwm1 phase table, built from the list of pwm1 pins sorted by duty.
+ * The isr sets all active pins at phase 0 and clears them phase by phase,
+ * each phase is followed by its delay in timer ticks. Pins fully off or
+ * fully on are not in the list, they are in the static masks.
+ * No SDK dependencies, so it's also built for the host, see host-sim.c.
+ */
+
+enum
+{
+	pwm_list_pins = 16,
+	pwm_max_channels = 4,
+};
+
+typedef struct
+{
+	uint32_t	phase_duty;
+	uint32_t	phase_delay;
+	uint16_t	phase_active_pins_clear_mask;
+} pwm_phase_t;
+
+assert_size(pwm_phase_t, 12);
+
+typedef struct
+{
+	uint32_t		amount_phases;
+	uint32_t		static_pins_on_mask;
+	uint32_t		static_pins_off_mask;
+	uint32_t		active_pins_all_set_mask;
+	uint32_t		active_pins_noduty1_set_mask;	// special case for duty is 1 period, only set intermittently
+	uint32_t		active_pins_duty1_clear_mask;	// special case for duty is 1 period, clear immediately after set
+	pwm_phase_t		phase[pwm_max_channels + 1];
+} pwm_phases_t;
+
+assert_size(pwm_phases_t, 84);
+
+typedef struct
+{
+	int8_t		head;
+	int8_t		next[pwm_list_pins];
+	uint32_t	duty[pwm_list_pins];
+	uint32_t	active_mask;		// pins in the list
+	uint32_t	static_on_mask;
+	uint32_t	static_off_mask;
+} pwm_list_t;
+
+void	pwm_list_clear(pwm_list_t *list);
+void	pwm_list_insert(pwm_list_t *list, unsigned int pin, unsigned int duty, unsigned int period);
+void	pwm_list_remove(pwm_list_t *list, unsigned int pin);
+int		pwm_phases_build(pwm_phases_t *phases, const pwm_list_t *list, unsigned int period, _Bool extend, _Bool spread);
+_Bool	pwm_phases_update(pwm_phases_t *phases, const pwm_list_t *list, unsigned int pin, unsigned int period, _Bool extend);
+
+#endif
@@ -1,9 +1,54 @@
 #include "queue.h"
 
-void queue_new(queue_t *queue, int size, char *buffer)
+void queue_new(queue_t *queue, unsigned int size, char *buffer)
 {
+	if((size == 0) || (size & (size - 1)))
+		log("queue: size %u not a power of two\n", size);
+
 	queue->data = buffer;
-	queue->size = size;
+	queue->mask = size - 1;
 	queue->in = 0;
 	queue->out = 0;
 }
+
+iram unsigned int queue_push_n(queue_t *queue, const char *src, unsigned int length)
+{
+	unsigned int offset, chunk;
+
+	if(length > queue_space(queue))
+		length = queue_space(queue);
+
+	offset = queue->in & queue->mask;
+	chunk = queue->mask + 1 - offset;
+
+	if(chunk > length)
+		chunk = length;
+
+	memcpy(queue->data + offset, src, chunk);
+	memcpy(queue->data, src + chunk, length - chunk);
+
+	queue->in += length;
+
+	return(length);
+}
+
+iram unsigned int queue_pop_n(queue_t *queue, char *dst, unsigned int length)
+{
+	unsigned int offset, chunk;
+
+	if(length > queue_length(queue))
+		length = queue_length(queue);
+
+	offset = queue->out & queue->mask;
+	chunk = queue->mask + 1 - offset;
+
+	if(chunk > length)
+		chunk = length;
+
+	memcpy(dst, queue->data + offset, chunk);
+	memcpy(dst + chunk, queue->data, length - chunk);
+
+	queue->out += length;
+
+	return(length);
+}
@@ -5,15 +5,30 @@
 
 #include "util.h"
 
+// single producer / single consumer ring buffer, size must be a power of two
+// in and out are free running, so all of the buffer can be used
+
 typedef struct
 {
 	char *data;
-	int size;
-	int in;
-	int out;
+	unsigned int mask;
+	volatile unsigned int in;
+	volatile unsigned int out;
 } queue_t;
 
-void queue_new(queue_t *queue, int size, char *buffer);
+void			queue_new(queue_t *queue, unsigned int size, char *buffer);
+unsigned int	queue_push_n(queue_t *queue, const char *src, unsigned int length);
+unsigned int	queue_pop_n(queue_t *queue, char *dst, unsigned int length);
+
+attr_inline attr_pure unsigned int queue_length(const queue_t *queue)
+{
+	return(queue->in - queue->out);
+}
+
+attr_inline attr_pure unsigned int queue_space(const queue_t *queue)
+{
+	return(queue->mask + 1 - (queue->in - queue->out));
+}
 
 attr_inline attr_pure char queue_empty(const queue_t *queue)
 {
@@ -22,7 +37,7 @@ attr_inline attr_pure char queue_empty(const queue_t *queue)
 
 attr_inline attr_pure char queue_full(const queue_t *queue)
 {
-	return(((queue->in + 1) % queue->size) == queue->out);
+	return((queue->in - queue->out) > queue->mask);
 }
 
 attr_inline void queue_flush(queue_t *queue)
@@ -31,18 +46,42 @@ attr_inline void queue_flush(queue_t *queue)
 	queue->out = 0;
 }
 
+// contiguous readable span at the head of the queue, consume with queue_skip
+
+attr_inline unsigned int queue_peek(const queue_t *queue, const char **data)
+{
+	unsigned int offset, length;
+
+	offset = queue->out & queue->mask;
+	length = queue->mask + 1 - offset;
+
+	if(length > (queue->in - queue->out))
+		length = queue->in - queue->out;
+
+	*data = queue->data + offset;
+
+	return(length);
+}
+
+attr_inline void queue_skip(queue_t *queue, unsigned int length)
+{
+	queue->out += length;
+}
+
+// the caller must check queue_full first, in may never run more than size ahead of out
+
 attr_inline void queue_push(queue_t *queue, char data)
 {
-	queue->data[queue->in] = data;
-	queue->in = (queue->in + 1) % queue->size;
+	queue->data[queue->in & queue->mask] = data;
+	queue->in++;
 }
 
 attr_inline char queue_pop(queue_t *queue)
 {
 	char data;
 
-	data = queue->data[queue->out];
-	queue->out = (queue->out + 1) % queue->size;
+	data = queue->data[queue->out & queue->mask];
+	queue->out++;
 
 	return(data);
 }
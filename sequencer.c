@@ -2,10 +2,14 @@
 #include "time.h"
 #include "io.h"
 #include "dispatch.h"
+#include "stats.h"
+
+#include <osapi.h>
 
 typedef struct
 {
 	_Bool		flash_valid;
+	_Bool		timed;
 	int			start;
 	int			current;
 	uint64_t	current_end_time;
@@ -14,6 +18,31 @@ typedef struct
 
 static sequencer_t sequencer;
 
+/*
+ * When the program fits, it's loaded into ram on start, with the io pins resolved, and each
+ * step is run from a one shot timer armed for the end time of the previous step. The end
+ * times are added up from the start, so the timer's latency doesn't accumulate. Longer
+ * programs are read from flash and polled by the fast timer, as before. Changes to the
+ * entries take effect at the next start.
+ */
+
+enum
+{
+	sequencer_program_size = 128,
+};
+
+typedef struct
+{
+	io_target_t	target;
+	uint32_t	value;
+	uint32_t	duration;
+	_Bool		valid;
+} sequencer_step_t;
+
+static sequencer_step_t sequencer_program[sequencer_program_size];
+static unsigned int sequencer_program_length;
+static ETSTimer sequencer_timer;
+
 typedef struct
 {
 	union
@@ -130,62 +159,128 @@ static _Bool get_flash_entry(unsigned int index, sequencer_entry_t *entry)
 	return(true);
 }
 
-static _Bool update_flash_entry(unsigned int index, unsigned int mirror, const sequencer_entry_t *entry)
+/*
+ * Edits are staged one sector at a time in flash_sector_buffer. The sector is read from the
+ * mapped (running) mirror when an edit first touches it and written back to both mirrors
+ * when an edit touches another sector or on commit, so a run of consecutive entries costs
+ * one erase/write per sector per mirror instead of one per entry. The buffer is shared with
+ * config and ota, so a transaction must be begun and committed from within the same command.
+ * Entries read back before the commit still show the old contents.
+ */
+
+static struct
 {
-	sequencer_entry_t *entries_in_buffer, *entry_in_buffer;
-	unsigned int flash_start_offset, sector;
-	char *buffer;
+	_Bool	open;
+	int		sector;
+} transaction;
 
-	if(!sequencer.flash_valid)
+static _Bool transaction_flush(void)
+{
+	unsigned int mirror, offset;
+	const char *buffer;
+
+	if(transaction.sector < 0)
+		return(true);
+
+	buffer = string_buffer(&flash_sector_buffer);
+
+	for(mirror = 0; mirror < 2; mirror++)
+	{
+		if(mirror == 0)
+			offset = SEQUENCER_FLASH_OFFSET_0;
+		else
+			offset = SEQUENCER_FLASH_OFFSET_1;
+
+		if(offset == 0) // plain image, no mirror offset
+			continue;
+
+		offset += transaction.sector * SPI_FLASH_SEC_SIZE;
+
+		log("sequencer flush: mirror: %u, sector: %d, offset: %x\n", mirror, transaction.sector, offset);
+
+		if(spi_flash_erase_sector(offset / SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
+			return(false);
+
+		if(spi_flash_write(offset, buffer, SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
+			return(false);
+
+		stat_sequencer_sector_writes++;
+	}
+
+	transaction.sector = -1;
+
+	return(true);
+}
+
+static _Bool transaction_update(unsigned int index, const sequencer_entry_t *entry)
+{
+	sequencer_entry_t *entries_in_buffer;
+	unsigned int current;
+	int sector;
+
+	if(!transaction.open)
 		return(false);
 
 	if(index >= sequencer_flash_entries)
 		return(false);
 
-	if(mirror > 1)
-		return(false);
+	sector = index / sequencer_flash_entries_per_sector;
 
-	if(string_size(&flash_sector_buffer) < SPI_FLASH_SEC_SIZE)
-		return(false);
+	entries_in_buffer = (sequencer_entry_t *)(void *)string_buffer_nonconst(&flash_sector_buffer);
 
-	buffer = string_buffer_nonconst(&flash_sector_buffer);
+	if(sector != transaction.sector)
+	{
+		if(!transaction_flush())
+			return(false);
 
-	if(mirror == 0)
-		flash_start_offset = SEQUENCER_FLASH_OFFSET_0;
-	else
-		flash_start_offset = SEQUENCER_FLASH_OFFSET_1;
+		// SEQUENCER_FLASH_OFFSET is mirror 0, read through the flash mapping to get the running mirror
 
-	if(flash_start_offset == 0) // plain image, no mirror offset
-		return(true);
+		for(current = 0; current < sequencer_flash_entries_per_sector; current++)
+			if(!get_flash_entry((sector * sequencer_flash_entries_per_sector) + current, &entries_in_buffer[current]))
+				return(false);
+
+		transaction.sector = sector;
+	}
+	entries_in_buffer[index - (sector * sequencer_flash_entries_per_sector)] = *entry;
 
-	sector = (index * sizeof(sequencer_entry_t)) / SPI_FLASH_SEC_SIZE;
+	return(true);
+}
 
-	log("update flash entry: update entry: %u, sector: %u, offset index: %u, flash start offset: %x\n",
-			index,
-			sector,
-			index - (sector * sequencer_flash_entries_per_sector),
-			flash_start_offset);
+_Bool sequencer_transaction_begin(void)
+{
+	if(!sequencer.flash_valid || transaction.open)
+		return(false);
 
-	if(spi_flash_read(flash_start_offset + (sector * SPI_FLASH_SEC_SIZE), buffer, SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
+	if(string_size(&flash_sector_buffer) < SPI_FLASH_SEC_SIZE)
 		return(false);
 
-	entries_in_buffer = (sequencer_entry_t *)(void *)buffer;
-	entry_in_buffer = &entries_in_buffer[index - (sector * sequencer_flash_entries_per_sector)];
+	transaction.open = true;
+	transaction.sector = -1;
 
-	log("* buffer offset: %u\n", (char *)&entries_in_buffer[index - (sector * sequencer_flash_entries_per_sector)] - buffer);
-	log("* entry1: io: %u, pin: %u, duration: %u, value: %u\n", entry_in_buffer->io, entry_in_buffer->pin, entry_in_buffer->duration, entry_in_buffer->value);
+	return(true);
+}
 
-	*entry_in_buffer = *entry;
+// discard the staged sector, sectors that were written already stay written
+
+void sequencer_transaction_abort(void)
+{
+	transaction.open = false;
+	transaction.sector = -1;
+}
 
-	log("* entry2: io: %u, pin: %u, duration: %u, value: %u\n", entry_in_buffer->io, entry_in_buffer->pin, entry_in_buffer->duration, entry_in_buffer->value);
+_Bool sequencer_transaction_commit(void)
+{
+	_Bool rv;
 
-	if(spi_flash_erase_sector((flash_start_offset + (sector * SPI_FLASH_SEC_SIZE)) / SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
+	if(!transaction.open)
 		return(false);
 
-	if(spi_flash_write(flash_start_offset + (sector * SPI_FLASH_SEC_SIZE), buffer, SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK)
-		return(false);
+	rv = transaction_flush();
 
-	return(true);
+	transaction.open = false;
+	transaction.sector = -1;
+
+	return(rv);
 }
 
 attr_pure int sequencer_get_start(void)
@@ -208,6 +303,16 @@ iram attr_pure int sequencer_get_repeats(void)
 	return(sequencer.repeats);
 }
 
+iram attr_pure _Bool sequencer_get_timed(void)
+{
+	return(sequencer.timed);
+}
+
+attr_pure unsigned int sequencer_get_program_length(void)
+{
+	return(sequencer_program_length);
+}
+
 void sequencer_get_status(_Bool *running, unsigned int *start, unsigned int *flash_size, unsigned int *flash_size_entries,
 		unsigned int *flash_offset_flash0, unsigned int *flash_offset_flash1, unsigned int *flash_offset_mapped)
 {
@@ -283,10 +388,19 @@ _Bool sequencer_set_entry(unsigned int index, int io, int pin, uint32_t value, i
 	entry.duration = duration;
 	entry.value = value;
 
-	if(!update_flash_entry(index, 0, &entry))
+	if(transaction.open)
+		return(transaction_update(index, &entry));
+
+	if(!sequencer_transaction_begin())
 		return(false);
 
-	return(update_flash_entry(index, 1, &entry));
+	if(!transaction_update(index, &entry))
+	{
+		sequencer_transaction_abort();
+		return(false);
+	}
+
+	return(sequencer_transaction_commit());
 }
 
 _Bool sequencer_remove_entry(unsigned int index)
@@ -307,16 +421,29 @@ _Bool sequencer_remove_entry(unsigned int index)
 	entry.duration = 0;
 	entry.value = 0;
 
-	if(!update_flash_entry(index, 0, &entry))
+	if(transaction.open)
+		return(transaction_update(index, &entry));
+
+	if(!sequencer_transaction_begin())
+		return(false);
+
+	if(!transaction_update(index, &entry))
+	{
+		sequencer_transaction_abort();
 		return(false);
+	}
 
-	return(update_flash_entry(index, 1, &entry));
+	return(sequencer_transaction_commit());
 }
 
+static void sequencer_timer_callback(void *arg);
+
 void sequencer_init(void)
 {
 	sequencer_entry_t header;
 
+	os_timer_setfn(&sequencer_timer, sequencer_timer_callback, (void *)0);
+
 	sequencer_stop();
 
 	sequencer.flash_valid = 0;
@@ -325,16 +452,103 @@ void sequencer_init(void)
 		sequencer.flash_valid = 1;
 }
 
+// load the program from start up to the first inactive entry, false if it doesn't fit
+
+static _Bool sequencer_load(unsigned int start)
+{
+	sequencer_step_t *step;
+	int io, pin, duration;
+	uint32_t value;
+	_Bool active;
+
+	for(sequencer_program_length = 0; sequencer_program_length < sequencer_program_size; sequencer_program_length++)
+	{
+		if(!sequencer_get_entry(start + sequencer_program_length, &active, &io, &pin, &value, &duration) || !active)
+			return(true);
+
+		step = &sequencer_program[sequencer_program_length];
+		step->valid = io_resolve_pin((string_t *)0, io, pin, &step->target) == io_ok;
+		step->value = value;
+		step->duration = duration;
+	}
+
+	if(!sequencer_get_entry(start + sequencer_program_length, &active, (int *)0, (int *)0, (uint32_t *)0, (int *)0) || !active)
+		return(true);
+
+	sequencer_program_length = 0;
+
+	return(false);
+}
+
+static void sequencer_step(void)
+{
+	const sequencer_step_t *step;
+	uint64_t now;
+
+	if(!sequencer.timed || (sequencer.repeats <= 0))
+		return;
+
+	if((unsigned int)(++sequencer.current - sequencer.start) >= sequencer_program_length)
+	{
+		if(--sequencer.repeats <= 0)
+		{
+			sequencer_stop();
+			return;
+		}
+
+		sequencer.current = sequencer.start;
+	}
+
+	step = &sequencer_program[sequencer.current - sequencer.start];
+
+	if(step->valid)
+		io_write_target((string_t *)0, &step->target, step->value);
+
+	now = time_get_us() / 1000;
+	sequencer.current_end_time += step->duration;
+
+	if(sequencer.current_end_time < now)
+	{
+		stat_sequencer_steps_late++;
+		sequencer.current_end_time = now;
+	}
+
+	os_timer_arm(&sequencer_timer, sequencer.current_end_time - now, 0);
+}
+
+static void sequencer_timer_callback(void *arg)
+{
+	sequencer_step();
+}
+
 void sequencer_start(unsigned int start, unsigned int repeats)
 {
+	sequencer_stop();
+
 	sequencer.start = start;
 	sequencer.current = sequencer.start - 1;
 	sequencer.current_end_time = 0;
 	sequencer.repeats = repeats;
+
+	if((repeats > 0) && sequencer.flash_valid && sequencer_load(start))
+	{
+		if(sequencer_program_length == 0)
+		{
+			sequencer_stop();
+			return;
+		}
+
+		sequencer.timed = true;
+		sequencer.current_end_time = time_get_us() / 1000;
+		sequencer_step();
+	}
 }
 
 void sequencer_stop(void)
 {
+	os_timer_disarm(&sequencer_timer);
+
+	sequencer.timed = false;
 	sequencer.start = 0;
 	sequencer.current = -1;
 	sequencer.current_end_time = 0;
@@ -343,7 +557,7 @@ void sequencer_stop(void)
 
 void sequencer_run(void)
 {
-	unsigned int io, pin, duration;
+	int io, pin, duration;
 	uint32_t value;
 	_Bool active;
 
@@ -5,6 +5,7 @@
 #include "time.h"
 #include "i2c.h"
 #include "i2c_sensor.h"
+#include "io_gpio.h"
 #include "rboot-interface.h"
 
 #include <user_interface.h>
@@ -20,6 +21,11 @@ int stat_pwm_cycles;
 int stat_timer_interrupts;
 int stat_pwm_timer_interrupts;
 int stat_pwm_timer_interrupts_while_nmi_masked;
+uint32_t stat_pwm_isr_cycles;
+unsigned int stat_io_fade_steps;
+unsigned int stat_io_fade_deadlines_missed;
+unsigned int stat_sequencer_steps_late;
+unsigned int stat_sequencer_sector_writes;
 int stat_pc_counts;
 int stat_display_init_time_us;
 int stat_cmd_receive_buffer_overflow;
@@ -40,12 +46,41 @@ unsigned int stat_task_command_failed;
 unsigned int stat_task_timer_posted;
 unsigned int stat_task_timer_failed;
 
+unsigned int stat_cmd_processed;
+unsigned int stat_cmd_binary;
+unsigned int stat_cmd_lookups;
+uint64_t stat_cmd_lookup_time_us;
+unsigned int stat_cmd_time_last_us;
+unsigned int stat_cmd_time_max_us;
+uint64_t stat_cmd_time_total_us;
+
+unsigned int stat_config_lookups;
+uint64_t stat_config_lookup_time_us;
+unsigned int stat_config_handle_hits;
+unsigned int stat_uart_bridge_bytes;
+unsigned int stat_uart_bridge_bytes_per_s;
+unsigned int stat_uart_bridge_bytes_per_s_max;
+unsigned int stat_uart_bridge_latency_last_us;
+unsigned int stat_uart_bridge_latency_max_us;
+unsigned int stat_uart_bridge_discarded;
+unsigned int stat_flash_compressed_bytes;
+unsigned int stat_flash_decompressed_bytes;
+unsigned int stat_tcp_send_large;
+unsigned int stat_tcp_send_ttlb_last_us;
+unsigned int stat_tcp_send_ttlb_max_us;
+uint64_t stat_tcp_send_ttlb_total_us;
+
 unsigned int stat_i2c_sda_stucks;
 unsigned int stat_i2c_sda_stuck_max_period;
 unsigned int stat_i2c_bus_locks;
 unsigned int stat_i2c_bus_lock_max_period;
 unsigned int stat_i2c_soft_resets;
 unsigned int stat_i2c_hard_resets;
+unsigned int stat_i2c_transfers;
+unsigned int stat_i2c_transfer_errors;
+unsigned int stat_i2c_transfer_overflows;
+unsigned int stat_i2c_transfer_bytes;
+uint64_t stat_i2c_transfer_busy_us;
 
 int stat_debug_1;
 int stat_debug_2;
@@ -253,6 +288,10 @@ void stats_time(string_t *dst)
 
 void stats_counters(string_t *dst)
 {
+	unsigned int pwm_isr_load, pwm_isr_channels, pwm_pdm_channels;
+
+	pwm_isr_load = io_gpio_pwm_isr_load(&pwm_isr_channels, &pwm_pdm_channels);
+
 	string_format(dst,
 			"> user_pre_init called: %s\n"
 			"> user_pre_init success: %s\n"
@@ -264,6 +303,8 @@ void stats_counters(string_t *dst)
 			"> primary pwm cycles: %u\n"
 			"> ... int fired: %u\n"
 			"> ... while masked: %u\n"
+			"> pwm isr cpu load: %u.%u %% with %u isr + %u pdm channels\n"
+			"> fade steps: %u, missed deadlines: %u\n"
 			"> pc counts: %u\n"
 			"> uart updated: %u\n"
 			"> commands/udp processed: %u\n"
@@ -280,6 +321,24 @@ void stats_counters(string_t *dst)
 			"> task command failed: %u\n"
 			"> task timer posted: %u\n"
 			"> task timer failed: %u\n"
+			"> commands processed: %u\n"
+			"> commands binary: %u\n"
+			"> command lookups: %u\n"
+			"> command lookup time total: %u us\n"
+			"> command processing time last: %u us\n"
+			"> command processing time max: %u us\n"
+			"> command processing time avg: %u us\n"
+			"> config lookups: %u\n"
+			"> config lookup time total: %u ms\n"
+			"> config handle cache hits: %u\n"
+			"> uart bridge bytes: %u\n"
+			"> uart bridge rate: %u B/s (max %u B/s)\n"
+			"> uart bridge latency last: %u us\n"
+			"> uart bridge latency max: %u us\n"
+			"> uart bridge discarded (no client): %u bytes\n"
+			"> flash compressed bytes received: %u, decompressed: %u\n"
+			"> tcp multi segment replies: %u\n"
+			"> tcp reply time to last byte last: %u us, max: %u us, avg: %u us\n"
 			"> debug counter 1: 0x%08x %d\n"
 			"> debug counter 2: 0x%08x %d\n"
 			"> debug counter 3: 0x%08x %d\n",
@@ -293,6 +352,11 @@ void stats_counters(string_t *dst)
 				stat_pwm_cycles,
 				stat_pwm_timer_interrupts,
 				stat_pwm_timer_interrupts_while_nmi_masked,
+				pwm_isr_load / 10, pwm_isr_load % 10,
+				pwm_isr_channels,
+				pwm_pdm_channels,
+				stat_io_fade_steps,
+				stat_io_fade_deadlines_missed,
 				stat_pc_counts,
 				stat_update_uart,
 				stat_update_command_udp,
@@ -309,6 +373,28 @@ void stats_counters(string_t *dst)
 				stat_task_command_failed,
 				stat_task_timer_posted,
 				stat_task_timer_failed,
+				stat_cmd_processed,
+				stat_cmd_binary,
+				stat_cmd_lookups,
+				(unsigned int)stat_cmd_lookup_time_us,
+				stat_cmd_time_last_us,
+				stat_cmd_time_max_us,
+				stat_cmd_processed ? (unsigned int)(stat_cmd_time_total_us / stat_cmd_processed) : 0,
+				stat_config_lookups,
+				(unsigned int)(stat_config_lookup_time_us / 1000),
+				stat_config_handle_hits,
+				stat_uart_bridge_bytes,
+				stat_uart_bridge_bytes_per_s,
+				stat_uart_bridge_bytes_per_s_max,
+				stat_uart_bridge_latency_last_us,
+				stat_uart_bridge_latency_max_us,
+				stat_uart_bridge_discarded,
+				stat_flash_compressed_bytes,
+				stat_flash_decompressed_bytes,
+				stat_tcp_send_large,
+				stat_tcp_send_ttlb_last_us,
+				stat_tcp_send_ttlb_max_us,
+				stat_tcp_send_large ? (unsigned int)(stat_tcp_send_ttlb_total_us / stat_tcp_send_large) : 0,
 				stat_debug_1,
 				stat_debug_1,
 				stat_debug_2,
@@ -317,6 +403,85 @@ void stats_counters(string_t *dst)
 				stat_debug_3);
 }
 
+typedef struct
+{
+	const char name[32];
+	const unsigned int *value;
+} stats_metric_t;
+
+roflash static const stats_metric_t stats_metrics_table[] =
+{
+	{ "uart0_rx_interrupts",			(const unsigned int *)&stat_uart0_rx_interrupts },
+	{ "uart0_tx_interrupts",			(const unsigned int *)&stat_uart0_tx_interrupts },
+	{ "uart1_tx_interrupts",			(const unsigned int *)&stat_uart1_tx_interrupts },
+	{ "fast_timer",						(const unsigned int *)&stat_fast_timer },
+	{ "slow_timer",						(const unsigned int *)&stat_slow_timer },
+	{ "pwm_cycles",						(const unsigned int *)&stat_pwm_cycles },
+	{ "pwm_timer_interrupts",			(const unsigned int *)&stat_pwm_timer_interrupts },
+	{ "io_fade_steps",					(const unsigned int *)&stat_io_fade_steps },
+	{ "io_fade_deadlines_missed",		(const unsigned int *)&stat_io_fade_deadlines_missed },
+	{ "pc_counts",						(const unsigned int *)&stat_pc_counts },
+	{ "update_uart",					(const unsigned int *)&stat_update_uart },
+	{ "update_command_udp",				(const unsigned int *)&stat_update_command_udp },
+	{ "update_command_tcp",				(const unsigned int *)&stat_update_command_tcp },
+	{ "update_display",					(const unsigned int *)&stat_update_display },
+	{ "update_ntp",						(const unsigned int *)&stat_update_ntp },
+	{ "cmd_receive_buffer_overflow",	(const unsigned int *)&stat_cmd_receive_buffer_overflow },
+	{ "cmd_send_buffer_overflow",		(const unsigned int *)&stat_cmd_send_buffer_overflow },
+	{ "uart_receive_buffer_overflow",	(const unsigned int *)&stat_uart_receive_buffer_overflow },
+	{ "uart_send_buffer_overflow",		(const unsigned int *)&stat_uart_send_buffer_overflow },
+	{ "task_uart_posted",				(const unsigned int *)&stat_task_uart_posted },
+	{ "task_uart_failed",				(const unsigned int *)&stat_task_uart_failed },
+	{ "task_command_posted",			(const unsigned int *)&stat_task_command_posted },
+	{ "task_command_failed",			(const unsigned int *)&stat_task_command_failed },
+	{ "task_timer_posted",				(const unsigned int *)&stat_task_timer_posted },
+	{ "task_timer_failed",				(const unsigned int *)&stat_task_timer_failed },
+	{ "cmd_processed",					(const unsigned int *)&stat_cmd_processed },
+	{ "cmd_binary",						(const unsigned int *)&stat_cmd_binary },
+	{ "cmd_lookups",					(const unsigned int *)&stat_cmd_lookups },
+	{ "cmd_time_last_us",				(const unsigned int *)&stat_cmd_time_last_us },
+	{ "cmd_time_max_us",				(const unsigned int *)&stat_cmd_time_max_us },
+	{ "config_lookups",					(const unsigned int *)&stat_config_lookups },
+	{ "config_handle_hits",				(const unsigned int *)&stat_config_handle_hits },
+	{ "uart_bridge_bytes",				(const unsigned int *)&stat_uart_bridge_bytes },
+	{ "uart_bridge_bytes_per_s",		(const unsigned int *)&stat_uart_bridge_bytes_per_s },
+	{ "uart_bridge_latency_last_us",	(const unsigned int *)&stat_uart_bridge_latency_last_us },
+	{ "uart_bridge_latency_max_us",		(const unsigned int *)&stat_uart_bridge_latency_max_us },
+	{ "uart_bridge_discarded",			(const unsigned int *)&stat_uart_bridge_discarded },
+	{ "flash_compressed_bytes",			(const unsigned int *)&stat_flash_compressed_bytes },
+	{ "flash_decompressed_bytes",		(const unsigned int *)&stat_flash_decompressed_bytes },
+	{ "tcp_send_large",					(const unsigned int *)&stat_tcp_send_large },
+	{ "tcp_send_ttlb_last_us",			(const unsigned int *)&stat_tcp_send_ttlb_last_us },
+	{ "tcp_send_ttlb_max_us",			(const unsigned int *)&stat_tcp_send_ttlb_max_us },
+	{ "i2c_sda_stucks",					(const unsigned int *)&stat_i2c_sda_stucks },
+	{ "i2c_bus_locks",					(const unsigned int *)&stat_i2c_bus_locks },
+	{ "i2c_soft_resets",				(const unsigned int *)&stat_i2c_soft_resets },
+	{ "i2c_hard_resets",				(const unsigned int *)&stat_i2c_hard_resets },
+	{ "i2c_transfers",					(const unsigned int *)&stat_i2c_transfers },
+	{ "i2c_transfer_errors",			(const unsigned int *)&stat_i2c_transfer_errors },
+	{ "i2c_transfer_bytes",				(const unsigned int *)&stat_i2c_transfer_bytes },
+};
+
+// Prometheus text format, all counters are plain integers, so no bus is touched
+
+void stats_metrics(string_t *dst)
+{
+	const stats_metric_t *metric;
+	unsigned int ix;
+
+	string_format(dst, "espiobridge_uptime_seconds %u\n", (unsigned int)(time_get_us() / 1000000));
+	string_format(dst, "espiobridge_heap_free_bytes %u\n", system_get_free_heap_size());
+
+	for(ix = 0; ix < (sizeof(stats_metrics_table) / sizeof(*stats_metrics_table)); ix++)
+	{
+		metric = &stats_metrics_table[ix];
+
+		string_append(dst, "espiobridge_");
+		string_append_cstr_flash(dst, metric->name);
+		string_format(dst, " %u\n", *metric->value);
+	}
+}
+
 void stats_i2c(string_t *dst)
 {
 	i2c_info_t			i2c_info;
@@ -333,6 +498,9 @@ void stats_i2c(string_t *dst)
 			"> i2c bus max locked periods: %u\n"
 			"> i2c soft resets: %u\n"
 			"> i2c hard resets: %u\n"
+			"> i2c queued transfers: %u, errors: %u, overflows: %u\n"
+			"> i2c queued transfer bytes: %u, throughput: %u bytes/s\n"
+			"> i2c queued transfer bus time: %u ms, not waited for by the submitter\n"
 			"> i2c multiplexer found: %s\n"
 			"> i2c buses: %u\n"
 			"> i2c sensors init called: %u\n"
@@ -341,11 +509,17 @@ void stats_i2c(string_t *dst)
 			"> i2c sensors init skip secondary: %u (%u)\n"
 			"> i2c sensors init skip found on bus 0: %u\n"
 			"> i2c sensors init skip dup address: %u\n"
+			"> i2c sensors init skip no ACK: %u\n"
 			"> i2c sensors init failed: %u\n"
 			"> i2c sensors init current bus: %u\n"
 			"> i2c sensors init current sensor id: %u\n"
 			"> i2c sensors init finished: %s\n"
-			"> i2c sensors init duration: %u ms\n",
+			"> i2c sensors init duration: %u ms\n"
+			"> i2c sensors init probes: %u, answered: %u, probe time: %u ms\n"
+			"> i2c sensors boot to ready: %u ms\n"
+			"> i2c sensor cache samples: %u, errors: %u\n"
+			"> i2c sensor cache hits: %u, misses: %u, overflows: %u\n"
+			"> i2c sensor background conversions: %u, cancelled: %u\n",
 				stat_display_init_time_us / 1000,
 				stat_i2c_sda_stucks,
 				stat_i2c_sda_stuck_max_period,
@@ -353,6 +527,12 @@ void stats_i2c(string_t *dst)
 				stat_i2c_bus_lock_max_period,
 				stat_i2c_soft_resets,
 				stat_i2c_hard_resets,
+				stat_i2c_transfers,
+				stat_i2c_transfer_errors,
+				stat_i2c_transfer_overflows,
+				stat_i2c_transfer_bytes,
+				stat_i2c_transfer_busy_us ? (unsigned int)((uint64_t)stat_i2c_transfer_bytes * 1000000 / stat_i2c_transfer_busy_us) : 0,
+				(unsigned int)(stat_i2c_transfer_busy_us / 1000),
 				yesno(i2c_info.multiplexer),
 				i2c_info.buses,
 				i2c_sensor_info.init_called,
@@ -363,11 +543,23 @@ void stats_i2c(string_t *dst)
 				i2c_sensor_info.init_skip_secondary / i2c_info.buses,
 				i2c_sensor_info.init_skip_found_on_bus_0,
 				i2c_sensor_info.init_skip_duplicate_address,
+				i2c_sensor_info.init_skip_no_ack,
 				i2c_sensor_info.init_failed,
 				i2c_sensor_info.init_current_bus,
 				i2c_sensor_info.init_current_sensor,
 				yesno(i2c_sensor_info.init_finished),
-				(uint32_t)((i2c_sensor_info.init_finished_us - i2c_sensor_info.init_started_us) / 1000));
+				(uint32_t)((i2c_sensor_info.init_finished_us - i2c_sensor_info.init_started_us) / 1000),
+				i2c_sensor_info.init_probes,
+				i2c_sensor_info.init_probe_acks,
+				i2c_sensor_info.init_probe_us / 1000,
+				(uint32_t)(i2c_sensor_info.init_finished_us / 1000),
+				i2c_sensor_info.cache_samples,
+				i2c_sensor_info.cache_sample_errors,
+				i2c_sensor_info.cache_hits,
+				i2c_sensor_info.cache_misses,
+				i2c_sensor_info.cache_overflows,
+				i2c_sensor_info.cache_conversions,
+				i2c_sensor_info.cache_conversions_cancelled);
 }
 
 void stats_wlan(string_t *dst)
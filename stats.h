@@ -27,6 +27,11 @@ extern int stat_slow_timer;
 extern int stat_pwm_cycles;;
 extern int stat_pwm_timer_interrupts;
 extern int stat_pwm_timer_interrupts_while_nmi_masked;
+extern uint32_t stat_pwm_isr_cycles;
+extern unsigned int stat_io_fade_steps;
+extern unsigned int stat_io_fade_deadlines_missed;
+extern unsigned int stat_sequencer_steps_late;
+extern unsigned int stat_sequencer_sector_writes;
 extern int stat_pc_counts;
 extern int stat_display_init_time_us;
 extern int stat_cmd_receive_buffer_overflow;
@@ -48,6 +53,30 @@ extern unsigned int stat_task_command_failed;
 extern unsigned int stat_task_timer_posted;
 extern unsigned int stat_task_timer_failed;
 
+extern unsigned int stat_cmd_processed;
+extern unsigned int stat_cmd_binary;
+extern unsigned int stat_cmd_lookups;
+extern uint64_t stat_cmd_lookup_time_us;
+extern unsigned int stat_cmd_time_last_us;
+extern unsigned int stat_cmd_time_max_us;
+extern uint64_t stat_cmd_time_total_us;
+
+extern unsigned int stat_config_lookups;
+extern uint64_t stat_config_lookup_time_us;
+extern unsigned int stat_config_handle_hits;
+extern unsigned int stat_uart_bridge_bytes;
+extern unsigned int stat_uart_bridge_bytes_per_s;
+extern unsigned int stat_uart_bridge_bytes_per_s_max;
+extern unsigned int stat_uart_bridge_latency_last_us;
+extern unsigned int stat_uart_bridge_latency_max_us;
+extern unsigned int stat_uart_bridge_discarded;
+extern unsigned int stat_flash_compressed_bytes;
+extern unsigned int stat_flash_decompressed_bytes;
+extern unsigned int stat_tcp_send_large;
+extern unsigned int stat_tcp_send_ttlb_last_us;
+extern unsigned int stat_tcp_send_ttlb_max_us;
+extern uint64_t stat_tcp_send_ttlb_total_us;
+
 extern int stat_debug_1;
 extern int stat_debug_2;
 extern int stat_debug_3;
@@ -59,6 +88,11 @@ extern unsigned int stat_i2c_bus_locks;
 extern unsigned int stat_i2c_bus_lock_max_period;
 extern unsigned int stat_i2c_soft_resets;
 extern unsigned int stat_i2c_hard_resets;
+extern unsigned int stat_i2c_transfers;
+extern unsigned int stat_i2c_transfer_errors;
+extern unsigned int stat_i2c_transfer_overflows;
+extern unsigned int stat_i2c_transfer_bytes;
+extern uint64_t stat_i2c_transfer_busy_us;
 
 extern volatile uint32_t *stat_stack_sp_initial;
 extern int stat_stack_painted;
@@ -66,6 +100,7 @@ extern int stat_stack_painted;
 void stats_firmware(string_t *dst);
 void stats_time(string_t *dst);
 void stats_counters(string_t *dst);
+void stats_metrics(string_t *dst);
 void stats_i2c(string_t *dst);
 void stats_wlan(string_t *dst);
 #endif
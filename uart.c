@@ -109,25 +109,35 @@ static void clear_fifos(unsigned int uart)
 
 static void fetch_queue(unsigned int uart)
 {
-	unsigned int byte;
+	char buffer[128];
+	unsigned int length, current;
 
 	// make sure to fetch all data from the fifo, or we'll get a another
 	// interrupt immediately after we enable it
 
-	while(rx_fifo_length(uart) > 0)
+	while((length = rx_fifo_length(uart)) > 0)
 	{
-		byte = read_peri_reg(UART_FIFO(uart));
+		if(length > sizeof(buffer))
+			length = sizeof(buffer);
 
-		if(!queue_full(&uart_receive_queue))
-			queue_push(&uart_receive_queue, byte);
+		for(current = 0; current < length; current++)
+			buffer[current] = read_peri_reg(UART_FIFO(uart));
+
+		stat_uart_receive_buffer_overflow += length - queue_push_n(&uart_receive_queue, buffer, length);
 	}
 
 	clear_interrupts(uart);
 	enable_receive_int(uart, true);
+
+	if(!queue_empty(&uart_receive_queue))
+		dispatch_uart_received();
 }
 
 static void fill_queue(unsigned int uart)
 {
+	char buffer[128];
+	unsigned int length, current;
+
 	if(autofill_info[uart].enabled)
 	{
 		while(tx_fifo_length(uart) < 128)
@@ -138,8 +148,10 @@ static void fill_queue(unsigned int uart)
 	}
 	else
 	{
-		while(!queue_empty(&uart_send_queue[uart]) && (tx_fifo_length(uart) < 128))
-			write_peri_reg(UART_FIFO(uart), queue_pop(&uart_send_queue[uart]));
+		length = queue_pop_n(&uart_send_queue[uart], buffer, sizeof(buffer) - tx_fifo_length(uart));
+
+		for(current = 0; current < length; current++)
+			write_peri_reg(UART_FIFO(uart), buffer[current]);
 
 		clear_interrupts(uart);
 		enable_transmit_int(uart, !queue_empty(&uart_send_queue[uart]));
@@ -345,9 +357,25 @@ iram attr_pure _Bool uart_full(unsigned int uart)
 
 iram void uart_send(unsigned int uart, unsigned int byte)
 {
+	if(queue_full(&uart_send_queue[uart]))
+	{
+		stat_uart_send_buffer_overflow++;
+		return;
+	}
+
 	queue_push(&uart_send_queue[uart], byte);
 }
 
+// returns the number of bytes queued, the caller accounts for the rest
+
+iram unsigned int uart_send_n(unsigned int uart, const char *src, unsigned int length)
+{
+	if(length > queue_space(&uart_send_queue[uart]))
+		length = queue_space(&uart_send_queue[uart]);
+
+	return(queue_push_n(&uart_send_queue[uart], src, length));
+}
+
 iram void uart_flush(unsigned int uart)
 {
 	enable_transmit_int(uart, !queue_empty(&uart_send_queue[uart]));
@@ -363,6 +391,21 @@ iram unsigned int uart_receive(unsigned int uart)
 	return(queue_pop(&uart_receive_queue));
 }
 
+iram unsigned int uart_receive_n(unsigned int uart, char *dst, unsigned int length)
+{
+	return(queue_pop_n(&uart_receive_queue, dst, length));
+}
+
+iram unsigned int uart_receive_peek(unsigned int uart, const char **data)
+{
+	return(queue_peek(&uart_receive_queue, data));
+}
+
+iram void uart_receive_skip(unsigned int uart, unsigned int length)
+{
+	queue_skip(&uart_receive_queue, length);
+}
+
 iram void uart_clear_send_queue(unsigned int uart)
 {
 	queue_flush(&uart_send_queue[uart]);
@@ -41,10 +41,14 @@ void			uart_autofill(unsigned int uart, _Bool enable, unsigned int character);
 void			uart_is_autofill(unsigned int uart, _Bool *enable, unsigned int *character);
 _Bool			uart_full(unsigned int uart);
 void			uart_send(unsigned int, unsigned int);
+unsigned int	uart_send_n(unsigned int, const char *, unsigned int);
 void			uart_flush(unsigned int);
 void			uart_clear_send_queue(unsigned int);
 _Bool			uart_empty(unsigned int);
 unsigned int	uart_receive(unsigned int);
+unsigned int	uart_receive_n(unsigned int, char *, unsigned int);
+unsigned int	uart_receive_peek(unsigned int, const char **);
+void			uart_receive_skip(unsigned int, unsigned int);
 void			uart_clear_receive_queue(unsigned int);
 void			uart_set_initial(unsigned int uart);
 
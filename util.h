@@ -14,6 +14,7 @@
 #include <stdarg.h>
 
 #include "attribute.h"
+#include "hash.h"
 
 typedef struct
 {